@@ -0,0 +1,21 @@
+#!/bin/bash
+
+# Builds an optimised interpreter for benchmarking.
+# usage: benchmarks/build.sh <output> [extra gcc flags...]
+
+cd "$(dirname "$0")/.."
+
+output=$1
+shift
+
+sources=$(python3 -c '
+import json
+data = json.load(open("compilation/compile_command.json"))
+print(" ".join(data["programs"] + data["modules"]))
+')
+flags=$(python3 -c '
+import json
+print(json.load(open("compilation/compile_command.json"))["flags"])
+')
+
+gcc -O2 "$@" $sources -o "$output" $flags
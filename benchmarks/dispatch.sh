@@ -0,0 +1,17 @@
+#!/bin/bash
+
+# Compares threaded (computed goto) dispatch against the portable switch loop.
+# usage: benchmarks/dispatch.sh
+
+cd "$(dirname "$0")/.."
+
+benchmarks/build.sh /tmp/hypl_threaded || exit 1
+benchmarks/build.sh /tmp/hypl_switch -DHVM_NO_COMPUTED_GOTO || exit 1
+
+for script in benchmarks/loop.hypl benchmarks/call.hypl; do
+  echo "== $script =="
+  echo "threaded:"
+  /tmp/hypl_threaded "$script"
+  echo "switch:"
+  /tmp/hypl_switch "$script"
+done
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+# Prints the collector's pause time histogram for the allocation benchmark
+# under a few pause targets, in milliseconds.
+# usage: benchmarks/gc_pause.sh [targets...]
+
+cd "$(dirname "$0")/.."
+
+benchmarks/build.sh /tmp/hypl_gc || exit 1
+
+targets=${@:-0.25 1 4}
+for target in $targets; do
+  echo "== --gc-pause=$target =="
+  /tmp/hypl_gc benchmarks/gc.hypl --gc-pause="$target" --gc-stats
+done
@@ -0,0 +1,16 @@
+#!/bin/bash
+
+# Runs the large heap benchmark with major collections on more and more
+# threads and prints the collector's pause statistics for each. One thread
+# is the incremental collector.
+# usage: benchmarks/gc_threads.sh [thread counts...]
+
+cd "$(dirname "$0")/.."
+
+benchmarks/build.sh /tmp/hypl_gc || exit 1
+
+counts=${@:-1 2 4 8}
+for threads in $counts; do
+  echo "== --gc-threads=$threads =="
+  /tmp/hypl_gc benchmarks/gc_heap.hypl --gc-threads="$threads" --gc-stats
+done
@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# Runs the prefork benchmark and prints, for each worker, the most memory it
+# held privately at any point: the pages it wrote to after the fork, and so
+# stopped sharing with the others.
+# usage: benchmarks/prefork.sh [workers]
+
+cd "$(dirname "$0")/.."
+
+benchmarks/build.sh /tmp/hypl_gc || exit 1
+
+workers=${1:-4}
+/tmp/hypl_gc benchmarks/prefork.hypl --prefork "$workers" > /dev/null &
+parent=$!
+
+declare -A most
+while kill -0 "$parent" 2> /dev/null; do
+  for child in $(cat /proc/"$parent"/task/"$parent"/children 2> /dev/null); do
+    kb=$(awk '/^Private_Dirty/ { print $2 }' /proc/"$child"/smaps_rollup 2> /dev/null)
+    if [ -n "$kb" ] && [ "$kb" -gt "${most[$child]:-0}" ]; then
+      most[$child]=$kb
+    fi
+    if [ -z "$heap" ]; then
+      heap=$(awk '/^Rss/ { print $2 }' /proc/"$parent"/smaps_rollup 2> /dev/null)
+    fi
+  done
+  sleep 0.05
+done
+
+echo "parent at fork: ${heap:-?} kB resident"
+for child in "${!most[@]}"; do
+  echo "worker $child: ${most[$child]} kB private"
+done
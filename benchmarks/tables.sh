@@ -0,0 +1,18 @@
+#!/bin/bash
+
+# Times the hash table workloads. Pass a second binary, e.g. one built from
+# an older revision, to time it on the same script.
+# usage: benchmarks/tables.sh [other-binary]
+
+cd "$(dirname "$0")/.."
+
+other=$1
+
+benchmarks/build.sh /tmp/hypl_bench || exit 1
+
+echo "== current =="
+/tmp/hypl_bench benchmarks/tables.hypl | grep "^time\|^strings"
+if [ -n "$other" ]; then
+  echo "== $other =="
+  "$other" benchmarks/tables.hypl | grep "^time\|^strings"
+fi
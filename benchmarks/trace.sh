@@ -0,0 +1,44 @@
+#!/bin/bash
+
+# Reports instructions per second for the lean loop and the tracing loop
+# (-d). The instruction count comes from a -DHVM_COUNT_INSTRUCTIONS build.
+# The lean loop runs with --no-jit so every instruction is interpreted; the
+# jit line is the same script with hot functions compiled.
+# Pass a second binary, e.g. one built from an older revision, to time it
+# on the same script.
+# usage: benchmarks/trace.sh [script] [other-binary]
+
+cd "$(dirname "$0")/.."
+
+script=${1:-benchmarks/trace.hypl}
+other=$2
+
+benchmarks/build.sh /tmp/hypl_bench || exit 1
+benchmarks/build.sh /tmp/hypl_count -DHVM_COUNT_INSTRUCTIONS || exit 1
+
+seconds() {
+  local start end
+  start=$(date +%s.%N)
+  "$@" > /dev/null
+  end=$(date +%s.%N)
+  awk "BEGIN { print $end - $start }"
+}
+
+count=$(/tmp/hypl_count "$script" | sed -n 's/^== \([0-9]*\) instructions executed ==$/\1/p')
+echo "instructions: $count"
+
+report() {
+  local name=$1
+  shift
+  local t
+  t=$(seconds "$@")
+  awk -v name="$name" -v t="$t" -v n="$count" \
+    'BEGIN { printf "%-8s %8.3fs %14.0f instructions/sec\n", name, t, n / t }'
+}
+
+report lean /tmp/hypl_bench "$script" --no-jit
+report jit /tmp/hypl_bench "$script"
+report traced /tmp/hypl_bench "$script" -d
+if [ -n "$other" ]; then
+  report other "$other" "$script"
+fi
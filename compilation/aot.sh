@@ -0,0 +1,27 @@
+#!/bin/bash
+
+# Compiles a script ahead of time into an executable: hypl --emit-c
+# translates it to C, which is built against the runtime sources.
+# usage: compilation/aot.sh <script.hypl> <output> [extra gcc flags...]
+
+root="$(cd "$(dirname "$0")/.." && pwd)"
+
+script=$1
+output=$2
+shift 2
+
+c_file="${output}.c"
+"$root/hypl" "$script" --emit-c > "$c_file" || exit 1
+
+sources=$(python3 -c '
+import json, sys
+root = sys.argv[1]
+data = json.load(open(root + "/compilation/compile_command.json"))
+print(" ".join(root + "/" + p for p in data["programs"] + data["modules"] if p != "hypl.c"))
+' "$root")
+flags=$(python3 -c '
+import json, sys
+print(json.load(open(sys.argv[1] + "/compilation/compile_command.json"))["flags"])
+' "$root")
+
+gcc -O2 "$@" -I"$root" "$c_file" $sources -o "$output" $flags
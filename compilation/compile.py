@@ -10,7 +10,7 @@ for filepath in data['programs']:
     command += filepath + ' '
 for filepath in data['modules']:
     command += filepath + ' '
-command = f"{command} -o {data['output']}"
+command = f"{command} -o {data['output']} {data['flags']}"
 
 print(command)
 
@@ -1,3 +1,3 @@
 #!/bin/bash
 
-gcc hypl.c hyperion/value.c hyperion/object.c hyperion/memory.c hyperion/HVM.c hyperion/chunk.c hyperion/debug.c hyperion/compiler.c hyperion/lexer.c hyperion/table.c hyperion/commandline.c hyperion/DMODE.c hyperion/std/time_module/time.c hyperion/std/math_module/math.c hyperion/std/type_conversion_module/type_conversion.c hyperion/std/file_io_module/file_io.c hyperion/std/console_module/console.c hyperion/std/list_module/list.c hyperion/std/sys_module/sys.c hyperion/std/os_module/os.c hyperion/std/string_module/string.c hyperion/std/random_module/random.c  -o hypl
\ No newline at end of file
+gcc hypl.c hyperion/value.c hyperion/object.c hyperion/memory.c hyperion/arena.c hyperion/HVM.c hyperion/chunk.c hyperion/debug.c hyperion/compiler.c hyperion/lexer.c hyperion/table.c hyperion/value_table.c hyperion/commandline.c hyperion/DMODE.c hyperion/optimizer.c hyperion/shape.c hyperion/jit.c hyperion/aot.c hyperion/emit_c.c hyperion/std/time_module/time.c hyperion/std/math_module/math.c hyperion/std/type_conversion_module/type_conversion.c hyperion/std/file_io_module/file_io.c hyperion/std/console_module/console.c hyperion/std/list_module/list.c hyperion/std/sys_module/sys.c hyperion/std/os_module/os.c hyperion/std/string_module/string.c hyperion/std/random_module/random.c hyperion/std/gc_module/gc.c hyperion/std/map_module/map.c hyperion/std/set_module/set.c  -o hypl -lm -pthread
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include "table.h"
 #include "memory.h"
 #include "DMODE.h"
+#include "jit.h"
 
 // <-- MODULES
 #include "std/time_module/time.h"
@@ -18,6 +19,9 @@
 #include "std/os_module/os.h"
 #include "std/string_module/string.h"
 #include "std/random_module/random.h"
+#include "std/gc_module/gc.h"
+#include "std/map_module/map.h"
+#include "std/set_module/set.h"
 // MODULES -->
 
 #include <stdarg.h>
@@ -73,6 +77,10 @@ static void init_stack() {
   hvm.openUpvalues = NULL;
 }
 
+// Tracebacks deeper than twice this show only the innermost and outermost
+// frames.
+#define TRACEBACK_EDGE 16
+
 static void runtime_error(const char* format, ...) {
   va_list args;
   va_start(args, format);
@@ -81,6 +89,11 @@ static void runtime_error(const char* format, ...) {
   fputs("\n", stderr);
 
   for (int i = hvm.frameCount - 1; i >= 0; i--) {
+    if (hvm.frameCount > 2 * TRACEBACK_EDGE && i == hvm.frameCount - TRACEBACK_EDGE - 1) {
+      fprintf(stderr, "... %d more frames ...\n", hvm.frameCount - 2 * TRACEBACK_EDGE);
+      i = TRACEBACK_EDGE;
+      continue;
+    }
     CallFrame* frame = &hvm.frames[i];
     ObjFunction* function = frame->closure->function;
     size_t instruction = frame->ip - function->chunk.code - 1;
@@ -95,41 +108,116 @@ static void runtime_error(const char* format, ...) {
   init_stack();
 }
 
-static void define_native(const char* name, NativeFn function) {
-  push(OBJ_VAL(copy_string(name, (int)strlen(name))));
-  push(OBJ_VAL(create_native(function)));
-  set_table(&hvm.globals, AS_STRING(hvm.stack[0]), hvm.stack[1]);
+// Returns the slot for a global, giving it a fresh undefined one the first
+// time the name is seen.
+int global_slot(ObjString* name) {
+  Value slot;
+  if (table_get(&hvm.globals, name, &slot)) return AS_INT(slot);
+
+  push(OBJ_VAL(name));
+  int index = hvm.global_values.size;
+  write_value_array(&hvm.global_values, UNDEFINED_VAL);
+  write_value_array(&hvm.global_names, OBJ_VAL(name));
+  set_table(&hvm.globals, name, INT_VAL(index));
   pop();
+
+  return index;
+}
+
+// The signature is one character per parameter, see ObjNative.
+void define_native(const char* name, NativeFn function, const char* signature) {
+  ObjString* string = copy_string(name, (int)strlen(name));
+  push(OBJ_VAL(string));
+  int slot = global_slot(string);
+  // The name string stays reachable through hvm.global_names.
+  hvm.global_values.values[slot] =
+      OBJ_VAL(create_native(function, string->chars, signature));
   pop();
 }
 
 void init_hvm() {
+  hvm.stack_capacity = STACK_INITIAL;
+  hvm.stack = (Value*)malloc(sizeof(Value) * hvm.stack_capacity);
+  hvm.frame_capacity = FRAMES_INITIAL;
+  hvm.frames = (CallFrame*)malloc(sizeof(CallFrame) * hvm.frame_capacity);
+  if (hvm.stack == NULL || hvm.frames == NULL) exit(1);
+
   init_stack();
-  hvm.objects = NULL;
+
+  hvm.instruction_count = 0;
+  hvm.cache_hits = 0;
+  hvm.cache_misses = 0;
 
   hvm.bytes_alloc = 0;
-  hvm.next_gc_limit = 1024 * 1024;
+  hvm.gc_heap_limit = GC_HEAP_LIMIT;
+  hvm.gc_grow_factor = GC_GROW_FACTOR;
+  hvm.next_gc_limit = GC_HEAP_LIMIT;
+
+  init_arena(&hvm.arena);
+  hvm.young_objects = NULL;
+  hvm.young_bytes = 0;
+
+  hvm.remembered_cnt = 0;
+  hvm.remembered_capacity = 0;
+  hvm.remembered = NULL;
+  hvm.collecting_young = false;
+
+  hvm.gc_phase = GC_IDLE;
+  hvm.gc_max_pause = GC_MAX_PAUSE;
+  hvm.step_bytes = 0;
+  hvm.scanning = NULL;
+  hvm.scanning_index = 0;
+  hvm.sweep_page = 0;
+  hvm.gc_threads = 1;
+
+  hvm.gc_pause_count = 0;
+  hvm.gc_pause_total = 0;
+  hvm.gc_pause_max = 0;
+  for (int i = 0; i < GC_PAUSE_BUCKETS; i++) hvm.gc_pauses[i] = 0;
+
+  hvm.gc_minor_count = 0;
+  hvm.gc_major_count = 0;
+  hvm.bytes_allocated = 0;
+  hvm.bytes_freed = 0;
+  hvm.peak_heap = 0;
+  for (int i = 0; i < OBJ_TYPE_COUNT; i++) hvm.object_counts[i] = 0;
 
   hvm.gray_cnt = 0;
   hvm.gray_capacity = 0;
   hvm.gray_stack = NULL;
 
   init_table(&hvm.globals);
+  create_value_array(&hvm.global_values);
+  create_value_array(&hvm.global_names);
   init_table(&hvm.strings);
 
+  hvm.root_shape = NULL;
+  hvm.root_shape = create_root_shape();
+
   hvm.initString = NULL;
   hvm.initString = copy_string("init", 4);
 
+  hvm.jit_enabled = !DMODE.mode;
+
   // define_native("clock", clock_native_function);
 }
 
 void free_hvm() {
   free_table(&hvm.globals);
+  free_value_array(&hvm.global_values);
+  free_value_array(&hvm.global_names);
   free_table(&hvm.strings);
 
   hvm.initString = NULL;
 
   free_objects();
+  free_shape_tree(hvm.root_shape);
+  hvm.root_shape = NULL;
+
+  free(hvm.stack);
+  hvm.stack = NULL;
+  free(hvm.frames);
+  hvm.frames = NULL;
 }
 
 void push(Value value) {
@@ -146,21 +234,130 @@ static Value peek_c(int distance) {
   return hvm.top[-1 - distance];
 }
 
+// Makes room for needed more values above top. The stack moves when it
+// grows, so frame slots and open upvalues are re-pointed into the new one.
+static void ensure_stack(int needed) {
+  int used = (int)(hvm.top - hvm.stack);
+  if (used + needed <= hvm.stack_capacity) return;
+
+  int capacity = hvm.stack_capacity;
+  while (capacity < used + needed) capacity *= 2;
+
+  Value* old = hvm.stack;
+  Value* stack = (Value*)malloc(sizeof(Value) * capacity);
+  if (stack == NULL) exit(1);
+  memcpy(stack, old, sizeof(Value) * used);
+
+  for (int i = 0; i < hvm.frameCount; i++) {
+    hvm.frames[i].slots = stack + (hvm.frames[i].slots - old);
+  }
+  for (ObjUpvalue* upvalue = hvm.openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+    upvalue->location = stack + (upvalue->location - old);
+  }
+
+  hvm.stack = stack;
+  hvm.stack_capacity = capacity;
+  hvm.top = stack + used;
+  free(old);
+}
+
 static bool call(ObjClosure* closure, int argCount) {
   if (argCount != closure->function->arity) {
     runtime_error("Expected %d arguments but got %d.", closure->function->arity, argCount);
     return false;
   }
 
-  if (hvm.frameCount == FRAMES_MAX) {
-    runtime_error("Stack overflow.");
-    return false;
+  if (hvm.frameCount == hvm.frame_capacity) {
+    if (hvm.frameCount == FRAMES_MAX) {
+      runtime_error("Stack overflow.");
+      return false;
+    }
+    hvm.frame_capacity *= 2;
+    hvm.frames = (CallFrame*)realloc(hvm.frames, sizeof(CallFrame) * hvm.frame_capacity);
+    if (hvm.frames == NULL) exit(1);
   }
 
+  // The callee and its arguments are already on the stack.
+  ensure_stack(closure->function->max_stack - argCount - 1 + STACK_SLACK);
+
   CallFrame* frame = &hvm.frames[hvm.frameCount++];
   frame->closure = closure;
   frame->ip = closure->function->chunk.code;
   frame->slots = hvm.top - argCount - 1;
+
+#ifdef HVM_JIT
+  if (++closure->function->hotness == JIT_HOT_THRESHOLD) {
+    jit_compile(closure->function);
+  }
+#endif
+  return true;
+}
+
+static const char* native_type_name(char type) {
+  switch (type) {
+    case 'i': return "an int";
+    case 'd': return "a double";
+    case 'n': return "a number";
+    case 's': return "a string";
+    case 'l': return "a list";
+    case 'm': return "a map";
+    case 'e': return "a set";
+    default: return "a value";
+  }
+}
+
+static inline uint8_t native_arg_kind(Value value) {
+  if (IS_DOUBLE(value)) return NATIVE_ARG_DOUBLE;
+  if (IS_INT(value)) return NATIVE_ARG_INT;
+  if (IS_STRING(value)) return NATIVE_ARG_STRING;
+  if (IS_LIST(value)) return NATIVE_ARG_LIST;
+  if (IS_MAP(value)) return NATIVE_ARG_MAP;
+  if (IS_SET(value)) return NATIVE_ARG_SET;
+  return NATIVE_ARG_OTHER;
+}
+
+static HVM_NOINLINE void native_args_error(ObjNative* native, int cnt,
+                                           int arg) {
+  if (cnt != native->arity) {
+    runtime_error("%s() expects %d arguments but got %d.",
+                  native->name, native->arity, cnt);
+  } else {
+    runtime_error("Argument %d of %s() must be %s.", arg + 1, native->name,
+                  native_type_name(native->signature[arg]));
+  }
+}
+
+// Checks a native call against the signature, then widens any int passed
+// where a double is expected in place.
+static inline bool check_native_args(ObjNative* native, int cnt, Value* args) {
+  if (cnt != native->arity) {
+    native_args_error(native, cnt, 0);
+    return false;
+  }
+  for (int i = 0; i < cnt; i++) {
+    uint8_t accepts = native->accepts[i];
+    if (accepts != NATIVE_ARG_ANY && !(accepts & native_arg_kind(args[i]))) {
+      native_args_error(native, cnt, i);
+      return false;
+    }
+  }
+  if (native->widen != 0) {
+    for (int i = 0; i < cnt; i++) {
+      if ((native->widen & (1 << i)) && IS_INT(args[i])) {
+        args[i] = DOUBLE_VAL((double)AS_INT(args[i]));
+      }
+    }
+  }
+  return true;
+}
+
+// Natives run on the caller's stack: the result replaces the callee and
+// the arguments are dropped, with no frame pushed.
+static inline bool call_native(ObjNative* native, int cnt) {
+  Value* args = hvm.top - cnt;
+  if (!check_native_args(native, cnt, args)) return false;
+  args[-1] = native->function(cnt, args);
+  hvm.top = args;
   return true;
 }
 
@@ -186,13 +383,8 @@ static bool call_value(Value callee, int cnt) {
       }
       case OBJ_CLOSURE:
         return call(AS_CLOSURE(callee), cnt);
-      case OBJ_NATIVE: {
-        NativeFn native = AS_NATIVE(callee);
-        Value result = native(cnt, hvm.top - cnt);
-        hvm.top -= cnt + 1;
-        push(result);
-        return true;
-      }
+      case OBJ_NATIVE:
+        return call_native(AS_NATIVE_OBJ(callee), cnt);
       default:
         break;
     }
@@ -201,16 +393,49 @@ static bool call_value(Value callee, int cnt) {
   return false;
 }
 
-static bool invoke_from_class(ObjClass* _class, ObjString* name, int cnt) {
+static CacheEntry* find_cache_entry(InlineCache* cache, ObjInstance* instance) {
+  for (int i = 0; i < cache->count; i++) {
+    CacheEntry* entry = &cache->entries[i];
+    if (entry->shape == instance->shape && entry->_class == instance->_class) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static void add_cache_entry(InlineCache* cache, ObjClass* _class, Shape* shape,
+                            int slot, Shape* transition, ObjClosure* method) {
+  if (cache->count == INLINE_CACHE_ENTRIES) return;
+
+  CacheEntry* entry = &cache->entries[cache->count++];
+  entry->_class = _class;
+  entry->shape = shape;
+  entry->slot = slot;
+  entry->transition = transition;
+  entry->method = method;
+
+  // The cache belongs to the running function's chunk.
+  Obj* function = (Obj*)hvm.frames[hvm.frameCount - 1].closure->function;
+  write_barrier(function, OBJ_VAL(_class));
+  if (method != NULL) write_barrier(function, OBJ_VAL(method));
+}
+
+// The functions below are the slow paths taken on an inline cache miss. They
+// do the full lookup and remember its result in the site's cache.
+
+static bool invoke_from_class(ObjInstance* instance, ObjString* name, int cnt,
+                              InlineCache* cache) {
   Value method;
-  if (!table_get(&_class->methods, name, &method)) {
+  if (!table_get(&instance->_class->methods, name, &method)) {
     runtime_error("Undefined property '%s'.", name->chars);
     return false;
   }
+  add_cache_entry(cache, instance->_class, instance->shape, -1, NULL,
+                  AS_CLOSURE(method));
   return call(AS_CLOSURE(method), cnt);
 }
 
-static bool invoke(ObjString* name, int cnt) {
+static bool invoke(ObjString* name, int cnt, InlineCache* cache) {
   Value receiver = peek_c(cnt);
 
   if (!IS_INSTANCE(receiver)) {
@@ -220,21 +445,26 @@ static bool invoke(ObjString* name, int cnt) {
 
   ObjInstance* instance = AS_INSTANCE(receiver);
 
-  Value value;
-  if (table_get(&instance->fields, name, &value)) {
+  int slot = shape_lookup(instance->shape, name);
+  if (slot >= 0) {
+    add_cache_entry(cache, instance->_class, instance->shape, slot, NULL, NULL);
+    Value value = instance->fields[slot];
     hvm.top[-cnt - 1] = value;
     return call_value(value, cnt);
   }
 
-  return invoke_from_class(instance->_class, name, cnt);
+  return invoke_from_class(instance, name, cnt, cache);
 }
 
-static bool bind_method(ObjClass* _class, ObjString* name) {
+static bool bind_method(ObjInstance* instance, ObjString* name,
+                        InlineCache* cache) {
   Value method;
-  if (!table_get(&_class->methods, name, &method)) {
+  if (!table_get(&instance->_class->methods, name, &method)) {
     runtime_error("Undefined property '%s'.", name->chars);
     return false;
   }
+  add_cache_entry(cache, instance->_class, instance->shape, -1, NULL,
+                  AS_CLOSURE(method));
 
   ObjBoundMethod* bound = create_bound_method(peek_c(0), AS_CLOSURE(method));
   pop();
@@ -242,6 +472,16 @@ static bool bind_method(ObjClass* _class, ObjString* name) {
   return true;
 }
 
+static void set_property(ObjInstance* instance, ObjString* name, Value value,
+                         InlineCache* cache) {
+  Shape* shape = instance->shape;
+  set_instance_field(instance, name, value);
+
+  Shape* transition = instance->shape == shape ? NULL : instance->shape;
+  add_cache_entry(cache, instance->_class, shape,
+                  shape_lookup(instance->shape, name), transition, NULL);
+}
+
 static ObjUpvalue* capture_upvalue(Value* local) {
   ObjUpvalue* prevUpvalue = NULL;
   ObjUpvalue* upvalue = hvm.openUpvalues;
@@ -272,14 +512,49 @@ static void close_upvalues(Value* last) {
     ObjUpvalue* upvalue = hvm.openUpvalues;
     upvalue->closed = *upvalue->location;
     upvalue->location = &upvalue->closed;
+    write_barrier((Obj*)upvalue, upvalue->closed);
     hvm.openUpvalues = upvalue->next;
   }
 }
 
+// Calls a closure in place of the current frame: upvalues over the frame are
+// closed, the callee and its arguments slide down to the frame's base and
+// the frame starts over in the new function. Any other callee gets an
+// ordinary call, and the OP_RETURN after OP_TAIL_CALL hands back its result.
+static bool tail_call(Value callee, int cnt) {
+  ObjClosure* closure;
+  if (IS_CLOSURE(callee)) {
+    closure = AS_CLOSURE(callee);
+  } else if (IS_BOUND_METHOD(callee)) {
+    ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
+    hvm.top[-cnt - 1] = bound->receiver;
+    closure = bound->method;
+  } else {
+    return call_value(callee, cnt);
+  }
+
+  if (cnt != closure->function->arity) {
+    runtime_error("Expected %d arguments but got %d.", closure->function->arity, cnt);
+    return false;
+  }
+
+  CallFrame* frame = &hvm.frames[hvm.frameCount - 1];
+  close_upvalues(frame->slots);
+  memmove(frame->slots, hvm.top - cnt - 1, sizeof(Value) * (cnt + 1));
+  hvm.top = frame->slots + cnt + 1;
+  ensure_stack(closure->function->max_stack - cnt - 1 + STACK_SLACK);
+
+  frame->closure = closure;
+  frame->ip = closure->function->chunk.code;
+  return true;
+}
+
 static void define_method(ObjString* name) {
   Value method = peek_c(0);
   ObjClass* _class = AS_CLASS(peek_c(1));
   set_table(&_class->methods, name, method);
+  write_barrier((Obj*)_class, OBJ_VAL(name));
+  write_barrier((Obj*)_class, method);
   pop();
 }
 
@@ -303,458 +578,454 @@ static void concatenate() {
   push(OBJ_VAL(result));
 }
 
-static InterReport execute() {
-  CallFrame* frame = &hvm.frames[hvm.frameCount - 1];
+static bool import_std(ObjString* name) {
+  if (strcmp(name->chars, "time") == 0) {
+    time_module_init();
+  } else if (strcmp(name->chars, "math") == 0) {
+    math_module_init();
+  } else if (strcmp(name->chars, "type_conv") == 0) {
+    type_conversion_module_init();
+  } else if (strcmp(name->chars, "file_io") == 0) {
+    file_io_module_init();
+  } else if (strcmp(name->chars, "console") == 0) {
+    console_module_init();
+  } else if (strcmp(name->chars, "list") == 0) {
+    list_module_init();
+  } else if (strcmp(name->chars, "sys") == 0) {
+    sys_module_init();
+  } else if (strcmp(name->chars, "os") == 0) {
+    os_module_init();
+  } else if (strcmp(name->chars, "string") == 0) {
+    string_module_init();
+  } else if (strcmp(name->chars, "random") == 0) {
+    random_module_init();
+  } else if (strcmp(name->chars, "gc") == 0) {
+    gc_module_init();
+  } else if (strcmp(name->chars, "map") == 0) {
+    map_module_init();
+  } else if (strcmp(name->chars, "set") == 0) {
+    set_module_init();
+  } else {
+    runtime_error("No Standard Module called '%s'", name->chars);
+    return false;
+  }
+  return true;
+}
 
-#define READ_BYTE() (*frame->ip++)
-
-#define READ_SHORT() \
-    (frame->ip += 2, \
-    (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
-
-#define READ_CONSTANT() \
-    (frame->closure->function->chunk.constants.values[READ_BYTE()])
-
-#define READ_STRING() AS_STRING(READ_CONSTANT())
-#define BINARY_OP(valueType, op) \
-  do { \
-    if (!( \
-        (IS_DOUBLE(peek_c(0)) && IS_DOUBLE(peek_c(1))) || \
-        (IS_INT(peek_c(0)) && IS_INT(peek_c(1))) \
-    )) { \
-      runtime_error("Operands must be numbers."); \
-      return INTER_RUNTIME_ERROR; \
-    } \
-    if (IS_DOUBLE(peek_c(0))) { \
-      double b = AS_DOUBLE(pop()); \
-      double a = AS_DOUBLE(pop()); \
-      push(valueType(a op b)); \
-    } else { \
-      int b = AS_INT(pop()); \
-      int a = AS_INT(pop()); \
-      push(valueType(a op b)); \
-    } \
-  } while (false)
-
-  while (true) {
-#ifdef DEBUG_TRACE_EXECUTION
-    if (DMODE.mode) {
-      printf("\t");
-      for (Value* pancake = hvm.stack; pancake < hvm.top; pancake++) {
-        printf("[ ");
-        print_value(*pancake);
-        printf(" ]");
-      }
-      printf("\n");
+// Runs the module to completion in a nested interpret(). Its result stands
+// for the rest of the importing run.
+static InterReport import_module(ObjString* name) {
+  char* module_name = name->chars;
+  replace_character(module_name, '@', '/');
+  char* extension = (char*)".hypl";
+
+  char* module = (char*)malloc(strlen(module_name) + strlen(extension) + 1);
+  strcat(module, module_name);
+  strcat(module, extension);
+
+  char* source_content = read_file(module);
+  if (source_content == NULL) {
+    runtime_error("No Module named: '%s'", module);
+    return INTER_RUNTIME_ERROR;
+  }
+
+  return interpret(source_content);
+}
+
+// Where a counted loop's bound lives. An undefined global comes back as
+// UNDEFINED_VAL for for_loop_test() to report.
+static inline Value for_bound(CallFrame* frame, const uint8_t* instruction) {
+  uint16_t index = (uint16_t)((instruction[3] << 8) | instruction[4]);
+  switch (instruction[2] & FOR_BOUND) {
+    case FOR_BOUND_LOCAL: return frame->slots[index];
+    case FOR_BOUND_GLOBAL: return hvm.global_values.values[index];
+    default: return frame->closure->function->chunk.constants.values[index];
+  }
+}
+
+static inline bool for_compare(int counter, int bound, uint8_t mode) {
+  switch (mode & FOR_COMPARE) {
+    case FOR_LESS: return counter < bound;
+    case FOR_LESS_EQUAL: return counter <= bound;
+    case FOR_GREATER: return counter > bound;
+    default: return counter >= bound;
+  }
+}
 
-      debug_instruction(&frame->closure->function->chunk,
-          (int)(frame->ip - frame->closure->function->chunk.code));
+// Steps and tests a counted loop's counter the way the condition and
+// increment it replaced would: inc and decr want an int, and the test two
+// ints or two doubles, with <= and >= being the negated > and < they
+// compile to. Reports the same errors, and returns false after one.
+static bool for_loop_test(CallFrame* frame, const uint8_t* instruction, bool* holds) {
+  uint8_t mode = instruction[2];
+  Value* counter = &frame->slots[instruction[1]];
+  if (instruction[0] == OP_FOR_LOOP) {
+    if (!IS_INT(*counter)) {
+      runtime_error("Operands must be two integers.");
+      return false;
     }
-#endif
+    *counter = INT_VAL(AS_INT(*counter) + FOR_STEP(mode));
+  }
 
-    uint8_t instruction;
-    switch (instruction = READ_BYTE()) {
-      case OP_BUILD_LIST: {
-        ObjList* list = create_list();
-        uint8_t itemCount = READ_BYTE();
-        push(OBJ_VAL(list));
-        for (int i = itemCount; i > 0; i--) {
-          push_back_to_list(list, peek_c(i));
-        }
-        pop();
-        while (itemCount-- > 0) {
-          pop();
-        }
-        push(OBJ_VAL(list));
-        break;
-      }
-      case OP_INDEX_SUBSCR: {
-        Value index = pop();
-        Value indexable = pop();
-        Value result;
-
-        if (!IS_LIST(indexable)) {
-          runtime_error("Invalid type to index into.");
-          return INTER_RUNTIME_ERROR;
-        }
+  Value bound = for_bound(frame, instruction);
+  if (IS_UNDEFINED(bound)) {
+    uint16_t slot = (uint16_t)((instruction[3] << 8) | instruction[4]);
+    runtime_error("Undefined variable '%s'.",
+        AS_STRING(hvm.global_names.values[slot])->chars);
+    return false;
+  }
 
-        ObjList* list = AS_LIST(indexable);
-        if (!IS_INT(index)) {
-          runtime_error("List index is not a number.");
-          return INTER_RUNTIME_ERROR;
-        } else if (!is_valid_list_index(list, AS_INT(index))) {
-          runtime_error("List index out of range.");
-          return INTER_RUNTIME_ERROR;
-        }
-        result = index_from_list(list, AS_INT(index));
-        push(result);
-        break;
-      }
-      case OP_STORE_SUBSCR: {
-        Value item = pop();
-        Value index = pop();
-        Value indexable = pop();
-
-         if (!IS_LIST(indexable)) {
-          runtime_error("Cannot store value in a non-list.");
-          return INTER_RUNTIME_ERROR;
-        }
+  if (IS_INT(*counter) && IS_INT(bound)) {
+    *holds = for_compare(AS_INT(*counter), AS_INT(bound), mode);
+    return true;
+  }
+  if (!IS_DOUBLE(*counter) || !IS_DOUBLE(bound)) {
+    runtime_error("Operands must be numbers.");
+    return false;
+  }
 
-        ObjList* list = AS_LIST(indexable);
-        if (!IS_INT(index)) {
-            runtime_error("List index is not a number.");
-            return INTER_RUNTIME_ERROR;
-        } else if (!is_valid_list_index(list, AS_INT(index))) {
-          runtime_error("List index out of range.");
-          return INTER_RUNTIME_ERROR;
-        }
-        store_to_list(list, AS_INT(index), item);
-        push(item);
-        break;
-      }
-      case OP_INVOKE: {
-        ObjString* method = READ_STRING();
-        int cnt = READ_BYTE();
-        if (!invoke(method, cnt)) {
-          return INTER_RUNTIME_ERROR;
-        }
-        frame = &hvm.frames[hvm.frameCount - 1];
-        break;
-      }
-      case OP_METHOD:
-        define_method(READ_STRING());
-        break;
-      case OP_GET_PROPERTY: {
-        if (!IS_INSTANCE(peek_c(0))) {
-          runtime_error("Only instances have properties.");
-          return INTER_RUNTIME_ERROR;
-        }
+  double a = AS_DOUBLE(*counter);
+  double b = AS_DOUBLE(bound);
+  switch (mode & FOR_COMPARE) {
+    case FOR_LESS: *holds = a < b; break;
+    case FOR_LESS_EQUAL: *holds = !(a > b); break;
+    case FOR_GREATER: *holds = a > b; break;
+    default: *holds = !(a < b); break;
+  }
+  return true;
+}
 
-        ObjInstance* instance = AS_INSTANCE(peek_c(0));
-        ObjString* name = READ_STRING();
+static void build_list(int count) {
+  ObjList* list = create_list();
+  push(OBJ_VAL(list));
+  for (int i = count; i > 0; i--) {
+    push_back_to_list(list, peek_c(i));
+  }
+  pop();
+  while (count-- > 0) {
+    pop();
+  }
+  push(OBJ_VAL(list));
+}
 
-        Value value;
-        if (table_get(&instance->fields, name, &value)) {
-          pop();
-          push(value);
-          break;
-        }
+static HVM_NOINLINE void unhashable_key_error() {
+  runtime_error("Map keys must be ints, doubles, bools, nil or strings.");
+}
 
-        if (!bind_method(instance->_class, name)) {
-          return INTER_RUNTIME_ERROR;
-        }
-        break;
-      }
-      case OP_SET_PROPERTY: {
-        if (!IS_INSTANCE(peek_c(1))) {
-          runtime_error("Only instances have fields.");
-          return INTER_RUNTIME_ERROR;
-        }
+// The pairs are on the stack, each key below its value, so everything
+// stays reachable while the map grows.
+static bool build_map(int count) {
+  ObjMap* map = create_map();
+  push(OBJ_VAL(map));
+  for (int i = count; i > 0; i--) {
+    Value key = peek_c(2 * i);
+    if (!is_hashable(key)) {
+      unhashable_key_error();
+      return false;
+    }
+    store_to_map(map, key, peek_c(2 * i - 1));
+  }
+  pop();
+  hvm.top -= 2 * count;
+  push(OBJ_VAL(map));
+  return true;
+}
 
-        ObjInstance* instance = AS_INSTANCE(peek_c(1));
-        set_table(&instance->fields, READ_STRING(), peek_c(0));
-        Value value = pop();
-        pop();
-        push(value);
-        break;
-      }
-      case OP_CONSTANT: {
-        Value constant = READ_CONSTANT();
-        push(constant);
-        break;
-      }
-      case OP_CLASS:
-        push(OBJ_VAL(create_class(READ_STRING())));
-        break;
-      case OP_CLOSURE: {
-        ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
-        ObjClosure* closure = create_closure(function);
-        push(OBJ_VAL(closure));
-        for (int i = 0; i < closure->upvalueCount; i++) {
-          uint8_t isLocal = READ_BYTE();
-          uint8_t index = READ_BYTE();
-          if (isLocal) {
-            closure->upvalues[i] = capture_upvalue(frame->slots + index);
-          } else {
-            closure->upvalues[i] = frame->closure->upvalues[index];
-          }
-        }
-        break;
-      }
-      case OP_CLOSE_UPVALUE:
-        close_upvalues(hvm.top - 1);
-        pop();
-        break;
-      case OP_GET_UPVALUE: {
-        uint8_t slot = READ_BYTE();
-        push(*frame->closure->upvalues[slot]->location);
-        break;
-      }
-      case OP_SET_UPVALUE: {
-        uint8_t slot = READ_BYTE();
-        *frame->closure->upvalues[slot]->location = peek_c(0);
-        break;
-      }
-      case OP_PRINT_TOLINE: {
-        print_value(pop());
-        break;
-      }
-      case OP_PRINT: {
-        print_value(pop());
-        printf("\n");
-        break;
-      }
-      case OP_CALL: {
-        int cnt = READ_BYTE();
-        if (!call_value(peek_c(cnt), cnt)) {
-          return INTER_RUNTIME_ERROR;
-        }
-        frame = &hvm.frames[hvm.frameCount - 1];
-        break;
-      }
-      case OP_JUMP_IF_FALSE: {
-        uint16_t offset = READ_SHORT();
-        if (isFalsey(peek_c(0))) frame->ip += offset;
-        break;
-      }
-      case OP_JUMP: {
-        uint16_t offset = READ_SHORT();
-        frame->ip += offset;
-        break;
-      }
-      case OP_LOOP: {
-        uint16_t offset = READ_SHORT();
-        frame->ip -= offset;
-        break;
-      }
-      case OP_POP: {
-        pop();
-        break;               
-      }
-      case OP_GET_LOCAL: {
-        uint8_t slot = READ_BYTE();
-        push(frame->slots[slot]);
-        break;
-      }
-      case OP_SET_LOCAL: {
-        uint8_t slot = READ_BYTE();
-        frame->slots[slot] = peek_c(0);
-        break;
-      }
-      case OP_DEFINE_GLOBAL: {
-        ObjString* name = READ_STRING();
-        set_table(&hvm.globals, name, peek_c(0));
-        pop();
-        break;
-      }
-      case OP_IMPORT_MODULE: {
-        ObjString *name = READ_STRING();
+static bool index_subscr() {
+  Value index = pop();
+  Value indexable = pop();
+
+  if (IS_MAP(indexable)) {
+    Value value;
+    if (!is_hashable(index)) {
+      unhashable_key_error();
+      return false;
+    } else if (!get_from_map(AS_MAP(indexable), index, &value)) {
+      runtime_error("Key not found in map.");
+      return false;
+    }
+    push(value);
+    return true;
+  }
+
+  if (!IS_LIST(indexable)) {
+    runtime_error("Only lists and maps can be indexed.");
+    return false;
+  }
 
-        char* module_name = name->chars;
-        replace_character(module_name, '@', '/');
-        char* extension = (char*)".hypl";
+  ObjList* list = AS_LIST(indexable);
+  if (!IS_INT(index)) {
+    runtime_error("List index is not a number.");
+    return false;
+  } else if (!is_valid_list_index(list, AS_INT(index))) {
+    runtime_error("List index out of range.");
+    return false;
+  }
+  push(index_from_list(list, AS_INT(index)));
+  return true;
+}
 
-        char* module = (char*)malloc(strlen(module_name) + strlen(extension) + 1);
-        strcat(module, module_name);
-        strcat(module, extension);
+static bool store_subscr() {
+  Value item = peek_c(0);
+  Value index = peek_c(1);
+  Value indexable = peek_c(2);
+
+  // A new key can grow the map, so the operands stay on the stack until
+  // it is stored.
+  if (IS_MAP(indexable)) {
+    if (!is_hashable(index)) {
+      unhashable_key_error();
+      return false;
+    }
+    store_to_map(AS_MAP(indexable), index, item);
+    hvm.top -= 3;
+    push(item);
+    return true;
+  }
 
-        char* source_content = read_file(module);
-        if (source_content == NULL) {
-          runtime_error("No Module named: '%s'", module);
-          return INTER_RUNTIME_ERROR;
-        }
+  hvm.top -= 3;
+  if (!IS_LIST(indexable)) {
+    runtime_error("Only lists and maps can be stored into.");
+    return false;
+  }
 
-        return interpret(source_content);
-      }
-      case OP_IMPORT_STD: {
-        ObjString *name = READ_STRING();
-        if (strcmp(name->chars, "time") == 0) {
-          time_module_init();
-        } else if (strcmp(name->chars, "math") == 0) {
-          math_module_init();
-        } else if (strcmp(name->chars, "type_conv") == 0) {
-          type_conversion_module_init();
-        } else if (strcmp(name->chars, "file_io") == 0) {
-          file_io_module_init();
-        } else if (strcmp(name->chars, "console") == 0) {
-          console_module_init();
-        } else if (strcmp(name->chars, "list") == 0) {
-          list_module_init();
-        } else if (strcmp(name->chars, "sys") == 0) {
-          sys_module_init();
-        } else if (strcmp(name->chars, "os") == 0) {
-          os_module_init();
-        } else if (strcmp(name->chars, "string") == 0) {
-          string_module_init();
-        } else if (strcmp(name->chars, "random") == 0) {
-          random_module_init();
-        } else {
-          runtime_error("No Standard Module called '%s'", name->chars);
-          return INTER_RUNTIME_ERROR;
-        }
-        break;
-      }
-      case OP_GET_GLOBAL: {
-        ObjString* name = READ_STRING();
-        Value value;
-        if (!table_get(&hvm.globals, name, &value)) {
-          runtime_error("Undefined variable '%s'.", name->chars);
-          return INTER_RUNTIME_ERROR;
-        }
-        push(value);
-        break;
-      }
-      case OP_SET_GLOBAL: {
-        ObjString* name = READ_STRING();
-        if (set_table(&hvm.globals, name, peek_c(0))) {
-          table_delete(&hvm.globals, name); 
-          runtime_error("Undefined variable '%s'.", name->chars);
-          return INTER_RUNTIME_ERROR;
-        }
-        break;
-      }
-      case OP_NOT: {
-        push(BOOL_VAL(isFalsey(pop())));
-        break;
-      }
-      case OP_NEGATE: {
-        if (!IS_INT(peek_c(0)) && !IS_DOUBLE(peek_c(0))) {
-          runtime_error("Operand must be a number.");
-          return INTER_RUNTIME_ERROR;
-        }
-        if (IS_INT(peek_c(0))) {
-          push(INT_VAL(-AS_INT(pop())));
-        } else {
-          push(DOUBLE_VAL(-AS_DOUBLE(pop())));
-        }
-        break;
-      }
-      case OP_TRUE:
-        push(BOOL_VAL(true));
-        break;
-      case OP_FALSE:
-        push(BOOL_VAL(false));
-        break;
-      case OP_NIL:
-        push(NIL_VAL);
-        break;
-      case OP_EQUAL: {
-        Value b = pop();
-        Value a = pop();
-        push(BOOL_VAL(are_equal(a, b)));
-        break;
-      }
-      case OP_GREATER:
-        BINARY_OP(BOOL_VAL, >);
-        break;
-      case OP_LESS:
-        BINARY_OP(BOOL_VAL, <);
-        break;
-      case OP_ADD: {
-        if (IS_INT(peek_c(0)) && IS_INT(peek_c(1))) {
-          int b = AS_INT(pop());
-          int a = AS_INT(pop());
-          push(INT_VAL(a + b));
-        } else {
-          runtime_error("Operands must be two integers.");
-          return INTER_RUNTIME_ERROR;
-        }
-        break;
-      }
-      case OP_ADD_S: {
-        if (IS_STRING(peek_c(0)) && IS_STRING(peek_c(1))) {
-          concatenate();
-        } else {
-          runtime_error("Operands must be two strings.");
-          return INTER_RUNTIME_ERROR;
-        }
-        break;
-      }
-      case OP_ADD_D: {
-        if (IS_DOUBLE(peek_c(0)) && IS_DOUBLE(peek_c(0))) {
-          double b = AS_DOUBLE(pop());
-          double a = AS_DOUBLE(pop());
-          push(DOUBLE_VAL(a + b));
-        } else {
-          runtime_error("Operands must be two doubles.");
-          return INTER_RUNTIME_ERROR;
-        }
-        break;
-      }
-      case OP_MINUS: {
-        BINARY_OP(INT_VAL, -);
-        break;
-      }
-      case OP_MINUS_D: {
-        BINARY_OP(DOUBLE_VAL, -);
-        break;
-      }
-      case OP_POWER: {
-        do {
-          if (!IS_INT(peek_c(0)) || !IS_INT(peek_c(1))) {
-            runtime_error("Operands must be integers.");
-            return INTER_RUNTIME_ERROR;
-          }
-          int b = AS_INT(pop());
-          int a = AS_INT(pop());
-          int res = (a ^ b);
-          push(INT_VAL(res));
-        } while (false);
-        break;
-      }
-      case OP_MODULE: {
-        do {
-          if (!IS_INT(peek_c(0)) || !IS_INT(peek_c(1))) {
-            runtime_error("Operands must be integers.");
-            return INTER_RUNTIME_ERROR;
-          }
-          int b = (int) AS_INT(pop());
-          int a = (int) AS_INT(pop());
-          int res = (a % b);
-          push(INT_VAL(res));
-        } while (false);
-        break;
-      }
-      case OP_MULTI: {
-        BINARY_OP(INT_VAL, *);
-        break;
-      }
-      case OP_MULTI_D: {
-        BINARY_OP(DOUBLE_VAL, *);
-        break;
-      }
-      case OP_DIVIDE: {
-        BINARY_OP(INT_VAL, /);
-        break;
-      }
-      case OP_DIVIDE_D: {
-        BINARY_OP(DOUBLE_VAL, /);
-        break;
-      }
-      case OP_RETURN: {
-        Value result = pop();
-        close_upvalues(frame->slots);
-        hvm.frameCount--;
-        if (hvm.frameCount == 0) {
-          pop();
-          return INTER_OK;
-        }
-        hvm.top = frame->slots;
-        push(result);
-        frame = &hvm.frames[hvm.frameCount - 1];
-        break;
-      }
+  ObjList* list = AS_LIST(indexable);
+  if (!IS_INT(index)) {
+    runtime_error("List index is not a number.");
+    return false;
+  } else if (!is_valid_list_index(list, AS_INT(index))) {
+    runtime_error("List index out of range.");
+    return false;
+  }
+  store_to_list(list, AS_INT(index), item);
+  push(item);
+  return true;
+}
+
+// Runtime entry points for compiled code, the JIT's and the C that
+// --emit-c writes. Each does what the interpreter's handler for the
+// instruction does, without the cache counters the tracing loop keeps, and
+// reports through its JitStatus whether the generated code may carry on.
+
+JitStatus jit_call_value(int cnt) {
+  int frame_count = hvm.frameCount;
+  if (!call_value(peek_c(cnt), cnt)) return JIT_ERROR;
+  return hvm.frameCount == frame_count ? JIT_CONTINUE : JIT_CALLED;
+}
+
+JitStatus jit_tail_call(int cnt) {
+  int frame_count = hvm.frameCount;
+  uint8_t* ip = hvm.frames[frame_count - 1].ip;
+  if (!tail_call(peek_c(cnt), cnt)) return JIT_ERROR;
+  if (hvm.frameCount != frame_count || hvm.frames[frame_count - 1].ip != ip) {
+    return JIT_CALLED;
+  }
+  return JIT_CONTINUE;
+}
+
+JitStatus jit_invoke(ObjString* name, int cnt, InlineCache* cache) {
+  int frame_count = hvm.frameCount;
+  Value receiver = peek_c(cnt);
+  CacheEntry* entry = IS_INSTANCE(receiver)
+      ? find_cache_entry(cache, AS_INSTANCE(receiver)) : NULL;
+
+  bool ok;
+  if (entry == NULL) {
+    ok = invoke(name, cnt, cache);
+  } else if (entry->slot < 0) {
+    ok = call(entry->method, cnt);
+  } else {
+    Value value = AS_INSTANCE(receiver)->fields[entry->slot];
+    hvm.top[-cnt - 1] = value;
+    ok = call_value(value, cnt);
+  }
+
+  if (!ok) return JIT_ERROR;
+  return hvm.frameCount == frame_count ? JIT_CONTINUE : JIT_CALLED;
+}
+
+JitStatus jit_get_property(ObjString* name, InlineCache* cache) {
+  if (!IS_INSTANCE(peek_c(0))) {
+    runtime_error("Only instances have properties.");
+    return JIT_ERROR;
+  }
+
+  ObjInstance* instance = AS_INSTANCE(peek_c(0));
+  CacheEntry* entry = find_cache_entry(cache, instance);
+  if (entry != NULL) {
+    if (entry->slot >= 0) {
+      hvm.top[-1] = instance->fields[entry->slot];
+    } else {
+      hvm.top[-1] = OBJ_VAL(create_bound_method(peek_c(0), entry->method));
+    }
+    return JIT_CONTINUE;
+  }
+
+  int slot = shape_lookup(instance->shape, name);
+  if (slot >= 0) {
+    add_cache_entry(cache, instance->_class, instance->shape, slot, NULL, NULL);
+    hvm.top[-1] = instance->fields[slot];
+    return JIT_CONTINUE;
+  }
+
+  return bind_method(instance, name, cache) ? JIT_CONTINUE : JIT_ERROR;
+}
+
+JitStatus jit_set_property(ObjString* name, InlineCache* cache) {
+  if (!IS_INSTANCE(peek_c(1))) {
+    runtime_error("Only instances have fields.");
+    return JIT_ERROR;
+  }
+
+  ObjInstance* instance = AS_INSTANCE(peek_c(1));
+  CacheEntry* entry = find_cache_entry(cache, instance);
+  if (entry != NULL && entry->slot < instance->field_capacity) {
+    if (entry->transition != NULL) instance->shape = entry->transition;
+    instance->fields[entry->slot] = peek_c(0);
+    write_barrier((Obj*)instance, peek_c(0));
+  } else {
+    set_property(instance, name, peek_c(0), cache);
+  }
+  Value value = pop();
+  pop();
+  push(value);
+  return JIT_CONTINUE;
+}
+
+JitStatus jit_index_subscr() {
+  return index_subscr() ? JIT_CONTINUE : JIT_ERROR;
+}
+
+JitStatus jit_store_subscr() {
+  return store_subscr() ? JIT_CONTINUE : JIT_ERROR;
+}
+
+JitStatus jit_build_list(int count) {
+  build_list(count);
+  return JIT_CONTINUE;
+}
+
+JitStatus jit_build_map(int count) {
+  return build_map(count) ? JIT_CONTINUE : JIT_ERROR;
+}
+
+JitStatus jit_concatenate() {
+  if (!IS_STRING(peek_c(0)) || !IS_STRING(peek_c(1))) {
+    runtime_error("Operands must be two strings.");
+    return JIT_ERROR;
+  }
+  concatenate();
+  return JIT_CONTINUE;
+}
+
+JitStatus jit_print(bool newline) {
+  print_value(pop());
+  if (newline) printf("\n");
+  return JIT_CONTINUE;
+}
+
+JitStatus jit_close_upvalue() {
+  close_upvalues(hvm.top - 1);
+  pop();
+  return JIT_CONTINUE;
+}
+
+JitStatus jit_return() {
+  CallFrame* frame = &hvm.frames[hvm.frameCount - 1];
+  Value result = pop();
+  close_upvalues(frame->slots);
+  hvm.frameCount--;
+  if (hvm.frameCount == 0) {
+    pop();
+    return JIT_RETURNED;
+  }
+  hvm.top = frame->slots;
+  push(result);
+  return JIT_RETURNED;
+}
+
+JitStatus jit_closure(ObjFunction* function, const uint8_t* upvalues) {
+  CallFrame* frame = &hvm.frames[hvm.frameCount - 1];
+  ObjClosure* closure = create_closure(function);
+  push(OBJ_VAL(closure));
+  for (int i = 0; i < closure->upvalueCount; i++) {
+    uint8_t isLocal = upvalues[2 * i];
+    uint8_t index = upvalues[2 * i + 1];
+    if (isLocal) {
+      closure->upvalues[i] = capture_upvalue(frame->slots + index);
+    } else {
+      closure->upvalues[i] = frame->closure->upvalues[index];
     }
+    write_barrier((Obj*)closure, OBJ_VAL(closure->upvalues[i]));
   }
+  return JIT_CONTINUE;
+}
+
+JitStatus jit_class(ObjString* name) {
+  push(OBJ_VAL(create_class(name)));
+  return JIT_CONTINUE;
+}
+
+JitStatus jit_method(ObjString* name) {
+  define_method(name);
+  return JIT_CONTINUE;
+}
 
-#undef READ_CONSTANT
-#undef READ_STRING
-#undef BINARY_OP
-#undef READ_BYTE
-#undef READ_SHORT
+JitStatus jit_import_std(ObjString* name) {
+  return import_std(name) ? JIT_CONTINUE : JIT_ERROR;
+}
+
+// Like OP_IMPORT_MODULE, the nested run's result is the result of the whole
+// program. It is kept here for run_compiled() to return.
+static InterReport import_report;
+
+JitStatus jit_import_module(ObjString* name) {
+  import_report = import_module(name);
+  return JIT_FINISHED;
+}
 
+JitStatus jit_error(const char* message) {
+  runtime_error("%s", message);
+  return JIT_ERROR;
 }
 
+JitStatus jit_for_loop(const uint8_t* instruction, bool* holds) {
+  CallFrame* frame = &hvm.frames[hvm.frameCount - 1];
+  return for_loop_test(frame, instruction, holds) ? JIT_CONTINUE : JIT_ERROR;
+}
+
+JitStatus jit_undefined_global(int slot) {
+  runtime_error("Undefined variable '%s'.",
+      AS_STRING(hvm.global_names.values[slot])->chars);
+  return JIT_ERROR;
+}
+
+#ifdef DEBUG_TRACE_EXECUTION
+static void trace_instruction(CallFrame* frame) {
+  hvm.instruction_count++;
+
+  printf("\t");
+  for (Value* pancake = hvm.stack; pancake < hvm.top; pancake++) {
+    printf("[ ");
+    print_value(*pancake);
+    printf(" ]");
+  }
+  printf("\n");
+
+  debug_instruction(&frame->closure->function->chunk,
+      (int)(frame->ip - frame->closure->function->chunk.code));
+}
+#endif
+
+#define EXECUTE_FUNCTION execute
+#include "HVM_loop.h"
+
+#ifdef DEBUG_TRACE_EXECUTION
+#define EXECUTE_TRACED
+#define EXECUTE_FUNCTION execute_traced
+#include "HVM_loop.h"
+#endif
+
 InterReport interpret(const char *source) {
   ObjFunction* function = compile(source);
   if (function == NULL) return INTER_COMPILE_ERROR;
@@ -766,9 +1037,69 @@ InterReport interpret(const char *source) {
   push(OBJ_VAL(closure));
   call(closure, 0);
 
+#ifdef DEBUG_TRACE_EXECUTION
+  InterReport res = DMODE.mode ? execute_traced() : execute();
+#else
+  InterReport res = execute();
+#endif
+
+  return res;
+}
+
+// Calls the global function called name with one argument, as a run of its
+// own once the script has finished. --prefork starts each worker this way.
+InterReport call_global(const char* name, Value argument) {
+  ObjString* string = copy_string(name, (int)strlen(name));
+  Value slot;
+  if (!table_get(&hvm.globals, string, &slot) ||
+      IS_UNDEFINED(hvm.global_values.values[AS_INT(slot)])) {
+    runtime_error("Undefined function '%s'.", name);
+    return INTER_RUNTIME_ERROR;
+  }
+
+  Value callee = hvm.global_values.values[AS_INT(slot)];
+  push(callee);
+  push(argument);
+  if (!call_value(callee, 1)) return INTER_RUNTIME_ERROR;
+  // A native or a class without init() is done already.
+  if (hvm.frameCount == 0) {
+    init_stack();
+    return INTER_OK;
+  }
+
+#ifdef DEBUG_TRACE_EXECUTION
+  InterReport res = DMODE.mode ? execute_traced() : execute();
+#else
   InterReport res = execute();
+#endif
 
+  // The last return leaves the callee and its arguments behind.
+  init_stack();
   return res;
 }
 
+// Runs a program whose functions were all translated to C by --emit-c.
+// Each frame's C function picks up at frame->ip and returns whenever a call
+// or return changes the frame on top, so calls do not nest on the C stack.
+// A frame from an imported, interpreted module goes back to execute().
+InterReport run_compiled(ObjFunction* function) {
+  // The program is native already, so there is nothing for the JIT to do.
+  hvm.jit_enabled = false;
+
+  push(OBJ_VAL(function));
+  ObjClosure* closure = create_closure(function);
+  pop();
+  push(OBJ_VAL(closure));
+  call(closure, 0);
+
+  for (;;) {
+    CallFrame* frame = &hvm.frames[hvm.frameCount - 1];
+    CompiledFn compiled = frame->closure->function->compiled;
+    if (compiled == NULL) return execute();
 
+    JitStatus status = (JitStatus)compiled(frame);
+    if (status == JIT_ERROR) return INTER_RUNTIME_ERROR;
+    if (status == JIT_FINISHED) return import_report;
+    if (status == JIT_RETURNED && hvm.frameCount == 0) return INTER_OK;
+  }
+}
@@ -4,18 +4,58 @@
 #include <stdio.h>
 #include <stdarg.h>
 
+#include "arena.h"
 #include "object.h"
 #include "chunk.h"
 #include "table.h"
 
 #define DEBUG_TRACE_EXECUTION
 
+// Direct-threaded dispatch through a table of label addresses. Build with
+// -DHVM_NO_COMPUTED_GOTO to get the portable switch loop instead.
+#if defined(__GNUC__) && !defined(HVM_NO_COMPUTED_GOTO)
+#define HVM_COMPUTED_GOTO
+#endif
+
+// GCC's cross-jumping folds every handler's dispatch jump back into a single
+// shared one, which defeats the point of threading.
+#if defined(HVM_COMPUTED_GOTO) && !defined(__clang__)
+#define HVM_DISPATCH_FUNCTION __attribute__((optimize("no-crossjumping")))
+#else
+#define HVM_DISPATCH_FUNCTION
+#endif
+
+// Keeps cold error reporting out of the handlers that call it.
+#if defined(__GNUC__)
+#define HVM_NOINLINE __attribute__((noinline))
+#else
+#define HVM_NOINLINE
+#endif
+
 #define UINT8_COUNT (UINT8_MAX + 1)
 
-#define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+// The value and frame stacks start small and grow in call(), which checks
+// once per call that the callee's max_stack fits. STACK_SLACK is headroom
+// for the runtime's own short-lived pushes, such as keeping a new object
+// reachable while it is built. FRAMES_MAX only stops runaway recursion from
+// eating all memory.
+#define STACK_INITIAL 256
+#define STACK_SLACK 16
+#define FRAMES_INITIAL 16
+#define FRAMES_MAX (1 << 20)
+
+// Where the incremental major collection is. See memory.c.
+typedef enum {
+  GC_IDLE,
+  GC_MARK,
+  GC_SWEEP
+} GcPhase;
 
-typedef struct {
+// Pause times are counted in buckets by powers of two of microseconds:
+// bucket 0 is under 1us and bucket i from 2^(i-1) up to 2^i us.
+#define GC_PAUSE_BUCKETS 24
+
+typedef struct CallFrame {
   ObjClosure* closure;
 
   uint8_t* ip;
@@ -23,21 +63,97 @@ typedef struct {
 } CallFrame;
 
 typedef struct {
-  CallFrame frames[FRAMES_MAX];
+  CallFrame* frames;
   int frameCount;
+  int frame_capacity;
+
+  // Counted by the tracing loop, and by the lean loop only in builds with
+  // -DHVM_COUNT_INSTRUCTIONS.
+  size_t instruction_count;
+
+  // Inline cache hits and misses at property and invoke sites, counted by
+  // the tracing loop.
+  size_t cache_hits;
+  size_t cache_misses;
 
+  // Bytes the collector counts as in use: the arena's pages and what
+  // objects own. A major collection starts once it passes next_gc_limit,
+  // which each one sets to gc_grow_factor times what it leaves, and never
+  // below gc_heap_limit.
   size_t bytes_alloc;
   size_t next_gc_limit;
-
-  Value stack[STACK_MAX];
+  size_t gc_heap_limit;
+  double gc_grow_factor;
+
+  // Every object lives in a cell of the arena, young or old. See arena.h.
+  Arena arena;
+
+  // The young generation: objects allocated since the last collection.
+  // Bytes allocated since then, counting the memory those objects own,
+  // trigger a minor collection. See memory.c.
+  Obj* young_objects;
+  size_t young_bytes;
+
+  // Old objects written to since the last collection that may point at
+  // young ones. A minor collection treats them as roots.
+  int remembered_cnt;
+  int remembered_capacity;
+  Obj** remembered;
+  bool collecting_young;
+
+  // The major collection marks and sweeps the old generation a slice at a
+  // time, each slice running for about gc_max_pause seconds once step_bytes
+  // more have been allocated. A long list is marked a slice at a time from
+  // scanning_index. The sweep goes through the arena's pages in order, and
+  // sweep_page is the first it has not swept yet.
+  GcPhase gc_phase;
+  double gc_max_pause;
+  size_t step_bytes;
+  ObjList* scanning;
+  int scanning_index;
+  int sweep_page;
+
+  // With more than one thread, major collections stop the program and run
+  // in parallel instead. Set before the program starts.
+  int gc_threads;
+
+  // Every pause the collector made, for --gc-stats and the gc module.
+  size_t gc_pause_count;
+  double gc_pause_total;
+  double gc_pause_max;
+  size_t gc_pauses[GC_PAUSE_BUCKETS];
+
+  // Totals over the run. Allocated and freed bytes count objects' cells
+  // and the memory they own. peak_heap is the most bytes_alloc has been.
+  size_t gc_minor_count;
+  size_t gc_major_count;
+  size_t bytes_allocated;
+  size_t bytes_freed;
+  size_t peak_heap;
+  size_t object_counts[OBJ_TYPE_COUNT];
+
+  Value* stack;
+  int stack_capacity;
   Value* top;
   ObjUpvalue* openUpvalues;
-  Obj* objects;
+
+  // Globals live in dense slots handed out by the compiler. The table maps
+  // each name to INT_VAL(slot) so natives and imported modules that define a
+  // name at runtime land in the slot the compiled code already uses.
   Table globals;
+  ValueArray global_values;
+  ValueArray global_names;
+
   Table strings;
 
+  Shape* root_shape;
+
   ObjString* initString;
 
+  // Cleared by --no-jit and under -d, whose tracing needs every instruction
+  // to go through the interpreter.
+  bool jit_enabled;
+
   int gray_cnt;
   int gray_capacity;
   Obj** gray_stack;
@@ -63,16 +179,28 @@ void push(Value value);
 
 Value pop();
 
+int global_slot(ObjString* name);
+
+void define_native(const char* name, NativeFn function, const char* signature);
+
 static Value peek_c(int distance);
 
 static bool isFalsey(Value value);
 
 static void concatenate();
 
-static InterReport execute();
+HVM_DISPATCH_FUNCTION static InterReport execute();
+
+#ifdef DEBUG_TRACE_EXECUTION
+HVM_DISPATCH_FUNCTION static InterReport execute_traced();
+#endif
 
 InterReport interpret(const char *source);
 
+InterReport call_global(const char* name, Value argument);
+
+InterReport run_compiled(ObjFunction* function);
+
 #endif
 
 
@@ -0,0 +1,776 @@
+// The body of the interpreter loop. HVM.c includes this file once for the
+// lean loop and, with EXECUTE_TRACED defined, once more for the tracing loop
+// used under -d, so production runs pay nothing per instruction for tracing.
+//
+// Expects EXECUTE_FUNCTION to name the function being generated.
+
+HVM_DISPATCH_FUNCTION static InterReport EXECUTE_FUNCTION() {
+  CallFrame* frame = &hvm.frames[hvm.frameCount - 1];
+
+#if defined(EXECUTE_TRACED)
+#define TRACE_INSTRUCTION() trace_instruction(frame)
+#elif defined(HVM_COUNT_INSTRUCTIONS)
+#define TRACE_INSTRUCTION() hvm.instruction_count++
+#else
+#define TRACE_INSTRUCTION() do {} while (false)
+#endif
+
+#ifdef EXECUTE_TRACED
+#define COUNT_CACHE(counter) hvm.counter++
+#else
+#define COUNT_CACHE(counter) do {} while (false)
+#endif
+
+// Compiled code only runs from the lean loop. JIT_ENTER switches to it when
+// the frame execution continues in has been compiled.
+#if defined(HVM_JIT) && !defined(EXECUTE_TRACED)
+#define JIT_ENTER() \
+  do { \
+    if (frame->closure->function->jit != NULL) goto jit_enter; \
+  } while (false)
+// Back-edges count towards hotness, so a long loop is compiled and entered
+// at its header without waiting for another call.
+#define JIT_BACK_EDGE() \
+  do { \
+    ObjFunction* function_ = frame->closure->function; \
+    if (function_->jit != NULL || \
+        (++function_->hotness == JIT_HOT_THRESHOLD && jit_compile(function_))) { \
+      goto jit_enter; \
+    } \
+  } while (false)
+#else
+#define JIT_ENTER() do {} while (false)
+#define JIT_BACK_EDGE() do {} while (false)
+#endif
+
+#define READ_BYTE() (*frame->ip++)
+
+#define READ_SHORT() \
+    (frame->ip += 2, \
+    (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+
+#define READ_CONSTANT() \
+    (frame->closure->function->chunk.constants.values[READ_BYTE()])
+
+#define READ_STRING() AS_STRING(READ_CONSTANT())
+
+#define READ_CACHE() \
+    (&frame->closure->function->chunk.caches[READ_SHORT()])
+
+#define BINARY_OP(valueType, op) \
+  do { \
+    if (!( \
+        (IS_DOUBLE(peek_c(0)) && IS_DOUBLE(peek_c(1))) || \
+        (IS_INT(peek_c(0)) && IS_INT(peek_c(1))) \
+    )) { \
+      runtime_error("Operands must be numbers."); \
+      return INTER_RUNTIME_ERROR; \
+    } \
+    if (IS_DOUBLE(peek_c(0))) { \
+      double b = AS_DOUBLE(pop()); \
+      double a = AS_DOUBLE(pop()); \
+      push(valueType(a op b)); \
+    } else { \
+      int b = AS_INT(pop()); \
+      int a = AS_INT(pop()); \
+      push(valueType(a op b)); \
+    } \
+  } while (false)
+
+// Quickening: a generic opcode rewrites itself in the chunk into the
+// specialisation for the operand types it sees. A specialisation guards on
+// those types and, when they change, rewrites the generic opcode back and
+// re-dispatches to it, so semantics never depend on which form runs.
+#define QUICKEN_IF_INTS(specialised) \
+  do { \
+    if (IS_INT(peek_c(0)) && IS_INT(peek_c(1))) frame->ip[-1] = specialised; \
+  } while (false)
+
+#define QUICKEN_IF_DOUBLES(specialised) \
+  do { \
+    if (IS_DOUBLE(peek_c(0)) && IS_DOUBLE(peek_c(1))) frame->ip[-1] = specialised; \
+  } while (false)
+
+#define DEQUICKEN(generic) \
+  do { \
+    frame->ip[-1] = generic; \
+    frame->ip--; \
+    DISPATCH(); \
+  } while (false)
+
+// Specialisations test both tags with one branch and write the result over
+// the left operand in place.
+#define INT_OP(valueType, op, generic) \
+  do { \
+    Value b = peek_c(0); \
+    Value a = peek_c(1); \
+    if (!(IS_INT(a) & IS_INT(b))) DEQUICKEN(generic); \
+    hvm.top[-2] = valueType(AS_INT(a) op AS_INT(b)); \
+    hvm.top--; \
+  } while (false)
+
+#define DOUBLE_OP(valueType, op, generic) \
+  do { \
+    Value b = peek_c(0); \
+    Value a = peek_c(1); \
+    if (!(IS_DOUBLE(a) & IS_DOUBLE(b))) DEQUICKEN(generic); \
+    hvm.top[-2] = valueType(AS_DOUBLE(a) op AS_DOUBLE(b)); \
+    hvm.top--; \
+  } while (false)
+
+#ifdef HVM_COMPUTED_GOTO
+  static void* dispatch_table[] = {
+    [OP_BUILD_LIST] = &&op_OP_BUILD_LIST,
+    [OP_BUILD_MAP] = &&op_OP_BUILD_MAP,
+    [OP_INDEX_SUBSCR] = &&op_OP_INDEX_SUBSCR,
+    [OP_STORE_SUBSCR] = &&op_OP_STORE_SUBSCR,
+    [OP_POP] = &&op_OP_POP,
+    [OP_IMPORT_STD] = &&op_OP_IMPORT_STD,
+    [OP_IMPORT_MODULE] = &&op_OP_IMPORT_MODULE,
+    [OP_INVOKE] = &&op_OP_INVOKE,
+    [OP_METHOD] = &&op_OP_METHOD,
+    [OP_GET_PROPERTY] = &&op_OP_GET_PROPERTY,
+    [OP_SET_PROPERTY] = &&op_OP_SET_PROPERTY,
+    [OP_CLASS] = &&op_OP_CLASS,
+    [OP_CLOSURE] = &&op_OP_CLOSURE,
+    [OP_PRINT] = &&op_OP_PRINT,
+    [OP_PRINT_TOLINE] = &&op_OP_PRINT_TOLINE,
+    [OP_JUMP_IF_FALSE] = &&op_OP_JUMP_IF_FALSE,
+    [OP_LOOP] = &&op_OP_LOOP,
+    [OP_JUMP] = &&op_OP_JUMP,
+    [OP_FOR_PREP] = &&op_OP_FOR_PREP,
+    [OP_FOR_LOOP] = &&op_OP_FOR_LOOP,
+    [OP_CALL] = &&op_OP_CALL,
+    [OP_TAIL_CALL] = &&op_OP_TAIL_CALL,
+    [OP_DEFINE_GLOBAL] = &&op_OP_DEFINE_GLOBAL,
+    [OP_GET_GLOBAL] = &&op_OP_GET_GLOBAL,
+    [OP_SET_GLOBAL] = &&op_OP_SET_GLOBAL,
+    [OP_GET_LOCAL] = &&op_OP_GET_LOCAL,
+    [OP_SET_LOCAL] = &&op_OP_SET_LOCAL,
+    [OP_GET_UPVALUE] = &&op_OP_GET_UPVALUE,
+    [OP_SET_UPVALUE] = &&op_OP_SET_UPVALUE,
+    [OP_CLOSE_UPVALUE] = &&op_OP_CLOSE_UPVALUE,
+    [OP_NIL] = &&op_OP_NIL,
+    [OP_RETURN] = &&op_OP_RETURN,
+    [OP_CONSTANT] = &&op_OP_CONSTANT,
+    [OP_TRUE] = &&op_OP_TRUE,
+    [OP_FALSE] = &&op_OP_FALSE,
+    [OP_NOT] = &&op_OP_NOT,
+    [OP_NEGATE] = &&op_OP_NEGATE,
+    [OP_ADD] = &&op_OP_ADD,
+    [OP_MINUS] = &&op_OP_MINUS,
+    [OP_MULTI] = &&op_OP_MULTI,
+    [OP_ADD_D] = &&op_OP_ADD_D,
+    [OP_ADD_S] = &&op_OP_ADD_S,
+    [OP_MINUS_D] = &&op_OP_MINUS_D,
+    [OP_MULTI_D] = &&op_OP_MULTI_D,
+    [OP_MODULE] = &&op_OP_MODULE,
+    [OP_POWER] = &&op_OP_POWER,
+    [OP_DIVIDE] = &&op_OP_DIVIDE,
+    [OP_DIVIDE_D] = &&op_OP_DIVIDE_D,
+    [OP_EQUAL] = &&op_OP_EQUAL,
+    [OP_GREATER] = &&op_OP_GREATER,
+    [OP_LESS] = &&op_OP_LESS,
+    [OP_INC_LOCAL] = &&op_OP_INC_LOCAL,
+    [OP_ADD_LOCAL_CONST] = &&op_OP_ADD_LOCAL_CONST,
+    [OP_GET_LOCAL_GET_LOCAL] = &&op_OP_GET_LOCAL_GET_LOCAL,
+    [OP_LESS_JUMP_IF_FALSE] = &&op_OP_LESS_JUMP_IF_FALSE,
+    [OP_GREATER_JUMP_IF_FALSE] = &&op_OP_GREATER_JUMP_IF_FALSE,
+    [OP_LESS_INT] = &&op_OP_LESS_INT,
+    [OP_LESS_DOUBLE] = &&op_OP_LESS_DOUBLE,
+    [OP_GREATER_INT] = &&op_OP_GREATER_INT,
+    [OP_GREATER_DOUBLE] = &&op_OP_GREATER_DOUBLE,
+    [OP_MINUS_INT] = &&op_OP_MINUS_INT,
+    [OP_MINUS_DOUBLE] = &&op_OP_MINUS_DOUBLE,
+    [OP_MULTI_INT] = &&op_OP_MULTI_INT,
+    [OP_MULTI_DOUBLE] = &&op_OP_MULTI_DOUBLE,
+    [OP_DIVIDE_INT] = &&op_OP_DIVIDE_INT,
+    [OP_DIVIDE_DOUBLE] = &&op_OP_DIVIDE_DOUBLE,
+    [OP_CALL_NATIVE] = &&op_OP_CALL_NATIVE,
+  };
+
+#define CASE(op) op_##op
+#define DISPATCH() \
+    do { \
+      TRACE_INSTRUCTION(); \
+      goto *dispatch_table[READ_BYTE()]; \
+    } while (false)
+#define INTERPRET_LOOP DISPATCH();
+#else
+#define CASE(op) case op
+#define DISPATCH() goto loop
+#define INTERPRET_LOOP \
+    loop: \
+      TRACE_INSTRUCTION(); \
+      switch (READ_BYTE())
+#endif
+
+  INTERPRET_LOOP
+  {
+    CASE(OP_BUILD_LIST):
+      build_list(READ_BYTE());
+      DISPATCH();
+    CASE(OP_BUILD_MAP):
+      if (!build_map(READ_BYTE())) {
+        return INTER_RUNTIME_ERROR;
+      }
+      DISPATCH();
+    CASE(OP_INDEX_SUBSCR):
+      if (!index_subscr()) {
+        return INTER_RUNTIME_ERROR;
+      }
+      DISPATCH();
+    CASE(OP_STORE_SUBSCR):
+      if (!store_subscr()) {
+        return INTER_RUNTIME_ERROR;
+      }
+      DISPATCH();
+    CASE(OP_INVOKE): {
+      ObjString* method = READ_STRING();
+      int cnt = READ_BYTE();
+      InlineCache* cache = READ_CACHE();
+
+      Value receiver = peek_c(cnt);
+      CacheEntry* entry = IS_INSTANCE(receiver)
+          ? find_cache_entry(cache, AS_INSTANCE(receiver)) : NULL;
+      if (entry != NULL) {
+        COUNT_CACHE(cache_hits);
+        if (entry->slot < 0) {
+          if (!call(entry->method, cnt)) {
+            return INTER_RUNTIME_ERROR;
+          }
+        } else {
+          Value value = AS_INSTANCE(receiver)->fields[entry->slot];
+          hvm.top[-cnt - 1] = value;
+          if (!call_value(value, cnt)) {
+            return INTER_RUNTIME_ERROR;
+          }
+        }
+      } else {
+        COUNT_CACHE(cache_misses);
+        if (!invoke(method, cnt, cache)) {
+          return INTER_RUNTIME_ERROR;
+        }
+      }
+      frame = &hvm.frames[hvm.frameCount - 1];
+      JIT_ENTER();
+      DISPATCH();
+    }
+    CASE(OP_METHOD):
+      define_method(READ_STRING());
+      DISPATCH();
+    CASE(OP_GET_PROPERTY): {
+      if (!IS_INSTANCE(peek_c(0))) {
+        runtime_error("Only instances have properties.");
+        return INTER_RUNTIME_ERROR;
+      }
+
+      ObjInstance* instance = AS_INSTANCE(peek_c(0));
+      ObjString* name = READ_STRING();
+      InlineCache* cache = READ_CACHE();
+
+      CacheEntry* entry = find_cache_entry(cache, instance);
+      if (entry != NULL) {
+        COUNT_CACHE(cache_hits);
+        if (entry->slot >= 0) {
+          hvm.top[-1] = instance->fields[entry->slot];
+        } else {
+          hvm.top[-1] = OBJ_VAL(create_bound_method(peek_c(0), entry->method));
+        }
+        DISPATCH();
+      }
+      COUNT_CACHE(cache_misses);
+
+      int slot = shape_lookup(instance->shape, name);
+      if (slot >= 0) {
+        add_cache_entry(cache, instance->_class, instance->shape, slot, NULL, NULL);
+        hvm.top[-1] = instance->fields[slot];
+        DISPATCH();
+      }
+
+      if (!bind_method(instance, name, cache)) {
+        return INTER_RUNTIME_ERROR;
+      }
+      DISPATCH();
+    }
+    CASE(OP_SET_PROPERTY): {
+      if (!IS_INSTANCE(peek_c(1))) {
+        runtime_error("Only instances have fields.");
+        return INTER_RUNTIME_ERROR;
+      }
+
+      ObjInstance* instance = AS_INSTANCE(peek_c(1));
+      ObjString* name = READ_STRING();
+      InlineCache* cache = READ_CACHE();
+
+      // A cached transition only applies when the new slot already fits.
+      CacheEntry* entry = find_cache_entry(cache, instance);
+      if (entry != NULL && entry->slot < instance->field_capacity) {
+        COUNT_CACHE(cache_hits);
+        if (entry->transition != NULL) instance->shape = entry->transition;
+        instance->fields[entry->slot] = peek_c(0);
+        write_barrier((Obj*)instance, peek_c(0));
+      } else {
+        COUNT_CACHE(cache_misses);
+        set_property(instance, name, peek_c(0), cache);
+      }
+      Value value = pop();
+      pop();
+      push(value);
+      DISPATCH();
+    }
+    CASE(OP_CONSTANT): {
+      Value constant = READ_CONSTANT();
+      push(constant);
+      DISPATCH();
+    }
+    CASE(OP_CLASS):
+      push(OBJ_VAL(create_class(READ_STRING())));
+      DISPATCH();
+    CASE(OP_CLOSURE): {
+      ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
+      ObjClosure* closure = create_closure(function);
+      push(OBJ_VAL(closure));
+      for (int i = 0; i < closure->upvalueCount; i++) {
+        uint8_t isLocal = READ_BYTE();
+        uint8_t index = READ_BYTE();
+        if (isLocal) {
+          closure->upvalues[i] = capture_upvalue(frame->slots + index);
+        } else {
+          closure->upvalues[i] = frame->closure->upvalues[index];
+        }
+        write_barrier((Obj*)closure, OBJ_VAL(closure->upvalues[i]));
+      }
+      DISPATCH();
+    }
+    CASE(OP_CLOSE_UPVALUE):
+      close_upvalues(hvm.top - 1);
+      pop();
+      DISPATCH();
+    CASE(OP_GET_UPVALUE): {
+      uint8_t slot = READ_BYTE();
+      push(*frame->closure->upvalues[slot]->location);
+      DISPATCH();
+    }
+    CASE(OP_SET_UPVALUE): {
+      ObjUpvalue* upvalue = frame->closure->upvalues[READ_BYTE()];
+      *upvalue->location = peek_c(0);
+      write_barrier((Obj*)upvalue, peek_c(0));
+      DISPATCH();
+    }
+    CASE(OP_PRINT_TOLINE): {
+      print_value(pop());
+      DISPATCH();
+    }
+    CASE(OP_PRINT): {
+      print_value(pop());
+      printf("\n");
+      DISPATCH();
+    }
+    CASE(OP_CALL): {
+      int cnt = READ_BYTE();
+      if (IS_NATIVE(peek_c(cnt))) frame->ip[-2] = OP_CALL_NATIVE;
+      if (!call_value(peek_c(cnt), cnt)) {
+        return INTER_RUNTIME_ERROR;
+      }
+      frame = &hvm.frames[hvm.frameCount - 1];
+      JIT_ENTER();
+      DISPATCH();
+    }
+    CASE(OP_CALL_NATIVE): {
+      int cnt = frame->ip[0];
+      Value callee = peek_c(cnt);
+      if (!IS_NATIVE(callee)) DEQUICKEN(OP_CALL);
+      frame->ip++;
+      if (!call_native(AS_NATIVE_OBJ(callee), cnt)) {
+        return INTER_RUNTIME_ERROR;
+      }
+      DISPATCH();
+    }
+    CASE(OP_TAIL_CALL): {
+      int cnt = READ_BYTE();
+      if (!tail_call(peek_c(cnt), cnt)) {
+        return INTER_RUNTIME_ERROR;
+      }
+      frame = &hvm.frames[hvm.frameCount - 1];
+      JIT_ENTER();
+      DISPATCH();
+    }
+    CASE(OP_JUMP_IF_FALSE): {
+      uint16_t offset = READ_SHORT();
+      if (isFalsey(peek_c(0))) frame->ip += offset;
+      DISPATCH();
+    }
+    CASE(OP_JUMP): {
+      uint16_t offset = READ_SHORT();
+      frame->ip += offset;
+      DISPATCH();
+    }
+    CASE(OP_LOOP): {
+      uint16_t offset = READ_SHORT();
+      frame->ip -= offset;
+      JIT_BACK_EDGE();
+      DISPATCH();
+    }
+    // Two ints step and test inline. Anything else takes for_loop_test(),
+    // which does what the general loop code would, errors included.
+    CASE(OP_FOR_PREP): {
+      const uint8_t* instruction = frame->ip - 1;
+      frame->ip += 6;
+      Value counter = frame->slots[instruction[1]];
+      Value bound = for_bound(frame, instruction);
+      bool holds;
+      if (IS_INT(counter) && IS_INT(bound)) {
+        holds = for_compare(AS_INT(counter), AS_INT(bound), instruction[2]);
+      } else if (!for_loop_test(frame, instruction, &holds)) {
+        return INTER_RUNTIME_ERROR;
+      }
+      if (!holds) frame->ip += (uint16_t)((instruction[5] << 8) | instruction[6]);
+      DISPATCH();
+    }
+    CASE(OP_FOR_LOOP): {
+      const uint8_t* instruction = frame->ip - 1;
+      frame->ip += 6;
+      Value* counter = &frame->slots[instruction[1]];
+      Value bound = for_bound(frame, instruction);
+      bool holds;
+      if (IS_INT(*counter) && IS_INT(bound)) {
+        int value = AS_INT(*counter) + FOR_STEP(instruction[2]);
+        *counter = INT_VAL(value);
+        holds = for_compare(value, AS_INT(bound), instruction[2]);
+      } else if (!for_loop_test(frame, instruction, &holds)) {
+        return INTER_RUNTIME_ERROR;
+      }
+      if (holds) {
+        frame->ip -= (uint16_t)((instruction[5] << 8) | instruction[6]);
+        JIT_BACK_EDGE();
+      }
+      DISPATCH();
+    }
+    CASE(OP_POP): {
+      pop();
+      DISPATCH();               
+    }
+    CASE(OP_GET_LOCAL): {
+      uint8_t slot = READ_BYTE();
+      push(frame->slots[slot]);
+      DISPATCH();
+    }
+    CASE(OP_SET_LOCAL): {
+      uint8_t slot = READ_BYTE();
+      frame->slots[slot] = peek_c(0);
+      DISPATCH();
+    }
+    CASE(OP_DEFINE_GLOBAL): {
+      hvm.global_values.values[READ_SHORT()] = pop();
+      DISPATCH();
+    }
+    CASE(OP_IMPORT_MODULE):
+      return import_module(READ_STRING());
+    CASE(OP_IMPORT_STD):
+      if (!import_std(READ_STRING())) {
+        return INTER_RUNTIME_ERROR;
+      }
+      DISPATCH();
+    CASE(OP_GET_GLOBAL): {
+      uint16_t slot = READ_SHORT();
+      Value value = hvm.global_values.values[slot];
+      if (IS_UNDEFINED(value)) {
+        runtime_error("Undefined variable '%s'.",
+            AS_STRING(hvm.global_names.values[slot])->chars);
+        return INTER_RUNTIME_ERROR;
+      }
+      push(value);
+      DISPATCH();
+    }
+    CASE(OP_SET_GLOBAL): {
+      uint16_t slot = READ_SHORT();
+      if (IS_UNDEFINED(hvm.global_values.values[slot])) {
+        runtime_error("Undefined variable '%s'.",
+            AS_STRING(hvm.global_names.values[slot])->chars);
+        return INTER_RUNTIME_ERROR;
+      }
+      hvm.global_values.values[slot] = peek_c(0);
+      DISPATCH();
+    }
+    CASE(OP_NOT): {
+      push(BOOL_VAL(isFalsey(pop())));
+      DISPATCH();
+    }
+    CASE(OP_NEGATE): {
+      if (!IS_INT(peek_c(0)) && !IS_DOUBLE(peek_c(0))) {
+        runtime_error("Operand must be a number.");
+        return INTER_RUNTIME_ERROR;
+      }
+      if (IS_INT(peek_c(0))) {
+        push(INT_VAL(-AS_INT(pop())));
+      } else {
+        push(DOUBLE_VAL(-AS_DOUBLE(pop())));
+      }
+      DISPATCH();
+    }
+    CASE(OP_TRUE):
+      push(BOOL_VAL(true));
+      DISPATCH();
+    CASE(OP_FALSE):
+      push(BOOL_VAL(false));
+      DISPATCH();
+    CASE(OP_NIL):
+      push(NIL_VAL);
+      DISPATCH();
+    CASE(OP_EQUAL): {
+      Value b = pop();
+      Value a = pop();
+      push(BOOL_VAL(are_equal(a, b)));
+      DISPATCH();
+    }
+    CASE(OP_GREATER):
+      QUICKEN_IF_INTS(OP_GREATER_INT);
+      QUICKEN_IF_DOUBLES(OP_GREATER_DOUBLE);
+      BINARY_OP(BOOL_VAL, >);
+      DISPATCH();
+    CASE(OP_LESS):
+      QUICKEN_IF_INTS(OP_LESS_INT);
+      QUICKEN_IF_DOUBLES(OP_LESS_DOUBLE);
+      BINARY_OP(BOOL_VAL, <);
+      DISPATCH();
+    CASE(OP_ADD): {
+      if (IS_INT(peek_c(0)) && IS_INT(peek_c(1))) {
+        int b = AS_INT(pop());
+        int a = AS_INT(pop());
+        push(INT_VAL(a + b));
+      } else {
+        runtime_error("Operands must be two integers.");
+        return INTER_RUNTIME_ERROR;
+      }
+      DISPATCH();
+    }
+    CASE(OP_ADD_S): {
+      if (IS_STRING(peek_c(0)) && IS_STRING(peek_c(1))) {
+        concatenate();
+      } else {
+        runtime_error("Operands must be two strings.");
+        return INTER_RUNTIME_ERROR;
+      }
+      DISPATCH();
+    }
+    CASE(OP_ADD_D): {
+      if (IS_DOUBLE(peek_c(0)) && IS_DOUBLE(peek_c(1))) {
+        double b = AS_DOUBLE(pop());
+        double a = AS_DOUBLE(pop());
+        push(DOUBLE_VAL(a + b));
+      } else {
+        runtime_error("Operands must be two doubles.");
+        return INTER_RUNTIME_ERROR;
+      }
+      DISPATCH();
+    }
+    CASE(OP_MINUS): {
+      QUICKEN_IF_INTS(OP_MINUS_INT);
+      BINARY_OP(INT_VAL, -);
+      DISPATCH();
+    }
+    CASE(OP_MINUS_D): {
+      QUICKEN_IF_DOUBLES(OP_MINUS_DOUBLE);
+      BINARY_OP(DOUBLE_VAL, -);
+      DISPATCH();
+    }
+    CASE(OP_POWER): {
+      do {
+        if (!IS_INT(peek_c(0)) || !IS_INT(peek_c(1))) {
+          runtime_error("Operands must be integers.");
+          return INTER_RUNTIME_ERROR;
+        }
+        int b = AS_INT(pop());
+        int a = AS_INT(pop());
+        int res = (a ^ b);
+        push(INT_VAL(res));
+      } while (false);
+      DISPATCH();
+    }
+    CASE(OP_MODULE): {
+      do {
+        if (!IS_INT(peek_c(0)) || !IS_INT(peek_c(1))) {
+          runtime_error("Operands must be integers.");
+          return INTER_RUNTIME_ERROR;
+        }
+        int b = (int) AS_INT(pop());
+        int a = (int) AS_INT(pop());
+        int res = (a % b);
+        push(INT_VAL(res));
+      } while (false);
+      DISPATCH();
+    }
+    CASE(OP_MULTI): {
+      QUICKEN_IF_INTS(OP_MULTI_INT);
+      BINARY_OP(INT_VAL, *);
+      DISPATCH();
+    }
+    CASE(OP_MULTI_D): {
+      QUICKEN_IF_DOUBLES(OP_MULTI_DOUBLE);
+      BINARY_OP(DOUBLE_VAL, *);
+      DISPATCH();
+    }
+    CASE(OP_DIVIDE): {
+      QUICKEN_IF_INTS(OP_DIVIDE_INT);
+      BINARY_OP(INT_VAL, /);
+      DISPATCH();
+    }
+    CASE(OP_DIVIDE_D): {
+      QUICKEN_IF_DOUBLES(OP_DIVIDE_DOUBLE);
+      BINARY_OP(DOUBLE_VAL, /);
+      DISPATCH();
+    }
+    // Superinstructions. Each one takes the fast path when the operands are
+    // plain ints and otherwise does exactly what the instruction it replaced
+    // would, leaving the rest of the original sequence to run unfused.
+    CASE(OP_INC_LOCAL): {
+      // GET_LOCAL a, CONSTANT k, ADD, SET_LOCAL a, POP
+      Value* local = &frame->slots[READ_BYTE()];
+      if (IS_INT(*local)) {
+        Value step = frame->closure->function->chunk.constants.values[frame->ip[1]];
+        *local = INT_VAL(AS_INT(*local) + AS_INT(step));
+        frame->ip += 6;
+      } else {
+        push(*local);
+      }
+      DISPATCH();
+    }
+    CASE(OP_ADD_LOCAL_CONST): {
+      // GET_LOCAL a, CONSTANT k, ADD
+      Value local = frame->slots[READ_BYTE()];
+      if (IS_INT(local)) {
+        Value step = frame->closure->function->chunk.constants.values[frame->ip[1]];
+        push(INT_VAL(AS_INT(local) + AS_INT(step)));
+        frame->ip += 3;
+      } else {
+        push(local);
+      }
+      DISPATCH();
+    }
+    CASE(OP_GET_LOCAL_GET_LOCAL): {
+      // GET_LOCAL a, GET_LOCAL b
+      push(frame->slots[READ_BYTE()]);
+      push(frame->slots[frame->ip[1]]);
+      frame->ip += 2;
+      DISPATCH();
+    }
+    CASE(OP_LESS_JUMP_IF_FALSE): {
+      // LESS, JUMP_IF_FALSE offset, POP
+      if (IS_INT(peek_c(0)) && IS_INT(peek_c(1))) {
+        int b = AS_INT(pop());
+        int a = AS_INT(pop());
+        if (a < b) {
+          frame->ip += 4;
+        } else {
+          push(BOOL_VAL(false));
+          frame->ip += 3 + (uint16_t)((frame->ip[1] << 8) | frame->ip[2]);
+        }
+      } else {
+        BINARY_OP(BOOL_VAL, <);
+      }
+      DISPATCH();
+    }
+    CASE(OP_GREATER_JUMP_IF_FALSE): {
+      // GREATER, JUMP_IF_FALSE offset, POP
+      if (IS_INT(peek_c(0)) && IS_INT(peek_c(1))) {
+        int b = AS_INT(pop());
+        int a = AS_INT(pop());
+        if (a > b) {
+          frame->ip += 4;
+        } else {
+          push(BOOL_VAL(false));
+          frame->ip += 3 + (uint16_t)((frame->ip[1] << 8) | frame->ip[2]);
+        }
+      } else {
+        BINARY_OP(BOOL_VAL, >);
+      }
+      DISPATCH();
+    }
+    CASE(OP_LESS_INT):
+      INT_OP(BOOL_VAL, <, OP_LESS);
+      DISPATCH();
+    CASE(OP_LESS_DOUBLE):
+      DOUBLE_OP(BOOL_VAL, <, OP_LESS);
+      DISPATCH();
+    CASE(OP_GREATER_INT):
+      INT_OP(BOOL_VAL, >, OP_GREATER);
+      DISPATCH();
+    CASE(OP_GREATER_DOUBLE):
+      DOUBLE_OP(BOOL_VAL, >, OP_GREATER);
+      DISPATCH();
+    CASE(OP_MINUS_INT):
+      INT_OP(INT_VAL, -, OP_MINUS);
+      DISPATCH();
+    CASE(OP_MINUS_DOUBLE):
+      DOUBLE_OP(DOUBLE_VAL, -, OP_MINUS_D);
+      DISPATCH();
+    CASE(OP_MULTI_INT):
+      INT_OP(INT_VAL, *, OP_MULTI);
+      DISPATCH();
+    CASE(OP_MULTI_DOUBLE):
+      DOUBLE_OP(DOUBLE_VAL, *, OP_MULTI_D);
+      DISPATCH();
+    CASE(OP_DIVIDE_INT):
+      INT_OP(INT_VAL, /, OP_DIVIDE);
+      DISPATCH();
+    CASE(OP_DIVIDE_DOUBLE):
+      DOUBLE_OP(DOUBLE_VAL, /, OP_DIVIDE_D);
+      DISPATCH();
+    CASE(OP_RETURN): {
+      Value result = pop();
+      close_upvalues(frame->slots);
+      hvm.frameCount--;
+      if (hvm.frameCount == 0) {
+        pop();
+        return INTER_OK;
+      }
+      hvm.top = frame->slots;
+      push(result);
+      frame = &hvm.frames[hvm.frameCount - 1];
+      JIT_ENTER();
+      DISPATCH();
+    }
+  }
+
+  // Only reachable from the switch build, on an opcode with no handler.
+  return INTER_RUNTIME_ERROR;
+
+#if defined(HVM_JIT) && !defined(EXECUTE_TRACED)
+  // Runs compiled frames until one needs the interpreter: an instruction
+  // the JIT left out, or a call into or return to a function that has not
+  // been compiled.
+jit_enter:
+  for (;;) {
+    JitStatus status = jit_run(frame);
+    if (status == JIT_ERROR) return INTER_RUNTIME_ERROR;
+    if (status == JIT_RETURNED && hvm.frameCount == 0) return INTER_OK;
+    frame = &hvm.frames[hvm.frameCount - 1];
+    if (status == JIT_EXITED || frame->closure->function->jit == NULL) {
+      DISPATCH();
+    }
+  }
+#endif
+
+#undef JIT_ENTER
+#undef JIT_BACK_EDGE
+#undef READ_CONSTANT
+#undef READ_STRING
+#undef READ_CACHE
+#undef COUNT_CACHE
+#undef BINARY_OP
+#undef QUICKEN_IF_INTS
+#undef QUICKEN_IF_DOUBLES
+#undef DEQUICKEN
+#undef INT_OP
+#undef DOUBLE_OP
+#undef READ_BYTE
+#undef READ_SHORT
+#undef CASE
+#undef DISPATCH
+#undef INTERPRET_LOOP
+#undef TRACE_INSTRUCTION
+}
+
+#undef EXECUTE_FUNCTION
+#undef EXECUTE_TRACED
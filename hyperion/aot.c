@@ -0,0 +1,64 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "aot.h"
+#include "chunk.h"
+#include "commandline.h"
+#include "DMODE.h"
+
+void aot_global(const char* name, int size) {
+  global_slot(copy_string(name, size));
+}
+
+// The function stays on the stack until aot_end_function, so the constants
+// added in between cannot collect it.
+ObjFunction* aot_begin_function(CompiledFn compiled, int arity,
+                                int upvalue_count, int max_stack,
+                                const char* name, const uint8_t* code,
+                                const int* lines, int size, int cache_count) {
+  ObjFunction* function = create_function();
+  push(OBJ_VAL(function));
+
+  function->arity = arity;
+  function->upvalueCount = upvalue_count;
+  function->max_stack = max_stack;
+  function->compiled = compiled;
+  if (name != NULL) {
+    function->name = copy_string(name, (int)strlen(name));
+    write_barrier((Obj*)function, OBJ_VAL(function->name));
+  }
+
+  for (int i = 0; i < size; i++) {
+    write_chunk(&function->chunk, code[i], lines[i]);
+  }
+  for (int i = 0; i < cache_count; i++) {
+    add_inline_cache(&function->chunk);
+  }
+  return function;
+}
+
+void aot_constant(ObjFunction* function, Value value) {
+  add_constant(&function->chunk, value);
+  write_barrier((Obj*)function, value);
+}
+
+ObjFunction* aot_end_function(ObjFunction* function) {
+  pop();
+  return function;
+}
+
+// Mirrors run_file() in hypl.c.
+int aot_main(int argc, char* argv[], ObjFunction* (*load)()) {
+  CLA.argc = argc;
+  CLA.argv = argv;
+  DMODE.mode = false;
+
+  init_hvm();
+  InterReport result = run_compiled(load());
+
+  if (result == INTER_COMPILE_ERROR) exit(65);
+  if (result == INTER_RUNTIME_ERROR) exit(70);
+
+  free_hvm();
+  return 0;
+}
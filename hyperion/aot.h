@@ -0,0 +1,206 @@
+#ifndef aot_h
+#define aot_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "HVM.h"
+#include "jit.h"
+#include "memory.h"
+#include "object.h"
+
+// Support for the C that `hypl script.hypl --emit-c` writes. A translated
+// program keeps every function's bytecode, constants and line table, so
+// frames, errors and the GC see exactly what the interpreter would, and
+// gives each function a C body in which every instruction is a macro
+// below. Control flow is gotos between instruction labels.
+//
+// compilation/aot.sh builds a translated script into an executable.
+
+// Loading. The generated program rebuilds its globals in the compiler's
+// slot order, then its functions innermost first.
+void aot_global(const char* name, int size);
+ObjFunction* aot_begin_function(CompiledFn compiled, int arity,
+                                int upvalue_count, int max_stack,
+                                const char* name, const uint8_t* code,
+                                const int* lines, int size, int cache_count);
+void aot_constant(ObjFunction* function, Value value);
+ObjFunction* aot_end_function(ObjFunction* function);
+
+// The generated main().
+int aot_main(int argc, char* argv[], ObjFunction* (*load)());
+
+// A function body keeps the stack top in a local, writing it back with the
+// frame's ip around anything that can look at the VM. The ip written is
+// the one after the instruction, as the interpreter's would be.
+#define AOT_BEGIN() \
+    Value* top = hvm.top; \
+    Value* slots = frame->slots; \
+    ObjFunction* function = frame->closure->function; \
+    uint8_t* code = function->chunk.code; \
+    Value* constants = function->chunk.constants.values; \
+    (void)slots; \
+    (void)constants
+
+#define AOT_SYNC(next) (hvm.top = top, frame->ip = code + (next))
+
+#define AOT_RELOAD() (top = hvm.top, slots = frame->slots)
+
+// Calls a runtime entry point, leaving with its status unless it says to
+// carry on. The stack may have moved, so slots is reloaded.
+#define AOT_RUNTIME(next, call) \
+    do { \
+      AOT_SYNC(next); \
+      JitStatus status_ = (call); \
+      if (status_ != JIT_CONTINUE) return status_; \
+      AOT_RELOAD(); \
+    } while (false)
+
+// Leaves with whatever the entry point returns.
+#define AOT_LEAVE(next, call) \
+    do { \
+      AOT_SYNC(next); \
+      return (call); \
+    } while (false)
+
+#define AOT_PUSH(value) (*top++ = (value))
+
+#define AOT_GET_GLOBAL(next, slot) \
+    do { \
+      Value value_ = hvm.global_values.values[slot]; \
+      if (IS_UNDEFINED(value_)) AOT_LEAVE(next, jit_undefined_global(slot)); \
+      AOT_PUSH(value_); \
+    } while (false)
+
+#define AOT_SET_GLOBAL(next, slot) \
+    do { \
+      if (IS_UNDEFINED(hvm.global_values.values[slot])) { \
+        AOT_LEAVE(next, jit_undefined_global(slot)); \
+      } \
+      hvm.global_values.values[slot] = top[-1]; \
+    } while (false)
+
+#define AOT_SET_UPVALUE(slot) \
+    do { \
+      ObjUpvalue* upvalue_ = frame->closure->upvalues[slot]; \
+      *upvalue_->location = top[-1]; \
+      write_barrier((Obj*)upvalue_, top[-1]); \
+    } while (false)
+
+#define AOT_FALSEY(value) (IS_BOOL(value) && !AS_BOOL(value))
+
+#define AOT_NEGATE(next) \
+    do { \
+      Value value_ = top[-1]; \
+      if (IS_INT(value_)) { \
+        top[-1] = INT_VAL(-AS_INT(value_)); \
+      } else if (IS_DOUBLE(value_)) { \
+        top[-1] = DOUBLE_VAL(-AS_DOUBLE(value_)); \
+      } else { \
+        AOT_LEAVE(next, jit_error("Operand must be a number.")); \
+      } \
+    } while (false)
+
+// The interpreter's BINARY_OP: two ints or two doubles, with the result
+// made by valueType either way.
+#define AOT_BINARY(next, valueType, op) \
+    do { \
+      Value b_ = top[-1]; \
+      Value a_ = top[-2]; \
+      if (IS_INT(a_) && IS_INT(b_)) { \
+        top[-2] = valueType(AS_INT(a_) op AS_INT(b_)); \
+      } else if (IS_DOUBLE(a_) && IS_DOUBLE(b_)) { \
+        top[-2] = valueType(AS_DOUBLE(a_) op AS_DOUBLE(b_)); \
+      } else { \
+        AOT_LEAVE(next, jit_error("Operands must be numbers.")); \
+      } \
+      top--; \
+    } while (false)
+
+#define AOT_INT_BINARY(next, op, message) \
+    do { \
+      Value b_ = top[-1]; \
+      Value a_ = top[-2]; \
+      if (!IS_INT(a_) || !IS_INT(b_)) AOT_LEAVE(next, jit_error(message)); \
+      top[-2] = INT_VAL(AS_INT(a_) op AS_INT(b_)); \
+      top--; \
+    } while (false)
+
+#define AOT_ADD_D(next) \
+    do { \
+      if (!IS_DOUBLE(top[-2]) || !IS_DOUBLE(top[-1])) { \
+        AOT_LEAVE(next, jit_error("Operands must be two doubles.")); \
+      } \
+      top[-2] = DOUBLE_VAL(AS_DOUBLE(top[-2]) + AS_DOUBLE(top[-1])); \
+      top--; \
+    } while (false)
+
+#define AOT_EQUAL() \
+    do { \
+      top[-2] = BOOL_VAL(are_equal(top[-2], top[-1])); \
+      top--; \
+    } while (false)
+
+// Superinstructions. As in the interpreter, the fast path skips the rest of
+// the fused sequence and anything else runs it unfused.
+#define AOT_INC_LOCAL(slot, constant, done) \
+    do { \
+      if (IS_INT(slots[slot])) { \
+        slots[slot] = INT_VAL(AS_INT(slots[slot]) + AS_INT(constants[constant])); \
+        goto done; \
+      } \
+      AOT_PUSH(slots[slot]); \
+    } while (false)
+
+#define AOT_ADD_LOCAL_CONST(slot, constant, done) \
+    do { \
+      if (IS_INT(slots[slot])) { \
+        AOT_PUSH(INT_VAL(AS_INT(slots[slot]) + AS_INT(constants[constant]))); \
+        goto done; \
+      } \
+      AOT_PUSH(slots[slot]); \
+    } while (false)
+
+#define AOT_COMPARE_JUMP(op, taken, not_taken) \
+    do { \
+      Value b_ = top[-1]; \
+      Value a_ = top[-2]; \
+      if (IS_INT(a_) && IS_INT(b_)) { \
+        top -= 2; \
+        if (AS_INT(a_) op AS_INT(b_)) goto taken; \
+        AOT_PUSH(BOOL_VAL(false)); \
+        goto not_taken; \
+      } \
+    } while (false)
+
+// OP_FOR_PREP and OP_FOR_LOOP. Two ints step and test inline, anything
+// else goes through jit_for_loop(), which also raises the errors.
+#define AOT_FOR_PREP(next, offset, slot, bound, compare, exit) \
+    do { \
+      Value bound_ = (bound); \
+      bool holds_; \
+      if (IS_INT(slots[slot]) && IS_INT(bound_)) { \
+        holds_ = AS_INT(slots[slot]) compare AS_INT(bound_); \
+      } else { \
+        AOT_RUNTIME(next, jit_for_loop(code + (offset), &holds_)); \
+      } \
+      if (!holds_) goto exit; \
+    } while (false)
+
+#define AOT_FOR_LOOP(next, offset, slot, step, bound, compare, body) \
+    do { \
+      Value bound_ = (bound); \
+      bool holds_; \
+      if (IS_INT(slots[slot]) && IS_INT(bound_)) { \
+        int counter_ = AS_INT(slots[slot]) + (step); \
+        slots[slot] = INT_VAL(counter_); \
+        holds_ = counter_ compare AS_INT(bound_); \
+      } else { \
+        AOT_RUNTIME(next, jit_for_loop(code + (offset), &holds_)); \
+      } \
+      if (holds_) goto body; \
+    } while (false)
+
+#endif
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+#include "HVM.h"
+
+// ASan cannot see cells freed back to a page, so free cells and the unused
+// end of a page are poisoned by hand. A free cell's first word, the link to
+// the next one, stays readable. LeakSanitizer does not look inside mapped
+// memory either, so chunks are registered with it for what objects own.
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#include <sanitizer/lsan_interface.h>
+#define POISON(pointer, size) ASAN_POISON_MEMORY_REGION(pointer, size)
+#define UNPOISON(pointer, size) ASAN_UNPOISON_MEMORY_REGION(pointer, size)
+#define REGISTER_ROOTS(pointer, size) __lsan_register_root_region(pointer, size)
+#define UNREGISTER_ROOTS(pointer, size) __lsan_unregister_root_region(pointer, size)
+#else
+#define POISON(pointer, size) ((void)(pointer), (void)(size))
+#define UNPOISON(pointer, size) ((void)(pointer), (void)(size))
+#define REGISTER_ROOTS(pointer, size) ((void)(pointer), (void)(size))
+#define UNREGISTER_ROOTS(pointer, size) ((void)(pointer), (void)(size))
+#endif
+
+#define CELLS_START(page) \
+    ((uint8_t*)(page) + ((sizeof(ArenaPage) + ARENA_GRANULE - 1) & ~(size_t)(ARENA_GRANULE - 1)))
+#define PAGE_END(page) ((uint8_t*)(page) + ARENA_PAGE_SIZE)
+
+// madvise gives back whole OS pages, so the one holding the header stays.
+#define OS_PAGE_SIZE 4096
+
+void init_arena(Arena* arena) {
+  for (int i = 0; i < ARENA_CLASSES; i++) arena->has_room[i] = NULL;
+  arena->pages = NULL;
+  arena->page_count = 0;
+  arena->page_capacity = 0;
+  arena->pool = NULL;
+  arena->pool_count = 0;
+  arena->released = NULL;
+  arena->chunk_top = NULL;
+  arena->chunk_end = NULL;
+  arena->chunks = NULL;
+  arena->chunk_marks = NULL;
+  arena->chunk_count = 0;
+  arena->chunk_capacity = 0;
+  arena->huge_pages = false;
+}
+
+void free_arena(Arena* arena) {
+  for (int i = 0; i < arena->chunk_count; i++) {
+    UNREGISTER_ROOTS(arena->chunks[i], ARENA_CHUNK_SIZE);
+    munmap(arena->chunks[i], ARENA_CHUNK_SIZE);
+    free(arena->chunk_marks[i]);
+  }
+  free(arena->chunks);
+  free(arena->chunk_marks);
+  free(arena->pages);
+  init_arena(arena);
+}
+
+// Chunks are aligned to their size, so huge pages can back them whole.
+static void map_chunk(Arena* arena) {
+  size_t size = 2 * ARENA_CHUNK_SIZE;
+  uint8_t* mapped = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped == MAP_FAILED) exit(1);
+
+  uint8_t* chunk = (uint8_t*)(((uintptr_t)mapped + ARENA_CHUNK_SIZE - 1) &
+                              ~(uintptr_t)(ARENA_CHUNK_SIZE - 1));
+  uint8_t* end = chunk + ARENA_CHUNK_SIZE;
+  if (chunk > mapped) munmap(mapped, chunk - mapped);
+  if (mapped + size > end) munmap(end, mapped + size - end);
+
+#ifdef MADV_HUGEPAGE
+  if (arena->huge_pages) madvise(chunk, ARENA_CHUNK_SIZE, MADV_HUGEPAGE);
+#endif
+  REGISTER_ROOTS(chunk, ARENA_CHUNK_SIZE);
+
+  if (arena->chunk_capacity < arena->chunk_count + 1) {
+    arena->chunk_capacity = arena->chunk_capacity < 8 ? 8 : arena->chunk_capacity * 2;
+    arena->chunks = (void**)realloc(arena->chunks, sizeof(void*) * arena->chunk_capacity);
+    arena->chunk_marks = (uint64_t**)realloc(arena->chunk_marks,
+                                             sizeof(uint64_t*) * arena->chunk_capacity);
+    if (arena->chunks == NULL || arena->chunk_marks == NULL) exit(1);
+  }
+  uint64_t* marks = (uint64_t*)calloc(ARENA_CHUNK_PAGES * ARENA_BITMAP_WORDS, sizeof(uint64_t));
+  if (marks == NULL) exit(1);
+  arena->chunk_marks[arena->chunk_count] = marks;
+  arena->chunks[arena->chunk_count++] = chunk;
+  arena->chunk_top = chunk;
+  arena->chunk_end = end;
+}
+
+void arena_use_huge_pages(Arena* arena) {
+  arena->huge_pages = true;
+#ifdef MADV_HUGEPAGE
+  for (int i = 0; i < arena->chunk_count; i++) {
+    madvise(arena->chunks[i], ARENA_CHUNK_SIZE, MADV_HUGEPAGE);
+  }
+#endif
+}
+
+static ArenaPage* take_page(Arena* arena) {
+  ArenaPage* page;
+  if (arena->pool != NULL) {
+    page = arena->pool;
+    arena->pool = page->next;
+    arena->pool_count--;
+  } else if (arena->released != NULL) {
+    page = arena->released;
+    arena->released = page->next;
+  } else {
+    if (arena->chunk_top == arena->chunk_end) map_chunk(arena);
+    page = (ArenaPage*)arena->chunk_top;
+    uint8_t* chunk = (uint8_t*)arena->chunks[arena->chunk_count - 1];
+    page->marks = arena->chunk_marks[arena->chunk_count - 1] +
+                  (arena->chunk_top - chunk) / ARENA_PAGE_SIZE * ARENA_BITMAP_WORDS;
+    arena->chunk_top += ARENA_PAGE_SIZE;
+
+    if (arena->page_capacity < arena->page_count + 1) {
+      arena->page_capacity = arena->page_capacity < 8 ? 8 : arena->page_capacity * 2;
+      arena->pages = (ArenaPage**)realloc(arena->pages, sizeof(ArenaPage*) * arena->page_capacity);
+      if (arena->pages == NULL) exit(1);
+    }
+    page->index = arena->page_count;
+    arena->pages[arena->page_count++] = page;
+  }
+  POISON(CELLS_START(page), PAGE_END(page) - CELLS_START(page));
+  hvm.bytes_alloc += ARENA_PAGE_SIZE;
+  return page;
+}
+
+static void list_page(Arena* arena, ArenaPage* page) {
+  ArenaPage** head = &arena->has_room[page->size_class];
+  page->prev = NULL;
+  page->next = *head;
+  if (*head != NULL) (*head)->prev = page;
+  *head = page;
+  page->has_room_listed = true;
+}
+
+static void unlist_page(Arena* arena, ArenaPage* page) {
+  if (page->prev != NULL) {
+    page->prev->next = page->next;
+  } else {
+    arena->has_room[page->size_class] = page->next;
+  }
+  if (page->next != NULL) page->next->prev = page->prev;
+  page->has_room_listed = false;
+}
+
+static ArenaPage* new_page(Arena* arena, int size_class) {
+  ArenaPage* page = take_page(arena);
+  page->in_use = true;
+  page->size_class = (uint8_t)size_class;
+  page->cell_size = (size_class + 1) * ARENA_GRANULE;
+  page->live = 0;
+  page->free = NULL;
+  page->bump = CELLS_START(page);
+  memset(page->allocated, 0, sizeof(page->allocated));
+  memset(page->marks, 0, sizeof(uint64_t) * ARENA_BITMAP_WORDS);
+  list_page(arena, page);
+  return page;
+}
+
+static bool has_room(ArenaPage* page) {
+  return page->free != NULL || page->bump + page->cell_size <= PAGE_END(page);
+}
+
+void* arena_allocate(Arena* arena, size_t size) {
+  int size_class = (int)((size - 1) / ARENA_GRANULE);
+  if (size_class >= ARENA_CLASSES) {
+    fprintf(stderr, "Objects of %zu bytes do not fit an arena cell.\n", size);
+    exit(EXIT_FAILURE);
+  }
+
+  ArenaPage* page = arena->has_room[size_class];
+  if (page == NULL) page = new_page(arena, size_class);
+
+  void* cell;
+  if (page->free != NULL) {
+    cell = page->free;
+    UNPOISON(cell, page->cell_size);
+    page->free = *(void**)cell;
+  } else {
+    cell = page->bump;
+    UNPOISON(cell, page->cell_size);
+    page->bump += page->cell_size;
+  }
+  page->live++;
+
+  size_t granule = ARENA_GRANULE_OF(cell);
+  page->allocated[granule / 64] |= (uint64_t)1 << (granule % 64);
+
+  if (!has_room(page)) unlist_page(arena, page);
+  return cell;
+}
+
+void arena_release_cell(void* cell) {
+  ArenaPage* page = ARENA_PAGE_OF(cell);
+  size_t granule = ARENA_GRANULE_OF(cell);
+  uint64_t bit = (uint64_t)1 << (granule % 64);
+  page->allocated[granule / 64] &= ~bit;
+  page->marks[granule / 64] &= ~bit;
+
+  *(void**)cell = page->free;
+  page->free = cell;
+  page->live--;
+  POISON((uint8_t*)cell + sizeof(void*), page->cell_size - sizeof(void*));
+}
+
+void arena_settle_page(Arena* arena, ArenaPage* page) {
+  if (!page->in_use) return;
+
+  if (page->live > 0) {
+    if (!page->has_room_listed && has_room(page)) list_page(arena, page);
+    return;
+  }
+
+  if (page->has_room_listed) unlist_page(arena, page);
+  page->in_use = false;
+  hvm.bytes_alloc -= ARENA_PAGE_SIZE;
+  if (arena->pool_count < ARENA_POOL_PAGES) {
+    page->next = arena->pool;
+    arena->pool = page;
+    arena->pool_count++;
+  } else {
+    madvise((uint8_t*)page + OS_PAGE_SIZE, ARENA_PAGE_SIZE - OS_PAGE_SIZE, MADV_DONTNEED);
+    page->next = arena->released;
+    arena->released = page;
+  }
+}
+
+void arena_free(Arena* arena, void* cell) {
+  arena_release_cell(cell);
+  arena_settle_page(arena, ARENA_PAGE_OF(cell));
+}
@@ -0,0 +1,120 @@
+#ifndef arena_h
+#define arena_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Objects live in pages of equal sized cells, one size class per page, in
+// steps of ARENA_GRANULE bytes. A cell is handed out from the page's free
+// list, or bumped off the part of the page never used yet. Each page keeps
+// a bitmap of its allocated cells and one of the cells the collector has
+// marked, a bit per granule, so sweeping a page is a scan of two bitmaps.
+//
+// The mark bitmaps live off to the side, one block of them per chunk, so
+// marking never writes to the pages themselves. A process forked from a
+// warmed up one keeps sharing the pages it only reads through collections.
+//
+// Pages are carved out of ARENA_CHUNK_SIZE chunks mapped from the OS. A
+// page that empties is kept for reuse, up to ARENA_POOL_PAGES of them, and
+// beyond that given back to the OS with madvise until it is needed again.
+#define ARENA_PAGE_SIZE (32 * 1024)
+#define ARENA_CHUNK_SIZE (2 * 1024 * 1024)
+#define ARENA_GRANULE 16
+#define ARENA_CLASSES 16
+#define ARENA_MAX_CELL (ARENA_CLASSES * ARENA_GRANULE)
+#define ARENA_POOL_PAGES 8
+#define ARENA_CHUNK_PAGES (ARENA_CHUNK_SIZE / ARENA_PAGE_SIZE)
+
+#define ARENA_BITMAP_WORDS (ARENA_PAGE_SIZE / ARENA_GRANULE / 64)
+
+typedef struct ArenaPage {
+  // Links in the list of pages of its class that have room.
+  struct ArenaPage* prev;
+  struct ArenaPage* next;
+  bool has_room_listed;
+  // Cleared while the page is empty and waiting to be reused.
+  bool in_use;
+
+  uint8_t size_class;
+  int cell_size;
+  // Allocated cells.
+  int live;
+  // Its place in hvm.arena.pages, which never changes.
+  int index;
+
+  void* free;
+  uint8_t* bump;
+
+  uint64_t allocated[ARENA_BITMAP_WORDS];
+  // ARENA_BITMAP_WORDS words in its chunk's block of mark bitmaps.
+  uint64_t* marks;
+} ArenaPage;
+
+typedef struct {
+  ArenaPage* has_room[ARENA_CLASSES];
+
+  // Every page ever carved, in order, whether in use or not.
+  ArenaPage** pages;
+  int page_count;
+  int page_capacity;
+
+  // Empty pages, kept as they are and then given back to the OS.
+  ArenaPage* pool;
+  int pool_count;
+  ArenaPage* released;
+
+  uint8_t* chunk_top;
+  uint8_t* chunk_end;
+  void** chunks;
+  uint64_t** chunk_marks;
+  int chunk_count;
+  int chunk_capacity;
+
+  // Ask for transparent huge pages on the chunks.
+  bool huge_pages;
+} Arena;
+
+#define ARENA_PAGE_OF(cell) \
+    ((ArenaPage*)((uintptr_t)(cell) & ~(uintptr_t)(ARENA_PAGE_SIZE - 1)))
+#define ARENA_GRANULE_OF(cell) \
+    (((uintptr_t)(cell) & (ARENA_PAGE_SIZE - 1)) / ARENA_GRANULE)
+
+void init_arena(Arena* arena);
+void free_arena(Arena* arena);
+
+// Asks for huge pages on the chunks mapped so far and on every later one.
+void arena_use_huge_pages(Arena* arena);
+
+void* arena_allocate(Arena* arena, size_t size);
+void arena_free(Arena* arena, void* cell);
+
+// arena_free in two halves, for freeing from several threads at once: the
+// first only touches the cell's page, and the second, run on one thread
+// once every page is done, files the page again.
+void arena_release_cell(void* cell);
+void arena_settle_page(Arena* arena, ArenaPage* page);
+
+static inline bool arena_is_marked(void* cell) {
+  size_t granule = ARENA_GRANULE_OF(cell);
+  return (ARENA_PAGE_OF(cell)->marks[granule / 64] >> (granule % 64)) & 1;
+}
+
+static inline void arena_set_mark(void* cell) {
+  size_t granule = ARENA_GRANULE_OF(cell);
+  ARENA_PAGE_OF(cell)->marks[granule / 64] |= (uint64_t)1 << (granule % 64);
+}
+
+static inline void arena_clear_mark(void* cell) {
+  size_t granule = ARENA_GRANULE_OF(cell);
+  ARENA_PAGE_OF(cell)->marks[granule / 64] &= ~((uint64_t)1 << (granule % 64));
+}
+
+// Marks the cell from any thread, returning whether it was marked already.
+static inline bool arena_set_mark_atomic(void* cell) {
+  size_t granule = ARENA_GRANULE_OF(cell);
+  uint64_t bit = (uint64_t)1 << (granule % 64);
+  return __atomic_fetch_or(&ARENA_PAGE_OF(cell)->marks[granule / 64], bit, __ATOMIC_RELAXED) & bit;
+}
+
+#endif
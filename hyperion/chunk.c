@@ -6,6 +6,7 @@
 #include "memory.h"
 #include "value.h"
 #include "chunk.h"
+#include "object.h"
 #include "HVM.h"
 
 void create_chunk(Chunk *chunk) {
@@ -14,6 +15,9 @@ void create_chunk(Chunk *chunk) {
   chunk->code = NULL;
   chunk->lines = NULL;
   create_value_array(&chunk->constants);
+  chunk->cache_count = 0;
+  chunk->cache_capacity = 0;
+  chunk->caches = NULL;
 }
 
 void write_chunk(Chunk *chunk, uint8_t byte, int line) {
@@ -35,10 +39,162 @@ int add_constant(Chunk* chunk, Value value) {
   return chunk->constants.size - 1;
 }
 
+int add_inline_cache(Chunk* chunk) {
+  if (chunk->cache_count + 1 > chunk->cache_capacity) {
+    int capacity = chunk->cache_capacity;
+    chunk->cache_capacity = GROW_CAPACITY(capacity);
+    chunk->caches = GROW_ARRAY(InlineCache, chunk->caches, capacity, chunk->cache_capacity);
+  }
+  chunk->caches[chunk->cache_count].count = 0;
+  return chunk->cache_count++;
+}
+
+static const int operand_bytes[] = {
+  [OP_BUILD_LIST] = 1,
+  [OP_BUILD_MAP] = 1,
+  [OP_IMPORT_STD] = 1,
+  [OP_IMPORT_MODULE] = 1,
+  [OP_INVOKE] = 4,
+  [OP_METHOD] = 1,
+  [OP_GET_PROPERTY] = 3,
+  [OP_SET_PROPERTY] = 3,
+  [OP_CLASS] = 1,
+  [OP_JUMP_IF_FALSE] = 2,
+  [OP_LOOP] = 2,
+  [OP_JUMP] = 2,
+  [OP_CALL] = 1,
+  [OP_TAIL_CALL] = 1,
+  [OP_DEFINE_GLOBAL] = 2,
+  [OP_GET_GLOBAL] = 2,
+  [OP_SET_GLOBAL] = 2,
+  [OP_GET_LOCAL] = 1,
+  [OP_SET_LOCAL] = 1,
+  [OP_GET_UPVALUE] = 1,
+  [OP_SET_UPVALUE] = 1,
+  [OP_CONSTANT] = 1,
+  [OP_FOR_PREP] = 6,
+  [OP_FOR_LOOP] = 6,
+  // A superinstruction only owns the operands of the instruction it
+  // replaced, the rest of its sequence is still decoded separately.
+  [OP_INC_LOCAL] = 1,
+  [OP_ADD_LOCAL_CONST] = 1,
+  [OP_GET_LOCAL_GET_LOCAL] = 1,
+  [OP_CALL_NATIVE] = 1,
+};
+
+// Net change in stack height for each instruction. CALL, INVOKE,
+// BUILD_LIST and BUILD_MAP depend on their operand and are worked out in stack_effect().
+// A superinstruction counts as the instruction it replaced.
+static const int stack_effects[] = {
+  [OP_INDEX_SUBSCR] = -1,
+  [OP_STORE_SUBSCR] = -2,
+  [OP_POP] = -1,
+  [OP_METHOD] = -1,
+  [OP_SET_PROPERTY] = -1,
+  [OP_CLASS] = 1,
+  [OP_CLOSURE] = 1,
+  [OP_PRINT] = -1,
+  [OP_PRINT_TOLINE] = -1,
+  [OP_DEFINE_GLOBAL] = -1,
+  [OP_GET_GLOBAL] = 1,
+  [OP_GET_LOCAL] = 1,
+  [OP_GET_UPVALUE] = 1,
+  [OP_CLOSE_UPVALUE] = -1,
+  [OP_NIL] = 1,
+  [OP_RETURN] = -1,
+  [OP_CONSTANT] = 1,
+  [OP_TRUE] = 1,
+  [OP_FALSE] = 1,
+  [OP_ADD] = -1,
+  [OP_MINUS] = -1,
+  [OP_MULTI] = -1,
+  [OP_ADD_D] = -1,
+  [OP_ADD_S] = -1,
+  [OP_MINUS_D] = -1,
+  [OP_MULTI_D] = -1,
+  [OP_MODULE] = -1,
+  [OP_POWER] = -1,
+  [OP_DIVIDE] = -1,
+  [OP_DIVIDE_D] = -1,
+  [OP_EQUAL] = -1,
+  [OP_GREATER] = -1,
+  [OP_LESS] = -1,
+  [OP_INC_LOCAL] = 1,
+  [OP_ADD_LOCAL_CONST] = 1,
+  [OP_GET_LOCAL_GET_LOCAL] = 1,
+  [OP_LESS_JUMP_IF_FALSE] = -1,
+  [OP_GREATER_JUMP_IF_FALSE] = -1,
+  [OP_LESS_INT] = -1,
+  [OP_LESS_DOUBLE] = -1,
+  [OP_GREATER_INT] = -1,
+  [OP_GREATER_DOUBLE] = -1,
+  [OP_MINUS_INT] = -1,
+  [OP_MINUS_DOUBLE] = -1,
+  [OP_MULTI_INT] = -1,
+  [OP_MULTI_DOUBLE] = -1,
+  [OP_DIVIDE_INT] = -1,
+  [OP_DIVIDE_DOUBLE] = -1,
+};
+
+int stack_effect(Chunk* chunk, int offset) {
+  uint8_t instruction = chunk->code[offset];
+  switch (instruction) {
+    case OP_CALL:
+    case OP_TAIL_CALL:
+    case OP_CALL_NATIVE:
+      return -chunk->code[offset + 1];
+    case OP_INVOKE:
+      return -chunk->code[offset + 2];
+    case OP_BUILD_LIST:
+      return 1 - chunk->code[offset + 1];
+    case OP_BUILD_MAP:
+      return 1 - 2 * chunk->code[offset + 1];
+    default:
+      if (instruction >= sizeof(stack_effects) / sizeof(stack_effects[0])) {
+        return 0;
+      }
+      return stack_effects[instruction];
+  }
+}
+
+int instruction_size(Chunk* chunk, int offset) {
+  uint8_t instruction = chunk->code[offset];
+  if (instruction == OP_CLOSURE) {
+    uint8_t constant = chunk->code[offset + 1];
+    ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
+    return 2 + function->upvalueCount * 2;
+  }
+  if (instruction >= sizeof(operand_bytes) / sizeof(operand_bytes[0])) {
+    return 1;
+  }
+  return 1 + operand_bytes[instruction];
+}
+
+// Where the jump at offset can go, or -1 if the instruction isn't a jump.
+// Fused jumps aren't covered, they keep their unfused sequence.
+int jump_target(Chunk* chunk, int offset) {
+  uint8_t* code = chunk->code;
+  int next = offset + instruction_size(chunk, offset);
+  switch (code[offset]) {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+      return next + ((code[offset + 1] << 8) | code[offset + 2]);
+    case OP_LOOP:
+      return next - ((code[offset + 1] << 8) | code[offset + 2]);
+    case OP_FOR_PREP:
+      return next + ((code[offset + 5] << 8) | code[offset + 6]);
+    case OP_FOR_LOOP:
+      return next - ((code[offset + 5] << 8) | code[offset + 6]);
+    default:
+      return -1;
+  }
+}
+
 void free_chunk(Chunk *chunk) {
   FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
   FREE_ARRAY(int, chunk->lines, chunk->capacity);
   free_value_array(&chunk->constants);
+  FREE_ARRAY(InlineCache, chunk->caches, chunk->cache_capacity);
   create_chunk(chunk);
 }
 
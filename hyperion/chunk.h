@@ -10,6 +10,7 @@
 
 typedef enum {
   OP_BUILD_LIST,
+  OP_BUILD_MAP,
   OP_INDEX_SUBSCR,
   OP_STORE_SUBSCR,
   OP_POP,
@@ -27,6 +28,7 @@ typedef enum {
   OP_LOOP,
   OP_JUMP,
   OP_CALL,
+  OP_TAIL_CALL,
   OP_DEFINE_GLOBAL,
   OP_GET_GLOBAL,
   OP_SET_GLOBAL,
@@ -55,15 +57,96 @@ typedef enum {
   OP_DIVIDE_D,
   OP_EQUAL,
   OP_GREATER,
-  OP_LESS
+  OP_LESS,
+  // Counted loops. Both read a local counter slot, a mode byte, a 16-bit
+  // bound operand and a 16-bit jump. FOR_PREP tests the counter and jumps
+  // forward past the loop when the test fails; FOR_LOOP steps the counter,
+  // tests it again and jumps back to the body while it holds.
+  OP_FOR_PREP,
+  OP_FOR_LOOP,
+
+  // Superinstructions, written over the first opcode of a fused sequence
+  // by optimizer.c. The rest of the sequence stays in place.
+  OP_INC_LOCAL,
+  OP_ADD_LOCAL_CONST,
+  OP_GET_LOCAL_GET_LOCAL,
+  OP_LESS_JUMP_IF_FALSE,
+  OP_GREATER_JUMP_IF_FALSE,
+
+  // Type-specialised forms execute() swaps in over a generic arithmetic or
+  // comparison opcode once it has seen the operand types at that site.
+  OP_LESS_INT,
+  OP_LESS_DOUBLE,
+  OP_GREATER_INT,
+  OP_GREATER_DOUBLE,
+  OP_MINUS_INT,
+  OP_MINUS_DOUBLE,
+  OP_MULTI_INT,
+  OP_MULTI_DOUBLE,
+  OP_DIVIDE_INT,
+  OP_DIVIDE_DOUBLE,
+  // OP_CALL once its callee has been a native.
+  OP_CALL_NATIVE
 } Commands;
 
+// The mode byte of OP_FOR_PREP and OP_FOR_LOOP: a comparison of the
+// counter against the bound, where the bound lives, and which way inc or
+// decr moves the counter.
+typedef enum {
+  FOR_LESS = 0,
+  FOR_LESS_EQUAL = 1,
+  FOR_GREATER = 2,
+  FOR_GREATER_EQUAL = 3,
+  FOR_COMPARE = 3,
+
+  FOR_BOUND_CONSTANT = 0,
+  FOR_BOUND_LOCAL = 4,
+  FOR_BOUND_GLOBAL = 8,
+  FOR_BOUND = 12,
+
+  FOR_STEP_DOWN = 16
+} ForMode;
+
+#define FOR_STEP(mode) (((mode) & FOR_STEP_DOWN) ? -1 : 1)
+
+struct ObjClass;
+struct ObjClosure;
+struct Shape;
+
+// One remembered lookup at a property or invoke site. A receiver of _class
+// laid out as shape finds the name in fields[slot] or, when slot is -1, as
+// method on its class. A SET_PROPERTY entry that added the field also keeps
+// the shape the instance moves to in transition.
+typedef struct {
+  struct ObjClass* _class;
+  struct Shape* shape;
+  int slot;
+  struct Shape* transition;
+  struct ObjClosure* method;
+} CacheEntry;
+
+// A site is monomorphic while it has seen a single layout and polymorphic up
+// to INLINE_CACHE_ENTRIES of them. Past that it stops caching and every
+// miss does the full lookup.
+#define INLINE_CACHE_ENTRIES 4
+
+typedef struct {
+  int count;
+  CacheEntry entries[INLINE_CACHE_ENTRIES];
+} InlineCache;
+
 typedef struct {
   int size;
   int capacity;
   uint8_t *code;
   ValueArray constants;
   int *lines;
+
+  // Side table of inline caches, indexed by the 16-bit operand of
+  // OP_GET_PROPERTY, OP_SET_PROPERTY and OP_INVOKE.
+  int cache_count;
+  int cache_capacity;
+  InlineCache* caches;
 } Chunk;
 
 
@@ -73,6 +156,14 @@ void write_chunk(Chunk *chunk, uint8_t byte, int line);
 
 int add_constant(Chunk* chunk, Value value);
 
+int add_inline_cache(Chunk* chunk);
+
 void free_chunk(Chunk *chunk);
 
+int instruction_size(Chunk* chunk, int offset);
+
+int stack_effect(Chunk* chunk, int offset);
+
+int jump_target(Chunk* chunk, int offset);
+
 #endif
@@ -12,6 +12,7 @@
 #include "compiler.h"
 #include "debug.h"
 #include "memory.h"
+#include "optimizer.h"
 #include "DMODE.h"
 
 #define UINT8_COUNT (UINT8_MAX + 1)
@@ -69,6 +70,10 @@ typedef struct Compiler {
   int local_count;
   Upvalue upvalues[UINT8_COUNT];
   int scope_depth;
+
+  // Chunk size right after the last OP_CALL emitted, so return_stmt can
+  // tell whether its expression ended in a call.
+  int last_call_end;
 } Compiler;
 
 typedef struct ClassCompiler {
@@ -82,6 +87,8 @@ typedef struct {
   bool panic_mode;
 } Parser;
 
+int optimize_level = 2;
+
 Compiler *current = NULL;
 ClassCompiler* current_class = NULL;
 Parser parser;
@@ -170,6 +177,16 @@ static int emit_jump(uint8_t instruction) {
   return get_chunk_compiling()->size - 2;
 }
 
+// Global accesses carry a 16-bit slot, locals and upvalues a single byte.
+static void emit_variable(uint8_t instruction, int arg) {
+  emit_byte(instruction);
+  if (instruction == OP_GET_GLOBAL || instruction == OP_SET_GLOBAL ||
+      instruction == OP_DEFINE_GLOBAL) {
+    emit_byte((arg >> 8) & 0xff);
+  }
+  emit_byte(arg & 0xff);
+}
+
 static void emit_return() {
   if (current->type == TYPE_INITIALIZER) {
     emit_bytes(OP_GET_LOCAL, 0);
@@ -213,6 +230,7 @@ void init_compiler(Compiler *compiler, FunctionType type) {
 
   compiler->local_count = 0;
   compiler->scope_depth = 0;
+  compiler->last_call_end = -1;
 
   compiler->function = create_function();
 
@@ -238,13 +256,26 @@ void init_compiler(Compiler *compiler, FunctionType type) {
 static ObjFunction* end_compiler() {
   emit_return();
   ObjFunction* function = current->function;
+
+  int optimized = 0;
+  int fused = 0;
+  if (!parser.had_error) {
+    if (optimize_level >= 2) optimized = optimize_chunk(get_chunk_compiling());
+    function->max_stack = compute_max_stack(get_chunk_compiling(), function->arity + 1);
+    if (optimize_level >= 1) fused = fuse_superinstructions(get_chunk_compiling());
+  }
+
 #ifdef DEBUG_PRINT_CODE
   if (!parser.had_error && DMODE.mode == true) {
     debug_chunk(get_chunk_compiling(), function->name != NULL
         ? function->name->chars : "<script>");
+    printf("== -O%d removed %d bytes ==\n", optimize_level, optimized);
+    printf("== superinstructions removed %d dispatches ==\n", fused);
   }
 #endif
 
+  // Constants and the name went in without write barriers.
+  rescan_object((Obj*)function);
   current = current->enclosing;
   return function;
 }
@@ -304,11 +335,29 @@ static uint8_t identifier_constant(Token* name) {
   return create_constant(OBJ_VAL(copy_string(name->start, name->size)));
 }
 
+static uint16_t identifier_global(Token* name) {
+  int slot = global_slot(copy_string(name->start, name->size));
+  if (slot > UINT16_MAX) {
+    error("Too many global variables.");
+    return 0;
+  }
+  return (uint16_t)slot;
+}
+
 static uint8_t argument_list();
 
 static void call(bool can_assign) {
   uint8_t cnt = argument_list();
   emit_bytes(OP_CALL, cnt);
+  current->last_call_end = get_chunk_compiling()->size;
+}
+
+static void emit_inline_cache() {
+  int cache = add_inline_cache(get_chunk_compiling());
+  if (cache > UINT16_MAX) error("Too many property accesses in one chunk.");
+
+  emit_byte((cache >> 8) & 0xff);
+  emit_byte(cache & 0xff);
 }
 
 static void dot(bool can_assign) {
@@ -318,12 +367,15 @@ static void dot(bool can_assign) {
   if (can_assign && match(TOKEN_EQUAL)) {
     expression();
     emit_bytes(OP_SET_PROPERTY, name);
+    emit_inline_cache();
   } else if (match(TOKEN_LEFT_PAREN)) {
     uint8_t cnt = argument_list();
     emit_bytes(OP_INVOKE, name);
     emit_byte(cnt);
+    emit_inline_cache();
   } else {
     emit_bytes(OP_GET_PROPERTY, name);
+    emit_inline_cache();
   }
 }
 
@@ -372,6 +424,31 @@ static void list(bool canAssign) {
   return;
 }
 
+static void map(bool canAssign) {
+  int pairCount = 0;
+  if (!check(TOKEN_RIGHT_BRACE)) {
+    do {
+      if (check(TOKEN_RIGHT_BRACE)) {
+        break;
+      }
+
+      parse_precedence(PREC_OR);
+      consume(TOKEN_COLON, "Expect ':' after map key.");
+      parse_precedence(PREC_OR);
+
+      if (pairCount == UINT8_MAX) {
+        error("Cannot have more than 255 entries in a map literal.");
+      }
+      pairCount++;
+    } while (match(TOKEN_COMMA));
+  }
+
+  consume(TOKEN_RIGHT_BRACE, "Expect '}' after map entries.");
+
+  emit_byte(OP_BUILD_MAP);
+  emit_byte(pairCount);
+}
+
 static void grouping(bool can_assign) {
   expression();
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression");
@@ -498,15 +575,15 @@ static void named_variable(Token name, bool can_assign) {
     getOp = OP_GET_UPVALUE;
     setOp = OP_SET_UPVALUE;
   } else {
-    arg = identifier_constant(&name);
+    arg = identifier_global(&name);
     getOp = OP_GET_GLOBAL;
     setOp = OP_SET_GLOBAL;
   }
   if (can_assign && match(TOKEN_EQUAL)) {
     expression();
-    emit_bytes(setOp, (uint8_t)arg);
+    emit_variable(setOp, arg);
   } else {
-    emit_bytes(getOp, (uint8_t)arg);
+    emit_variable(getOp, arg);
   }
 }
 
@@ -528,21 +605,21 @@ static void mark_initialized() {
   current->locals[current->local_count - 1].depth = current->scope_depth;
 }
 
-static uint8_t parse_variable(const char *error_message) {
+static uint16_t parse_variable(const char *error_message) {
   consume(TOKEN_IDENTIFIER, error_message);
 
   declare_variable();
   if (current->scope_depth > 0) return 0;
 
-  return identifier_constant(&parser.previous);
+  return identifier_global(&parser.previous);
 }
 
-static void define_variable(uint8_t global) {
+static void define_variable(uint16_t global) {
   if (current->scope_depth > 0) {
     mark_initialized();
     return;
   }
-  emit_bytes(OP_DEFINE_GLOBAL, global);
+  emit_variable(OP_DEFINE_GLOBAL, global);
 }
 
 static uint8_t argument_list() {
@@ -585,7 +662,7 @@ ParseRule rules[] = {
   [TOKEN_RIGHT_BRACKET] = {NULL,     NULL,   PREC_NONE},
   [TOKEN_LEFT_PAREN]    = {grouping, call,   PREC_CALL},
   [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE},
-  [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE}, 
+  [TOKEN_LEFT_BRACE]    = {map,      NULL,   PREC_NONE},
   [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE},
   [TOKEN_COMMA]         = {NULL,     NULL,   PREC_NONE},
   [TOKEN_DOT]           = {NULL,     dot,    PREC_CALL},
@@ -597,6 +674,7 @@ ParseRule rules[] = {
   [TOKEN_POWER]         = {NULL,     binary, PREC_TERM},
   [TOKEN_PERCENT]       = {unary,    binary, PREC_TERM},
   [TOKEN_SEMICOLON]     = {NULL,     NULL,   PREC_NONE},
+  [TOKEN_COLON]         = {NULL,     NULL,   PREC_NONE},
   [TOKEN_SLASH]         = {NULL,     binary, PREC_FACTOR},
   [TOKEN_SLASHD]        = {NULL,     binary, PREC_FACTOR},
   [TOKEN_STAR]          = {NULL,     binary, PREC_FACTOR},
@@ -693,8 +771,8 @@ static void function(FunctionType type) {
       if (current->function->arity > 255) {
         error_current("Can't have more than 255 parameters.");
       }
-      uint8_t constant = parse_variable("Expect parameter name.");
-      define_variable(constant);
+      uint16_t slot = parse_variable("Expect parameter name.");
+      define_variable(slot);
     } while (match(TOKEN_COMMA));
   }
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
@@ -729,9 +807,11 @@ static void class_declaration() {
   Token t_class_name = parser.previous;
   uint8_t class_name = identifier_constant(&parser.previous);
   declare_variable();
+  uint16_t global = 0;
+  if (current->scope_depth == 0) global = identifier_global(&parser.previous);
 
   emit_bytes(OP_CLASS, class_name);
-  define_variable(class_name);
+  define_variable(global);
 
   ClassCompiler class_compiler;
   class_compiler.enclosing = current_class;
@@ -750,14 +830,14 @@ static void class_declaration() {
 }
 
 static void function_declaration() {
-  uint8_t global = parse_variable("Expect function name.");
+  uint16_t global = parse_variable("Expect function name.");
   mark_initialized();
   function(TYPE_FUNCTION);
   define_variable(global);
 }
 
 static void variable_declaration() {
-  uint8_t global = parse_variable("Expect variable name.");
+  uint16_t global = parse_variable("Expect variable name.");
 
   if (match(TOKEN_EQUAL)) {
     expression();
@@ -776,17 +856,121 @@ static void expression_stmt() {
   emit_byte(OP_POP);
 }
 
+// The rest of a for header in the form `i < bound; inc i)`, where i is the
+// local the initializer declared.
+typedef struct {
+  uint8_t mode;
+  uint16_t bound;
+  int line;
+} CountedLoop;
+
+#define COUNTED_LOOP_TOKENS 7
+
+// Looks ahead from the condition for a counted loop header: the counter
+// compared with <, <=, > or >= against an int literal or a local or global
+// variable, then inc or decr of the counter. The bound is read again on
+// every test, so the body may still change it. Consumes the header only
+// when it matches.
+static bool counted_loop_header(Token* counter, CountedLoop* loop) {
+  Token tokens[COUNTED_LOOP_TOKENS];
+  Lexer saved = save_lexer();
+  tokens[0] = parser.current;
+  for (int i = 1; i < COUNTED_LOOP_TOKENS; i++) tokens[i] = lex_token();
+  restore_lexer(saved);
+
+  if (tokens[0].type != TOKEN_IDENTIFIER || !identifiers_equal(&tokens[0], counter) ||
+      tokens[3].type != TOKEN_SEMICOLON ||
+      (tokens[4].type != TOKEN_INC && tokens[4].type != TOKEN_DECR) ||
+      tokens[5].type != TOKEN_IDENTIFIER || !identifiers_equal(&tokens[5], counter) ||
+      tokens[6].type != TOKEN_RIGHT_PAREN) {
+    return false;
+  }
+
+  switch (tokens[1].type) {
+    case TOKEN_LESS: loop->mode = FOR_LESS; break;
+    case TOKEN_LESS_EQUAL: loop->mode = FOR_LESS_EQUAL; break;
+    case TOKEN_GREATER: loop->mode = FOR_GREATER; break;
+    case TOKEN_GREATER_EQUAL: loop->mode = FOR_GREATER_EQUAL; break;
+    default: return false;
+  }
+  if (tokens[4].type == TOKEN_DECR) loop->mode |= FOR_STEP_DOWN;
+
+  Token* bound = &tokens[2];
+  if (bound->type == TOKEN_INT) {
+    loop->mode |= FOR_BOUND_CONSTANT;
+    loop->bound = create_constant(INT_VAL((int)strtod(bound->start, NULL)));
+  } else if (bound->type == TOKEN_IDENTIFIER && !identifiers_equal(bound, counter)) {
+    int slot = resolve_local(current, bound);
+    if (slot != -1) {
+      loop->mode |= FOR_BOUND_LOCAL;
+      loop->bound = (uint16_t)slot;
+    } else if (resolve_upvalue(current, bound) != -1) {
+      return false;
+    } else {
+      loop->mode |= FOR_BOUND_GLOBAL;
+      loop->bound = identifier_global(bound);
+    }
+  } else {
+    return false;
+  }
+
+  loop->line = tokens[0].line;
+  for (int i = 0; i < COUNTED_LOOP_TOKENS; i++) advance();
+  return true;
+}
+
+// Writes FOR_PREP or FOR_LOOP with the header's line, where the errors its
+// test raises belong, and returns the offset of its jump.
+static int emit_counted_loop(uint8_t instruction, uint8_t counter, CountedLoop* loop) {
+  Chunk* chunk = get_chunk_compiling();
+  uint8_t bytes[] = {
+    instruction, counter, loop->mode,
+    (loop->bound >> 8) & 0xff, loop->bound & 0xff, 0xff, 0xff
+  };
+  for (size_t i = 0; i < sizeof(bytes); i++) {
+    write_chunk(chunk, bytes[i], loop->line);
+  }
+  return chunk->size - 2;
+}
+
+// A counted loop tests and steps its counter in one instruction per
+// iteration instead of the condition, increment and two loops below.
+static void counted_loop(uint8_t counter, CountedLoop* loop) {
+  int exit_jump = emit_counted_loop(OP_FOR_PREP, counter, loop);
+  int body_start = get_chunk_compiling()->size;
+
+  statement();
+
+  int back_jump = emit_counted_loop(OP_FOR_LOOP, counter, loop);
+  int offset = get_chunk_compiling()->size - body_start;
+  if (offset > UINT16_MAX) error("Loop body too large.");
+  get_chunk_compiling()->code[back_jump] = (offset >> 8) & 0xff;
+  get_chunk_compiling()->code[back_jump + 1] = offset & 0xff;
+
+  patch_jump(exit_jump);
+}
+
 static void for_statement() {
   init_scope();
   consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+  int counter = -1;
   if (match(TOKEN_SEMICOLON)) {
     // No initializer.
   } else if (match(TOKEN_LET)) {
     variable_declaration();
+    counter = current->local_count - 1;
   } else {
     expression_stmt();
   }
 
+  CountedLoop loop;
+  if (counter != -1 &&
+      counted_loop_header(&current->locals[counter].name, &loop)) {
+    counted_loop((uint8_t)counter, &loop);
+    destroy_scope();
+    return;
+  }
+
   int loop_start = get_chunk_compiling()->size;
   int exit_jump = -1;
   if (!match(TOKEN_SEMICOLON)) {
@@ -884,6 +1068,14 @@ static void return_stmt() {
 
     expression();
     consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+
+    // A call that is the last thing the expression does is in tail position
+    // and can reuse this frame. The OP_RETURN stays for callees that can't,
+    // and for any jump inside the expression that lands past the call.
+    Chunk* chunk = get_chunk_compiling();
+    if (current->last_call_end == chunk->size) {
+      chunk->code[chunk->size - 2] = OP_TAIL_CALL;
+    }
     emit_byte(OP_RETURN);
   }
 }
@@ -944,9 +1136,9 @@ static void gvar_stmt() {
   name.start = change_string_to_value(name.start);
   advance();
 
-  emit_bytes(
+  emit_variable(
       OP_GET_GLOBAL, 
-      identifier_constant(&name)
+      identifier_global(&name)
   );
 }
 
@@ -961,15 +1153,15 @@ static void decr_stmt() {
       getOp = OP_GET_UPVALUE;
       setOp = OP_SET_UPVALUE;
     } else {
-      arg = identifier_constant(&parser.previous);
+      arg = identifier_global(&parser.previous);
       getOp = OP_GET_GLOBAL;
       setOp = OP_SET_GLOBAL;
     }
 
-    emit_bytes(getOp, arg);
+    emit_variable(getOp, arg);
     emit_bytes(OP_CONSTANT, create_constant(INT_VAL(-1)));
     emit_byte(OP_ADD);
-    emit_bytes(setOp, arg);
+    emit_variable(setOp, arg);
   } else {
     error("Expect variable name.");
   }
@@ -986,15 +1178,15 @@ static void inc_stmt() {
       getOp = OP_GET_UPVALUE;
       setOp = OP_SET_UPVALUE;
     } else {
-      arg = identifier_constant(&parser.previous);
+      arg = identifier_global(&parser.previous);
       getOp = OP_GET_GLOBAL;
       setOp = OP_SET_GLOBAL;
     }
 
-    emit_bytes(getOp, arg);
+    emit_variable(getOp, arg);
     emit_bytes(OP_CONSTANT, create_constant(INT_VAL(1)));
     emit_byte(OP_ADD);
-    emit_bytes(setOp, arg);
+    emit_variable(setOp, arg);
   } else {
     error("Expect variable name.");
   }
@@ -1065,6 +1257,8 @@ void mark_compiler_roots() {
   Compiler* compiler = current;
   while (compiler != NULL) {
     mark_object_memory((Obj*)compiler->function);
+    // Still taking constants without write barriers.
+    rescan_object((Obj*)compiler->function);
     compiler = compiler->enclosing;
   }
 }
@@ -12,6 +12,11 @@
 #include "HVM.h"
 #include "object.h"
 
+// How hard compile() works on the bytecode, set with -O. 0 leaves it as
+// parsed, 1 fuses superinstructions and 2, the default, first folds
+// constants, drops dead code and threads jumps.
+extern int optimize_level;
+
 ObjFunction* compile(const char* source);
 void mark_compiler_roots();
 static uint8_t create_constant(Value c);
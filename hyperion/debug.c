@@ -6,6 +6,7 @@
 #include "chunk.h"
 #include "debug.h"
 #include "object.h"
+#include "HVM.h"
 
 int simple_instruction(const char* op_command, int offset) {
   printf("%s\n", op_command);
@@ -23,10 +24,22 @@ int constant_instruction(const char* op_command, Chunk *chunk, int offset) {
 static int invoke_instruction(const char* name, Chunk* chunk, int offset) {
   uint8_t constant = chunk->code[offset + 1];
   uint8_t cnt = chunk->code[offset + 2];
+  uint16_t cache = (uint16_t)(chunk->code[offset + 3] << 8);
+  cache |= chunk->code[offset + 4];
   printf("%-16s (%d args) %4d '", name, cnt, constant);
   print_value(chunk->constants.values[constant]);
-  printf("'\n");
-  return offset + 3;
+  printf("' cache %d\n", cache);
+  return offset + 5;
+}
+
+static int property_instruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint16_t cache = (uint16_t)(chunk->code[offset + 2] << 8);
+  cache |= chunk->code[offset + 3];
+  printf("%-16s %4d '", name, constant);
+  print_value(chunk->constants.values[constant]);
+  printf("' cache %d\n", cache);
+  return offset + 4;
 }
 
 static int byte_instruction(const char* name, Chunk* chunk, int offset) {
@@ -35,6 +48,15 @@ static int byte_instruction(const char* name, Chunk* chunk, int offset) {
   return offset + 2; 
 }
 
+static int global_instruction(const char* name, Chunk* chunk, int offset) {
+  uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+  slot |= chunk->code[offset + 2];
+  printf("%-16s %4d '", name, slot);
+  print_value(hvm.global_names.values[slot]);
+  printf("'\n");
+  return offset + 3;
+}
+
 static int jump_instruction(const char* name, int sign, Chunk* chunk, int offset) {
   uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
   jump |= chunk->code[offset + 2];
@@ -42,6 +64,57 @@ static int jump_instruction(const char* name, int sign, Chunk* chunk, int offset
   return offset + 3;
 }
 
+// OP_FOR_PREP and OP_FOR_LOOP print as their test, then where they jump.
+static int counted_loop_instruction(const char* name, Chunk* chunk, int offset) {
+  static const char* comparisons[] = {"<", "<=", ">", ">="};
+  uint8_t mode = chunk->code[offset + 2];
+  uint16_t bound = (uint16_t)((chunk->code[offset + 3] << 8) | chunk->code[offset + 4]);
+  int target = jump_target(chunk, offset);
+
+  printf("%-16s %4d %s%s ", name, chunk->code[offset + 1],
+      comparisons[mode & FOR_COMPARE], (mode & FOR_STEP_DOWN) ? " decr" : "");
+  switch (mode & FOR_BOUND) {
+    case FOR_BOUND_LOCAL:
+      printf("local %d", bound);
+      break;
+    case FOR_BOUND_GLOBAL:
+      printf("'");
+      print_value(hvm.global_names.values[bound]);
+      printf("'");
+      break;
+    default:
+      printf("'");
+      print_value(chunk->constants.values[bound]);
+      printf("'");
+      break;
+  }
+  printf(" %4d -> %d\n", offset, target);
+  return offset + 7;
+}
+
+// The disassembler shows a superinstruction as one instruction and skips
+// the tail of the sequence it stands for.
+static int fused_local_constant_instruction(const char* name, Chunk* chunk,
+    int offset, int size) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint8_t constant = chunk->code[offset + 3];
+  printf("%-16s %4d '", name, slot);
+  print_value(chunk->constants.values[constant]);
+  printf("'\n");
+  return offset + size;
+}
+
+static int fused_two_locals_instruction(const char* name, Chunk* chunk, int offset) {
+  printf("%-16s %4d %4d\n", name, chunk->code[offset + 1], chunk->code[offset + 3]);
+  return offset + 4;
+}
+
+static int fused_jump_instruction(const char* name, Chunk* chunk, int offset) {
+  uint16_t jump = (uint16_t)(chunk->code[offset + 2] << 8);
+  jump |= chunk->code[offset + 3];
+  printf("%-16s %4d -> %d\n", name, offset, offset + 4 + jump);
+  return offset + 5;
+}
 
 int debug_instruction(Chunk *chunk, int offset) {
   printf("%04d ", offset);
@@ -55,6 +128,8 @@ int debug_instruction(Chunk *chunk, int offset) {
   switch (instruction) {
     case OP_BUILD_LIST:
       return byte_instruction("OP_BUILD_LIST", chunk, offset);
+    case OP_BUILD_MAP:
+      return byte_instruction("OP_BUILD_MAP", chunk, offset);
     case OP_INDEX_SUBSCR:
       return simple_instruction("OP_INDEX_SUBSCR", offset);
     case OP_STORE_SUBSCR:
@@ -68,9 +143,9 @@ int debug_instruction(Chunk *chunk, int offset) {
     case OP_METHOD:
       return constant_instruction("OP_METHOD", chunk, offset);
     case OP_GET_PROPERTY:
-      return constant_instruction("OP_GET_PROPERTY", chunk, offset);
+      return property_instruction("OP_GET_PROPERTY", chunk, offset);
     case OP_SET_PROPERTY:
-      return constant_instruction("OP_SET_PROPERTY", chunk, offset);
+      return property_instruction("OP_SET_PROPERTY", chunk, offset);
     case OP_CLASS:
       return constant_instruction("OP_CLASS", chunk, offset);
     case OP_NIL:
@@ -91,16 +166,20 @@ int debug_instruction(Chunk *chunk, int offset) {
       return simple_instruction("OP_POP", offset);
     case OP_CALL:
       return byte_instruction("OP_CALL", chunk, offset);
+    case OP_TAIL_CALL:
+      return byte_instruction("OP_TAIL_CALL", chunk, offset);
+    case OP_CALL_NATIVE:
+      return byte_instruction("OP_CALL_NATIVE", chunk, offset);
     case OP_GET_LOCAL:
       return byte_instruction("OP_GET_LOCAL", chunk, offset);
     case OP_SET_LOCAL:
       return byte_instruction("OP_SET_LOCAL", chunk, offset);
     case OP_DEFINE_GLOBAL:
-      return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+      return global_instruction("OP_DEFINE_GLOBAL", chunk, offset);
     case OP_GET_GLOBAL:
-      return constant_instruction("OP_GET_GLOBAL", chunk, offset);
+      return global_instruction("OP_GET_GLOBAL", chunk, offset);
     case OP_SET_GLOBAL:
-      return constant_instruction("OP_SET_GLOBAL", chunk, offset);
+      return global_instruction("OP_SET_GLOBAL", chunk, offset);
     case OP_NEGATE:
       return simple_instruction("OP_NEGATE", offset);
     case OP_POWER:
@@ -139,12 +218,46 @@ int debug_instruction(Chunk *chunk, int offset) {
       return simple_instruction("OP_GREATER", offset);
     case OP_LESS:
       return simple_instruction("OP_LESS", offset);
+    case OP_FOR_PREP:
+      return counted_loop_instruction("OP_FOR_PREP", chunk, offset);
+    case OP_FOR_LOOP:
+      return counted_loop_instruction("OP_FOR_LOOP", chunk, offset);
     case OP_GET_UPVALUE:
       return byte_instruction("OP_GET_UPVALUE", chunk, offset);
     case OP_SET_UPVALUE:
       return byte_instruction("OP_SET_UPVALUE", chunk, offset);
     case OP_CLOSE_UPVALUE:
       return simple_instruction("OP_CLOSE_UPVALUE", offset);
+    case OP_INC_LOCAL:
+      return fused_local_constant_instruction("OP_INC_LOCAL", chunk, offset, 8);
+    case OP_ADD_LOCAL_CONST:
+      return fused_local_constant_instruction("OP_ADD_LOCAL_CONST", chunk, offset, 5);
+    case OP_GET_LOCAL_GET_LOCAL:
+      return fused_two_locals_instruction("OP_GET_LOCAL_GET_LOCAL", chunk, offset);
+    case OP_LESS_JUMP_IF_FALSE:
+      return fused_jump_instruction("OP_LESS_JUMP_IF_FALSE", chunk, offset);
+    case OP_GREATER_JUMP_IF_FALSE:
+      return fused_jump_instruction("OP_GREATER_JUMP_IF_FALSE", chunk, offset);
+    case OP_LESS_INT:
+      return simple_instruction("OP_LESS_INT", offset);
+    case OP_LESS_DOUBLE:
+      return simple_instruction("OP_LESS_DOUBLE", offset);
+    case OP_GREATER_INT:
+      return simple_instruction("OP_GREATER_INT", offset);
+    case OP_GREATER_DOUBLE:
+      return simple_instruction("OP_GREATER_DOUBLE", offset);
+    case OP_MINUS_INT:
+      return simple_instruction("OP_MINUS_INT", offset);
+    case OP_MINUS_DOUBLE:
+      return simple_instruction("OP_MINUS_DOUBLE", offset);
+    case OP_MULTI_INT:
+      return simple_instruction("OP_MULTI_INT", offset);
+    case OP_MULTI_DOUBLE:
+      return simple_instruction("OP_MULTI_DOUBLE", offset);
+    case OP_DIVIDE_INT:
+      return simple_instruction("OP_DIVIDE_INT", offset);
+    case OP_DIVIDE_DOUBLE:
+      return simple_instruction("OP_DIVIDE_DOUBLE", offset);
     case OP_CLOSURE: {
       offset++;
       uint8_t constant = chunk->code[offset++];
@@ -0,0 +1,441 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emit_c.h"
+#include "chunk.h"
+#include "HVM.h"
+
+// Every function reachable from the script through its constants, the
+// script first. A function's index names its generated C.
+typedef struct {
+  ObjFunction** functions;
+  int count;
+  int capacity;
+} FunctionList;
+
+static void collect_functions(FunctionList* list, ObjFunction* function) {
+  if (list->count + 1 > list->capacity) {
+    list->capacity = list->capacity < 8 ? 8 : list->capacity * 2;
+    list->functions = (ObjFunction**)realloc(list->functions,
+        sizeof(ObjFunction*) * list->capacity);
+  }
+  list->functions[list->count++] = function;
+
+  ValueArray* constants = &function->chunk.constants;
+  for (int i = 0; i < constants->size; i++) {
+    if (IS_FUNCTION(constants->values[i])) {
+      collect_functions(list, AS_FUNCTION(constants->values[i]));
+    }
+  }
+}
+
+static int function_index(FunctionList* list, ObjFunction* function) {
+  for (int i = 0; i < list->count; i++) {
+    if (list->functions[i] == function) return i;
+  }
+  return -1;
+}
+
+static int read_short(uint8_t* code, int offset) {
+  return (uint16_t)((code[offset] << 8) | code[offset + 1]);
+}
+
+static void emit_string(FILE* out, const char* chars, int size) {
+  fputc('"', out);
+  for (int i = 0; i < size; i++) {
+    unsigned char c = (unsigned char)chars[i];
+    if (c == '"' || c == '\\') {
+      fprintf(out, "\\%c", c);
+    } else if (c >= ' ' && c < 127 && c != '?') {
+      fputc(c, out);
+    } else {
+      fprintf(out, "\\%03o", c);
+    }
+  }
+  fputc('"', out);
+}
+
+static void emit_value(FILE* out, FunctionList* list, Value value) {
+  if (IS_INT(value)) {
+    fprintf(out, "INT_VAL(%d)", AS_INT(value));
+  } else if (IS_DOUBLE(value)) {
+    double number = AS_DOUBLE(value);
+    if (isinf(number)) {
+      fprintf(out, "DOUBLE_VAL(%sHUGE_VAL)", number < 0 ? "-" : "");
+    } else {
+      fprintf(out, "DOUBLE_VAL(%a)", number);
+    }
+  } else if (IS_STRING(value)) {
+    ObjString* string = AS_STRING(value);
+    fprintf(out, "OBJ_VAL(copy_string(");
+    emit_string(out, string->chars, string->size);
+    fprintf(out, ", %d))", string->size);
+  } else if (IS_FUNCTION(value)) {
+    fprintf(out, "OBJ_VAL(load_fn_%d())", function_index(list, AS_FUNCTION(value)));
+  } else {
+    fprintf(out, "NIL_VAL");
+  }
+}
+
+// Marks the offsets the generated code jumps to, and among them the ones a
+// frame resumes at once a call it made returns.
+static void find_labels(Chunk* chunk, bool* labels, bool* resumes) {
+  uint8_t* code = chunk->code;
+  for (int offset = 0; offset < chunk->size;
+       offset += instruction_size(chunk, offset)) {
+    int next = offset + instruction_size(chunk, offset);
+    switch (code[offset]) {
+      case OP_JUMP:
+      case OP_JUMP_IF_FALSE:
+        labels[next + read_short(code, offset + 1)] = true;
+        break;
+      case OP_LOOP:
+      case OP_FOR_PREP:
+      case OP_FOR_LOOP:
+        labels[jump_target(chunk, offset)] = true;
+        break;
+      case OP_INC_LOCAL:
+        labels[offset + 8] = true;
+        break;
+      case OP_ADD_LOCAL_CONST:
+        labels[offset + 5] = true;
+        break;
+      case OP_LESS_JUMP_IF_FALSE:
+      case OP_GREATER_JUMP_IF_FALSE:
+        labels[offset + 5] = true;
+        labels[offset + 4 + read_short(code, offset + 2)] = true;
+        break;
+      case OP_CALL:
+      case OP_CALL_NATIVE:
+      case OP_TAIL_CALL:
+      case OP_INVOKE:
+        labels[next] = true;
+        resumes[next] = true;
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+static void emit_counted_loop(FILE* out, Chunk* chunk, int offset) {
+  static const char* comparisons[] = {"<", "<=", ">", ">="};
+  uint8_t* code = chunk->code;
+  int next = offset + instruction_size(chunk, offset);
+  uint8_t mode = code[offset + 2];
+  int bound = read_short(code, offset + 3);
+
+  if (code[offset] == OP_FOR_PREP) {
+    fprintf(out, "AOT_FOR_PREP(%d, %d, %d, ", next, offset, code[offset + 1]);
+  } else {
+    fprintf(out, "AOT_FOR_LOOP(%d, %d, %d, %d, ", next, offset, code[offset + 1],
+            FOR_STEP(mode));
+  }
+  switch (mode & FOR_BOUND) {
+    case FOR_BOUND_LOCAL: fprintf(out, "slots[%d]", bound); break;
+    case FOR_BOUND_GLOBAL: fprintf(out, "hvm.global_values.values[%d]", bound); break;
+    default: fprintf(out, "constants[%d]", bound); break;
+  }
+  fprintf(out, ", %s, L%d);", comparisons[mode & FOR_COMPARE],
+          jump_target(chunk, offset));
+}
+
+static void emit_instruction(FILE* out, Chunk* chunk, int offset) {
+  uint8_t* code = chunk->code;
+  int next = offset + instruction_size(chunk, offset);
+
+  switch (code[offset]) {
+    case OP_CONSTANT:
+      fprintf(out, "AOT_PUSH(constants[%d]);", code[offset + 1]);
+      break;
+    case OP_NIL:
+      fprintf(out, "AOT_PUSH(NIL_VAL);");
+      break;
+    case OP_TRUE:
+      fprintf(out, "AOT_PUSH(BOOL_VAL(true));");
+      break;
+    case OP_FALSE:
+      fprintf(out, "AOT_PUSH(BOOL_VAL(false));");
+      break;
+    case OP_POP:
+      fprintf(out, "top--;");
+      break;
+    // The second GET_LOCAL of the pair follows as its own instruction.
+    case OP_GET_LOCAL:
+    case OP_GET_LOCAL_GET_LOCAL:
+      fprintf(out, "AOT_PUSH(slots[%d]);", code[offset + 1]);
+      break;
+    case OP_SET_LOCAL:
+      fprintf(out, "slots[%d] = top[-1];", code[offset + 1]);
+      break;
+    case OP_GET_GLOBAL:
+      fprintf(out, "AOT_GET_GLOBAL(%d, %d);", next, read_short(code, offset + 1));
+      break;
+    case OP_SET_GLOBAL:
+      fprintf(out, "AOT_SET_GLOBAL(%d, %d);", next, read_short(code, offset + 1));
+      break;
+    case OP_DEFINE_GLOBAL:
+      fprintf(out, "hvm.global_values.values[%d] = *--top;",
+              read_short(code, offset + 1));
+      break;
+    case OP_GET_UPVALUE:
+      fprintf(out, "AOT_PUSH(*frame->closure->upvalues[%d]->location);",
+              code[offset + 1]);
+      break;
+    case OP_SET_UPVALUE:
+      fprintf(out, "AOT_SET_UPVALUE(%d);", code[offset + 1]);
+      break;
+    case OP_CLOSE_UPVALUE:
+      fprintf(out, "AOT_RUNTIME(%d, jit_close_upvalue());", next);
+      break;
+    case OP_JUMP:
+      fprintf(out, "goto L%d;", next + read_short(code, offset + 1));
+      break;
+    case OP_LOOP:
+      fprintf(out, "goto L%d;", next - read_short(code, offset + 1));
+      break;
+    case OP_FOR_PREP:
+    case OP_FOR_LOOP:
+      emit_counted_loop(out, chunk, offset);
+      break;
+    case OP_JUMP_IF_FALSE:
+      fprintf(out, "if (AOT_FALSEY(top[-1])) goto L%d;",
+              next + read_short(code, offset + 1));
+      break;
+    case OP_NOT:
+      fprintf(out, "top[-1] = BOOL_VAL(AOT_FALSEY(top[-1]));");
+      break;
+    case OP_NEGATE:
+      fprintf(out, "AOT_NEGATE(%d);", next);
+      break;
+    case OP_ADD:
+      fprintf(out, "AOT_INT_BINARY(%d, +, \"Operands must be two integers.\");", next);
+      break;
+    case OP_ADD_S:
+      fprintf(out, "AOT_RUNTIME(%d, jit_concatenate());", next);
+      break;
+    case OP_ADD_D:
+      fprintf(out, "AOT_ADD_D(%d);", next);
+      break;
+    case OP_MINUS:
+    case OP_MINUS_INT:
+      fprintf(out, "AOT_BINARY(%d, INT_VAL, -);", next);
+      break;
+    case OP_MINUS_D:
+    case OP_MINUS_DOUBLE:
+      fprintf(out, "AOT_BINARY(%d, DOUBLE_VAL, -);", next);
+      break;
+    case OP_MULTI:
+    case OP_MULTI_INT:
+      fprintf(out, "AOT_BINARY(%d, INT_VAL, *);", next);
+      break;
+    case OP_MULTI_D:
+    case OP_MULTI_DOUBLE:
+      fprintf(out, "AOT_BINARY(%d, DOUBLE_VAL, *);", next);
+      break;
+    case OP_DIVIDE:
+    case OP_DIVIDE_INT:
+      fprintf(out, "AOT_BINARY(%d, INT_VAL, /);", next);
+      break;
+    case OP_DIVIDE_D:
+    case OP_DIVIDE_DOUBLE:
+      fprintf(out, "AOT_BINARY(%d, DOUBLE_VAL, /);", next);
+      break;
+    case OP_MODULE:
+      fprintf(out, "AOT_INT_BINARY(%d, %%, \"Operands must be integers.\");", next);
+      break;
+    case OP_POWER:
+      fprintf(out, "AOT_INT_BINARY(%d, ^, \"Operands must be integers.\");", next);
+      break;
+    case OP_EQUAL:
+      fprintf(out, "AOT_EQUAL();");
+      break;
+    case OP_LESS:
+    case OP_LESS_INT:
+    case OP_LESS_DOUBLE:
+      fprintf(out, "AOT_BINARY(%d, BOOL_VAL, <);", next);
+      break;
+    case OP_GREATER:
+    case OP_GREATER_INT:
+    case OP_GREATER_DOUBLE:
+      fprintf(out, "AOT_BINARY(%d, BOOL_VAL, >);", next);
+      break;
+    // GET_LOCAL a, CONSTANT k, ADD, SET_LOCAL a, POP
+    case OP_INC_LOCAL:
+      fprintf(out, "AOT_INC_LOCAL(%d, %d, L%d);",
+              code[offset + 1], code[offset + 3], offset + 8);
+      break;
+    // GET_LOCAL a, CONSTANT k, ADD
+    case OP_ADD_LOCAL_CONST:
+      fprintf(out, "AOT_ADD_LOCAL_CONST(%d, %d, L%d);",
+              code[offset + 1], code[offset + 3], offset + 5);
+      break;
+    // LESS or GREATER, JUMP_IF_FALSE offset, POP
+    case OP_LESS_JUMP_IF_FALSE:
+    case OP_GREATER_JUMP_IF_FALSE: {
+      const char* op = code[offset] == OP_LESS_JUMP_IF_FALSE ? "<" : ">";
+      fprintf(out, "AOT_COMPARE_JUMP(%s, L%d, L%d);\n  AOT_BINARY(%d, BOOL_VAL, %s);",
+              op, offset + 5, offset + 4 + read_short(code, offset + 2), next, op);
+      break;
+    }
+    case OP_CALL:
+    case OP_CALL_NATIVE:
+      fprintf(out, "AOT_RUNTIME(%d, jit_call_value(%d));", next, code[offset + 1]);
+      break;
+    case OP_TAIL_CALL:
+      fprintf(out, "AOT_RUNTIME(%d, jit_tail_call(%d));", next, code[offset + 1]);
+      break;
+    case OP_INVOKE:
+      fprintf(out, "AOT_RUNTIME(%d, jit_invoke(AS_STRING(constants[%d]), %d, "
+              "&function->chunk.caches[%d]));", next, code[offset + 1],
+              code[offset + 2], read_short(code, offset + 3));
+      break;
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+      fprintf(out, "AOT_RUNTIME(%d, %s(AS_STRING(constants[%d]), "
+              "&function->chunk.caches[%d]));", next,
+              code[offset] == OP_GET_PROPERTY ? "jit_get_property" : "jit_set_property",
+              code[offset + 1], read_short(code, offset + 2));
+      break;
+    case OP_INDEX_SUBSCR:
+      fprintf(out, "AOT_RUNTIME(%d, jit_index_subscr());", next);
+      break;
+    case OP_STORE_SUBSCR:
+      fprintf(out, "AOT_RUNTIME(%d, jit_store_subscr());", next);
+      break;
+    case OP_BUILD_LIST:
+      fprintf(out, "AOT_RUNTIME(%d, jit_build_list(%d));", next, code[offset + 1]);
+      break;
+    case OP_BUILD_MAP:
+      fprintf(out, "AOT_RUNTIME(%d, jit_build_map(%d));", next, code[offset + 1]);
+      break;
+    case OP_PRINT:
+    case OP_PRINT_TOLINE:
+      fprintf(out, "AOT_RUNTIME(%d, jit_print(%s));", next,
+              code[offset] == OP_PRINT ? "true" : "false");
+      break;
+    case OP_CLOSURE:
+      fprintf(out, "AOT_RUNTIME(%d, jit_closure(AS_FUNCTION(constants[%d]), code + %d));",
+              next, code[offset + 1], offset + 2);
+      break;
+    case OP_CLASS:
+      fprintf(out, "AOT_RUNTIME(%d, jit_class(AS_STRING(constants[%d])));",
+              next, code[offset + 1]);
+      break;
+    case OP_METHOD:
+      fprintf(out, "AOT_RUNTIME(%d, jit_method(AS_STRING(constants[%d])));",
+              next, code[offset + 1]);
+      break;
+    case OP_IMPORT_STD:
+      fprintf(out, "AOT_RUNTIME(%d, jit_import_std(AS_STRING(constants[%d])));",
+              next, code[offset + 1]);
+      break;
+    case OP_IMPORT_MODULE:
+      fprintf(out, "AOT_LEAVE(%d, jit_import_module(AS_STRING(constants[%d])));",
+              next, code[offset + 1]);
+      break;
+    case OP_RETURN:
+      fprintf(out, "AOT_LEAVE(%d, jit_return());", next);
+      break;
+  }
+}
+
+static void emit_function(FILE* out, ObjFunction* function, int index) {
+  Chunk* chunk = &function->chunk;
+  bool* labels = (bool*)calloc(chunk->size + 1, sizeof(bool));
+  bool* resumes = (bool*)calloc(chunk->size + 1, sizeof(bool));
+  find_labels(chunk, labels, resumes);
+
+  fprintf(out, "// %s\n", function->name == NULL ? "script" : function->name->chars);
+  fprintf(out, "static int hypl_fn_%d(CallFrame* frame) {\n", index);
+  fprintf(out, "  AOT_BEGIN();\n");
+
+  fprintf(out, "  switch (frame->ip - code) {\n");
+  for (int offset = 0; offset < chunk->size; offset++) {
+    if (resumes[offset]) fprintf(out, "    case %d: goto L%d;\n", offset, offset);
+  }
+  fprintf(out, "  }\n\n");
+
+  for (int offset = 0; offset < chunk->size;
+       offset += instruction_size(chunk, offset)) {
+    if (labels[offset]) fprintf(out, "L%d:\n", offset);
+    fprintf(out, "  ");
+    emit_instruction(out, chunk, offset);
+    fprintf(out, "\n");
+  }
+  fprintf(out, "}\n\n");
+
+  free(labels);
+  free(resumes);
+}
+
+static void emit_loader(FILE* out, FunctionList* list, int index) {
+  ObjFunction* function = list->functions[index];
+  Chunk* chunk = &function->chunk;
+
+  fprintf(out, "static const uint8_t code_%d[] = {", index);
+  for (int i = 0; i < chunk->size; i++) {
+    fprintf(out, "%s%d,", i % 16 == 0 ? "\n  " : " ", chunk->code[i]);
+  }
+  fprintf(out, "\n};\n\n");
+
+  fprintf(out, "static const int lines_%d[] = {", index);
+  for (int i = 0; i < chunk->size; i++) {
+    fprintf(out, "%s%d,", i % 16 == 0 ? "\n  " : " ", chunk->lines[i]);
+  }
+  fprintf(out, "\n};\n\n");
+
+  fprintf(out, "static ObjFunction* load_fn_%d() {\n", index);
+  fprintf(out, "  ObjFunction* function = aot_begin_function(hypl_fn_%d, %d, %d, %d, ",
+          index, function->arity, function->upvalueCount, function->max_stack);
+  if (function->name == NULL) {
+    fprintf(out, "NULL");
+  } else {
+    emit_string(out, function->name->chars, function->name->size);
+  }
+  fprintf(out, ",\n      code_%d, lines_%d, %d, %d);\n",
+          index, index, chunk->size, chunk->cache_count);
+  for (int i = 0; i < chunk->constants.size; i++) {
+    fprintf(out, "  aot_constant(function, ");
+    emit_value(out, list, chunk->constants.values[i]);
+    fprintf(out, ");\n");
+  }
+  fprintf(out, "  return aot_end_function(function);\n}\n\n");
+}
+
+void emit_c(ObjFunction* script, FILE* out) {
+  FunctionList list;
+  list.functions = NULL;
+  list.count = 0;
+  list.capacity = 0;
+  collect_functions(&list, script);
+
+  fprintf(out, "// Generated by hypl --emit-c. Build it with compilation/aot.sh.\n\n");
+  fprintf(out, "#include <math.h>\n\n#include \"hyperion/aot.h\"\n\n");
+
+  for (int i = 0; i < list.count; i++) {
+    emit_function(out, list.functions[i], i);
+  }
+
+  // Nested functions are constants of the one around them, so they load
+  // first.
+  for (int i = list.count - 1; i >= 0; i--) {
+    emit_loader(out, &list, i);
+  }
+
+  // Globals get their slots in the order the compiler handed them out.
+  fprintf(out, "static ObjFunction* load_program() {\n");
+  for (int i = 0; i < hvm.global_names.size; i++) {
+    ObjString* name = AS_STRING(hvm.global_names.values[i]);
+    fprintf(out, "  aot_global(");
+    emit_string(out, name->chars, name->size);
+    fprintf(out, ", %d);\n", name->size);
+  }
+  fprintf(out, "  return load_fn_0();\n}\n\n");
+
+  fprintf(out, "int main(int argc, char* argv[]) {\n");
+  fprintf(out, "  return aot_main(argc, argv, load_program);\n}\n");
+
+  free(list.functions);
+}
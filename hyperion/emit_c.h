@@ -0,0 +1,15 @@
+#ifndef emit_c_h
+#define emit_c_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "object.h"
+
+// Writes the program compiled into script as a C translation unit for
+// aot.h's runtime support, with a main() that runs it. See aot.h.
+void emit_c(ObjFunction* script, FILE* out);
+
+#endif
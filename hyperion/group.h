@@ -0,0 +1,128 @@
+#ifndef group_h
+#define group_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The control bytes and group probing the hash tables share: Table for
+// interned string keys and ValueTable for any hashable value. Each slot has
+// a control byte that is empty, deleted, or the low seven bits of its key's
+// hash, and a probe compares a whole group of GROUP_SIZE control bytes
+// against those bits at once, so keys are only read for slots that
+// probably hold them. The control array has GROUP_SIZE - 1 more bytes that
+// mirror its start, so a group can be read at any slot without wrapping.
+#define GROUP_SIZE 16
+
+#define GROUP_MAX_LOAD 0.875
+
+// A full slot's control byte has the top bit clear, which tells it from the
+// two special values.
+#define CONTROL_EMPTY 0x80
+#define CONTROL_DELETED 0xfe
+#define IS_FULL(control) (((control) & 0x80) == 0)
+
+// The hash picks the group a probe starts at with its upper bits and goes
+// in the control byte with the lower seven.
+#define HASH_START(hash) ((hash) >> 7)
+#define HASH_TAG(hash) ((uint8_t)((hash) & 0x7f))
+
+#define CONTROL_SIZE(capacity) ((capacity) + GROUP_SIZE - 1)
+
+// Probes go from group to group by growing strides, which with a power of
+// two capacity reach every group before coming back to the first.
+#define PROBE_NEXT(position, stride, mask) \
+    ((stride) += GROUP_SIZE, (position) = ((position) + (stride)) & (mask))
+
+// Bit i of each mask is set when byte i of the group at control matches.
+#if defined(__SSE2__)
+
+static inline uint32_t match_tag(const uint8_t* control, uint8_t tag) {
+  __m128i group = _mm_loadu_si128((const __m128i*)control);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+}
+
+static inline uint32_t match_empty(const uint8_t* control) {
+  return match_tag(control, CONTROL_EMPTY);
+}
+
+// Empty and deleted are the only control bytes with the top bit set.
+static inline uint32_t match_free(const uint8_t* control) {
+  __m128i group = _mm_loadu_si128((const __m128i*)control);
+  return (uint32_t)_mm_movemask_epi8(group);
+}
+
+#else
+
+static inline uint32_t match_tag(const uint8_t* control, uint8_t tag) {
+  uint32_t mask = 0;
+  for (int i = 0; i < GROUP_SIZE; i++) {
+    if (control[i] == tag) mask |= 1u << i;
+  }
+  return mask;
+}
+
+static inline uint32_t match_empty(const uint8_t* control) {
+  return match_tag(control, CONTROL_EMPTY);
+}
+
+static inline uint32_t match_free(const uint8_t* control) {
+  uint32_t mask = 0;
+  for (int i = 0; i < GROUP_SIZE; i++) {
+    if (control[i] & 0x80) mask |= 1u << i;
+  }
+  return mask;
+}
+
+#endif
+
+// Sets a slot's control byte, and its mirror past the end when it has one.
+static inline void set_control(uint8_t* control, int capacity, int index, uint8_t value) {
+  control[index] = value;
+  control[((index - (GROUP_SIZE - 1)) & (capacity - 1)) + GROUP_SIZE - 1] = value;
+}
+
+// The first empty or deleted slot on hash's probe.
+static inline int find_free_slot(const uint8_t* control, int capacity, uint32_t hash) {
+  uint32_t mask = (uint32_t)capacity - 1;
+  uint32_t position = HASH_START(hash) & mask;
+  uint32_t stride = 0;
+  while (true) {
+    uint32_t match = match_free(control + position);
+    if (match != 0) return (int)((position + __builtin_ctz(match)) & mask);
+    PROBE_NEXT(position, stride, mask);
+  }
+}
+
+// A probe only goes past a slot from a group with no empty slot in it. If
+// the full and deleted slots around index are fewer than GROUP_SIZE, no
+// group holding index was ever full, so no probe has gone past it and a key
+// leaving it can leave it empty rather than deleted.
+static inline bool can_empty(const uint8_t* control, int capacity, int index) {
+  uint32_t mask = (uint32_t)capacity - 1;
+  uint32_t after = match_empty(control + index);
+  uint32_t before = match_empty(control + ((index - GROUP_SIZE) & mask));
+  if (after == 0 || before == 0) return false;
+  int full_after = __builtin_ctz(after);
+  int full_before = __builtin_clz(before) - (32 - GROUP_SIZE);
+  return full_after + full_before < GROUP_SIZE;
+}
+
+// How many groups a probe for a key with hash reads to reach slot index.
+static inline int probe_length(int capacity, uint32_t hash, int index) {
+  uint32_t mask = (uint32_t)capacity - 1;
+  uint32_t position = HASH_START(hash) & mask;
+  uint32_t stride = 0;
+  int groups = 1;
+  while ((((uint32_t)index - position) & mask) >= GROUP_SIZE) {
+    PROBE_NEXT(position, stride, mask);
+    groups++;
+  }
+  return groups;
+}
+
+#endif
@@ -0,0 +1,826 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+#include "HVM.h"
+#include "memory.h"
+
+#ifdef HVM_JIT
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Generated code keeps the VM state it touches most in callee-saved
+// registers, so it survives calls into the runtime:
+//
+//   rbx  hvm.top, written back before every runtime call
+//   r12  frame->slots
+//   r13  the CallFrame being run
+//   r14  &hvm
+//
+// Everything else lives where the interpreter keeps it, so compiled code can
+// hand a frame back to execute() at any instruction boundary.
+enum {
+  RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+  R12 = 12, R13 = 13, R14 = 14
+};
+
+#define TOP RBX
+#define SLOTS R12
+#define FRAME R13
+#define VM R14
+
+enum {
+  CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_L = 0xc, CC_GE = 0xd, CC_LE = 0xe,
+  CC_G = 0xf
+};
+
+// ModRM reg field values selecting the operation of a group opcode.
+enum { EXT_ADD = 0, EXT_AND = 4, EXT_SUB = 5, EXT_CMP = 7 };
+
+#define INT_TAG_HIGH ((QNAN | TAG_INT) >> 48)
+#define QNAN_HIGH (QNAN >> 48)
+#define OBJ_TAG_HIGH ((QNAN | SIGN_BIT) >> 50)
+
+typedef struct {
+  int at;
+  int label;
+} Fixup;
+
+// Labels 0 to size - 1 are bytecode offsets, size to 2 * size - 1 are the
+// exits to the interpreter for the instruction at label - size, and
+// 2 * size is the shared epilogue. Labels local to a template follow.
+typedef struct {
+  Chunk* chunk;
+
+  uint8_t* code;
+  int size;
+  int capacity;
+
+  int* labels;
+  int label_count;
+  int label_capacity;
+
+  Fixup* fixups;
+  int fixup_count;
+  int fixup_capacity;
+} Assembler;
+
+static void emit_byte(Assembler* as, uint8_t byte) {
+  if (as->size + 1 > as->capacity) {
+    as->capacity = as->capacity < 256 ? 256 : as->capacity * 2;
+    as->code = (uint8_t*)realloc(as->code, as->capacity);
+  }
+  as->code[as->size++] = byte;
+}
+
+static void emit_u32(Assembler* as, uint32_t value) {
+  for (int i = 0; i < 4; i++) emit_byte(as, (uint8_t)(value >> (8 * i)));
+}
+
+static void emit_u64(Assembler* as, uint64_t value) {
+  for (int i = 0; i < 8; i++) emit_byte(as, (uint8_t)(value >> (8 * i)));
+}
+
+static int new_label(Assembler* as) {
+  if (as->label_count + 1 > as->label_capacity) {
+    as->label_capacity *= 2;
+    as->labels = (int*)realloc(as->labels, sizeof(int) * as->label_capacity);
+  }
+  as->labels[as->label_count] = -1;
+  return as->label_count++;
+}
+
+static void place_label(Assembler* as, int label) {
+  as->labels[label] = as->size;
+}
+
+static int exit_label(Assembler* as, int offset) {
+  return as->chunk->size + offset;
+}
+
+static int leave_label(Assembler* as) {
+  return 2 * as->chunk->size;
+}
+
+// A rel32 to a label, patched once every label is placed.
+static void emit_rel32(Assembler* as, int label) {
+  if (as->fixup_count + 1 > as->fixup_capacity) {
+    as->fixup_capacity = as->fixup_capacity < 64 ? 64 : as->fixup_capacity * 2;
+    as->fixups = (Fixup*)realloc(as->fixups, sizeof(Fixup) * as->fixup_capacity);
+  }
+  as->fixups[as->fixup_count].at = as->size;
+  as->fixups[as->fixup_count].label = label;
+  as->fixup_count++;
+  emit_u32(as, 0);
+}
+
+// -- Instruction encoding -------------------------------------------------
+
+static void emit_rex(Assembler* as, bool wide, int reg, int rm) {
+  uint8_t rex = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+  if (rex != 0x40) emit_byte(as, rex);
+}
+
+// ModRM, and the SIB byte rsp and r12 need, for [base + disp].
+static void emit_mem(Assembler* as, int reg, int base, int32_t disp) {
+  bool short_disp = disp >= -128 && disp <= 127;
+  emit_byte(as, (short_disp ? 0x40 : 0x80) | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP) emit_byte(as, 0x24);
+  if (short_disp) {
+    emit_byte(as, (uint8_t)disp);
+  } else {
+    emit_u32(as, (uint32_t)disp);
+  }
+}
+
+// op reg, [base + disp]. Opcodes above 0xff carry their 0x0f escape.
+static void emit_op_mem(Assembler* as, bool wide, int op, int reg, int base,
+                        int32_t disp) {
+  emit_rex(as, wide, reg, base);
+  if (op > 0xff) emit_byte(as, op >> 8);
+  emit_byte(as, op & 0xff);
+  emit_mem(as, reg, base, disp);
+}
+
+// op rm, reg with both operands in registers.
+static void emit_op_reg(Assembler* as, bool wide, int op, int reg, int rm) {
+  emit_rex(as, wide, reg, rm);
+  if (op > 0xff) emit_byte(as, op >> 8);
+  emit_byte(as, op & 0xff);
+  emit_byte(as, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// Scalar double op xmm0, [base + disp]. The prefix goes before any REX.
+static void emit_sse_mem(Assembler* as, uint8_t prefix, uint8_t op, int base,
+                         int32_t disp) {
+  emit_byte(as, prefix);
+  emit_rex(as, false, 0, base);
+  emit_byte(as, 0x0f);
+  emit_byte(as, op);
+  emit_mem(as, 0, base, disp);
+}
+
+static void emit_load(Assembler* as, int dst, int base, int32_t disp) {
+  emit_op_mem(as, true, 0x8b, dst, base, disp);
+}
+
+static void emit_load32(Assembler* as, int dst, int base, int32_t disp) {
+  emit_op_mem(as, false, 0x8b, dst, base, disp);
+}
+
+static void emit_store(Assembler* as, int base, int32_t disp, int src) {
+  emit_op_mem(as, true, 0x89, src, base, disp);
+}
+
+static void emit_mov_imm(Assembler* as, int dst, uint64_t imm) {
+  emit_rex(as, true, 0, dst);
+  emit_byte(as, 0xb8 + (dst & 7));
+  emit_u64(as, imm);
+}
+
+static void emit_mov_imm32(Assembler* as, int dst, uint32_t imm) {
+  emit_rex(as, false, 0, dst);
+  emit_byte(as, 0xb8 + (dst & 7));
+  emit_u32(as, imm);
+}
+
+static void emit_alu_imm(Assembler* as, bool wide, int ext, int reg, int32_t imm) {
+  emit_op_reg(as, wide, 0x81, ext, reg);
+  emit_u32(as, (uint32_t)imm);
+}
+
+static void emit_shr_imm(Assembler* as, int reg, uint8_t amount) {
+  emit_op_reg(as, true, 0xc1, 5, reg);
+  emit_byte(as, amount);
+}
+
+static void emit_lea(Assembler* as, int dst, int base, int32_t disp) {
+  emit_op_mem(as, true, 0x8d, dst, base, disp);
+}
+
+static void emit_push_reg(Assembler* as, int reg) {
+  emit_rex(as, false, 0, reg);
+  emit_byte(as, 0x50 + (reg & 7));
+}
+
+static void emit_pop_reg(Assembler* as, int reg) {
+  emit_rex(as, false, 0, reg);
+  emit_byte(as, 0x58 + (reg & 7));
+}
+
+static void emit_jmp(Assembler* as, int label) {
+  emit_byte(as, 0xe9);
+  emit_rel32(as, label);
+}
+
+static void emit_jcc(Assembler* as, int cc, int label) {
+  emit_byte(as, 0x0f);
+  emit_byte(as, 0x80 + cc);
+  emit_rel32(as, label);
+}
+
+static void emit_call(Assembler* as, void* function) {
+  emit_mov_imm(as, RAX, (uint64_t)(uintptr_t)function);
+  emit_op_reg(as, false, 0xff, 2, RAX);
+}
+
+// -- Value helpers --------------------------------------------------------
+
+static void emit_push_value(Assembler* as, int reg) {
+  emit_store(as, TOP, 0, reg);
+  emit_alu_imm(as, true, EXT_ADD, TOP, sizeof(Value));
+}
+
+static void emit_drop(Assembler* as, int count) {
+  emit_alu_imm(as, true, EXT_SUB, TOP, count * (int)sizeof(Value));
+}
+
+// Jumps to fail unless the value at [base + disp] is an int. Ints are the
+// only values whose top 16 bits are exactly QNAN | TAG_INT.
+static void emit_check_int(Assembler* as, int base, int32_t disp, int fail) {
+  emit_load(as, RCX, base, disp);
+  emit_shr_imm(as, RCX, 48);
+  emit_alu_imm(as, false, EXT_CMP, RCX, INT_TAG_HIGH);
+  emit_jcc(as, CC_NE, fail);
+}
+
+static void emit_check_double(Assembler* as, int base, int32_t disp, int fail) {
+  emit_load(as, RCX, base, disp);
+  emit_shr_imm(as, RCX, 48);
+  emit_alu_imm(as, false, EXT_AND, RCX, QNAN_HIGH);
+  emit_alu_imm(as, false, EXT_CMP, RCX, QNAN_HIGH);
+  emit_jcc(as, CC_E, fail);
+}
+
+// Boxes the int in eax. The 32-bit op that produced it cleared the rest.
+static void emit_box_int(Assembler* as) {
+  emit_mov_imm(as, RCX, QNAN | TAG_INT);
+  emit_op_reg(as, true, 0x09, RCX, RAX);
+}
+
+static void call_write_barrier(Obj* owner, Value value) {
+  write_barrier(owner, value);
+}
+
+// The write barrier after storing rsi into a field of the object in rdi.
+// Only object values can need remembering, so others skip the call.
+static void emit_write_barrier(Assembler* as) {
+  int done = new_label(as);
+  emit_op_reg(as, true, 0x89, RSI, RCX);
+  emit_shr_imm(as, RCX, 50);
+  emit_alu_imm(as, false, EXT_CMP, RCX, OBJ_TAG_HIGH);
+  emit_jcc(as, CC_NE, done);
+  emit_call(as, (void*)call_write_barrier);
+  place_label(as, done);
+}
+
+// Turns the condition cc into TRUE_VAL or FALSE_VAL in rax. TRUE_VAL is
+// FALSE_VAL + 1.
+static void emit_bool_from_flags(Assembler* as, int cc) {
+  emit_byte(as, 0x0f);
+  emit_byte(as, 0x90 + cc);
+  emit_byte(as, 0xc0);
+  emit_op_reg(as, false, 0x0fb6, RAX, RAX);
+  emit_mov_imm(as, RCX, FALSE_VAL);
+  emit_op_reg(as, true, 0x01, RCX, RAX);
+}
+
+// Hands the instruction at offset to the interpreter.
+static void emit_exit_stub(Assembler* as, int offset) {
+  emit_store(as, VM, offsetof(HVM, top), TOP);
+  emit_mov_imm(as, RAX, (uint64_t)(uintptr_t)(as->chunk->code + offset));
+  emit_store(as, FRAME, offsetof(CallFrame, ip), RAX);
+  emit_mov_imm32(as, RAX, JIT_EXITED);
+  emit_jmp(as, leave_label(as));
+}
+
+// Calls a runtime entry point whose arguments are already in rdi, rsi and
+// rdx. The stack top and an ip just past the instruction are written back
+// first, as the interpreter would have them, so errors report the right
+// line and a pushed frame returns to the right place. Anything but
+// JIT_CONTINUE leaves with that status. Otherwise the stack may have moved,
+// so the registers pointing into it are reloaded.
+static void emit_runtime_call(Assembler* as, void* function, int next) {
+  emit_store(as, VM, offsetof(HVM, top), TOP);
+  emit_mov_imm(as, RAX, (uint64_t)(uintptr_t)(as->chunk->code + next));
+  emit_store(as, FRAME, offsetof(CallFrame, ip), RAX);
+  emit_call(as, function);
+  emit_op_reg(as, false, 0x85, RAX, RAX);
+  emit_jcc(as, CC_NE, leave_label(as));
+  emit_load(as, TOP, VM, offsetof(HVM, top));
+  emit_load(as, SLOTS, FRAME, offsetof(CallFrame, slots));
+}
+
+// -- Templates ------------------------------------------------------------
+
+// Both operands ints, op eax, [second] and box. Anything else goes to the
+// interpreter, which also raises the errors.
+static void emit_int_binary(Assembler* as, int op, int fail) {
+  emit_check_int(as, TOP, -16, fail);
+  emit_check_int(as, TOP, -8, fail);
+  emit_load32(as, RAX, TOP, -16);
+  emit_op_mem(as, false, op, RAX, TOP, -8);
+  emit_box_int(as);
+  emit_store(as, TOP, -16, RAX);
+  emit_drop(as, 1);
+}
+
+static void emit_double_binary(Assembler* as, uint8_t op, int fail) {
+  emit_check_double(as, TOP, -16, fail);
+  emit_check_double(as, TOP, -8, fail);
+  emit_sse_mem(as, 0xf2, 0x10, TOP, -16);
+  emit_sse_mem(as, 0xf2, op, TOP, -8);
+  emit_sse_mem(as, 0xf2, 0x11, TOP, -16);
+  emit_drop(as, 1);
+}
+
+// Integer division and remainder. A zero or -1 divisor is left to the
+// interpreter.
+static void emit_int_divide(Assembler* as, bool remainder, int fail) {
+  emit_check_int(as, TOP, -16, fail);
+  emit_check_int(as, TOP, -8, fail);
+  emit_load32(as, RCX, TOP, -8);
+  emit_alu_imm(as, false, EXT_CMP, RCX, 0);
+  emit_jcc(as, CC_E, fail);
+  emit_alu_imm(as, false, EXT_CMP, RCX, -1);
+  emit_jcc(as, CC_E, fail);
+  emit_load32(as, RAX, TOP, -16);
+  emit_byte(as, 0x99);
+  emit_op_reg(as, false, 0xf7, 7, RCX);
+  if (remainder) emit_op_reg(as, false, 0x89, RDX, RAX);
+  emit_box_int(as);
+  emit_store(as, TOP, -16, RAX);
+  emit_drop(as, 1);
+}
+
+// LESS or GREATER on two ints or two doubles, leaving a bool.
+static void emit_compare(Assembler* as, bool less, int fail) {
+  int doubles = new_label(as);
+  int done = new_label(as);
+
+  emit_check_int(as, TOP, -16, doubles);
+  emit_check_int(as, TOP, -8, doubles);
+  emit_load32(as, RAX, TOP, -16);
+  emit_op_mem(as, false, 0x3b, RAX, TOP, -8);
+  emit_bool_from_flags(as, less ? CC_L : CC_G);
+  emit_jmp(as, done);
+
+  // ucomisd sets "above" only for an ordered result, so NaN compares false
+  // as it does in C. a < b is tested as b > a.
+  place_label(as, doubles);
+  emit_check_double(as, TOP, -16, fail);
+  emit_check_double(as, TOP, -8, fail);
+  emit_sse_mem(as, 0xf2, 0x10, TOP, less ? -8 : -16);
+  emit_sse_mem(as, 0x66, 0x2e, TOP, less ? -16 : -8);
+  emit_bool_from_flags(as, CC_A);
+
+  place_label(as, done);
+  emit_store(as, TOP, -16, RAX);
+  emit_drop(as, 1);
+}
+
+// LESS or GREATER fused with the JUMP_IF_FALSE and POP after it. Two ints
+// branch straight to either side, anything else runs the unfused sequence.
+static void emit_compare_jump(Assembler* as, int offset, bool less) {
+  uint8_t* code = as->chunk->code;
+  int target = offset + 4 + (uint16_t)((code[offset + 2] << 8) | code[offset + 3]);
+  int slow = new_label(as);
+
+  emit_check_int(as, TOP, -16, slow);
+  emit_check_int(as, TOP, -8, slow);
+  emit_load32(as, RAX, TOP, -16);
+  emit_op_mem(as, false, 0x3b, RAX, TOP, -8);
+  emit_lea(as, TOP, TOP, -16);
+  emit_jcc(as, less ? CC_L : CC_G, offset + 5);
+  emit_mov_imm(as, RAX, FALSE_VAL);
+  emit_push_value(as, RAX);
+  emit_jmp(as, target);
+
+  place_label(as, slow);
+  emit_compare(as, less, exit_label(as, offset));
+}
+
+// FOR_PREP and FOR_LOOP on an int counter and an int bound. Anything else,
+// an undefined global bound included, goes to the interpreter before the
+// counter is touched.
+static void emit_counted_loop(Assembler* as, int offset, int fail) {
+  Chunk* chunk = as->chunk;
+  uint8_t* code = chunk->code;
+  bool prep = code[offset] == OP_FOR_PREP;
+  uint8_t mode = code[offset + 2];
+  int32_t counter = code[offset + 1] * sizeof(Value);
+  uint16_t index = (uint16_t)((code[offset + 3] << 8) | code[offset + 4]);
+  int32_t bound = index * sizeof(Value);
+  int base = SLOTS;
+
+  emit_check_int(as, SLOTS, counter, fail);
+  switch (mode & FOR_BOUND) {
+    case FOR_BOUND_GLOBAL:
+      emit_load(as, RDX, VM, offsetof(HVM, global_values) + offsetof(ValueArray, values));
+      base = RDX;
+      emit_check_int(as, base, bound, fail);
+      break;
+    case FOR_BOUND_LOCAL:
+      emit_check_int(as, base, bound, fail);
+      break;
+    default:
+      if (!IS_INT(chunk->constants.values[index])) {
+        emit_jmp(as, fail);
+        return;
+      }
+      break;
+  }
+
+  emit_load32(as, RAX, SLOTS, counter);
+  if (!prep) {
+    emit_alu_imm(as, false, EXT_ADD, RAX, FOR_STEP(mode));
+    emit_box_int(as);
+    emit_store(as, SLOTS, counter, RAX);
+  }
+  if ((mode & FOR_BOUND) == FOR_BOUND_CONSTANT) {
+    emit_alu_imm(as, false, EXT_CMP, RAX, AS_INT(chunk->constants.values[index]));
+  } else {
+    emit_op_mem(as, false, 0x3b, RAX, base, bound);
+  }
+
+  // FOR_PREP leaves the loop when the test fails, FOR_LOOP goes round again
+  // while it holds.
+  static const int holds[] = {CC_L, CC_LE, CC_G, CC_GE};
+  static const int fails[] = {CC_GE, CC_G, CC_LE, CC_L};
+  int compare = mode & FOR_COMPARE;
+  emit_jcc(as, prep ? fails[compare] : holds[compare], jump_target(chunk, offset));
+}
+
+static void emit_instruction(Assembler* as, int offset) {
+  Chunk* chunk = as->chunk;
+  uint8_t* code = chunk->code;
+  int next = offset + instruction_size(chunk, offset);
+  int exit = exit_label(as, offset);
+
+  switch (code[offset]) {
+    case OP_CONSTANT:
+      emit_mov_imm(as, RAX, chunk->constants.values[code[offset + 1]]);
+      emit_push_value(as, RAX);
+      break;
+    case OP_NIL:
+      emit_mov_imm(as, RAX, NIL_VAL);
+      emit_push_value(as, RAX);
+      break;
+    case OP_TRUE:
+      emit_mov_imm(as, RAX, TRUE_VAL);
+      emit_push_value(as, RAX);
+      break;
+    case OP_FALSE:
+      emit_mov_imm(as, RAX, FALSE_VAL);
+      emit_push_value(as, RAX);
+      break;
+    case OP_POP:
+      emit_drop(as, 1);
+      break;
+    // The second GET_LOCAL of the pair follows as its own instruction.
+    case OP_GET_LOCAL:
+    case OP_GET_LOCAL_GET_LOCAL:
+      emit_load(as, RAX, SLOTS, code[offset + 1] * sizeof(Value));
+      emit_push_value(as, RAX);
+      break;
+    case OP_SET_LOCAL:
+      emit_load(as, RAX, TOP, -8);
+      emit_store(as, SLOTS, code[offset + 1] * sizeof(Value), RAX);
+      break;
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_DEFINE_GLOBAL: {
+      int32_t disp = ((code[offset + 1] << 8) | code[offset + 2]) * sizeof(Value);
+      emit_load(as, RDX, VM, offsetof(HVM, global_values) + offsetof(ValueArray, values));
+      if (code[offset] == OP_DEFINE_GLOBAL) {
+        emit_load(as, RAX, TOP, -8);
+        emit_store(as, RDX, disp, RAX);
+        emit_drop(as, 1);
+        break;
+      }
+      // An undefined global is an error, which the interpreter reports.
+      emit_load(as, RAX, RDX, disp);
+      emit_mov_imm(as, RCX, UNDEFINED_VAL);
+      emit_op_reg(as, true, 0x39, RCX, RAX);
+      emit_jcc(as, CC_E, exit);
+      if (code[offset] == OP_GET_GLOBAL) {
+        emit_push_value(as, RAX);
+      } else {
+        emit_load(as, RAX, TOP, -8);
+        emit_store(as, RDX, disp, RAX);
+      }
+      break;
+    }
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+      emit_load(as, RAX, FRAME, offsetof(CallFrame, closure));
+      emit_load(as, RAX, RAX, offsetof(ObjClosure, upvalues));
+      emit_load(as, RDI, RAX, code[offset + 1] * sizeof(ObjUpvalue*));
+      emit_load(as, RAX, RDI, offsetof(ObjUpvalue, location));
+      if (code[offset] == OP_GET_UPVALUE) {
+        emit_load(as, RAX, RAX, 0);
+        emit_push_value(as, RAX);
+      } else {
+        emit_load(as, RSI, TOP, -8);
+        emit_store(as, RAX, 0, RSI);
+        emit_write_barrier(as);
+      }
+      break;
+    case OP_JUMP:
+      emit_jmp(as, next + ((code[offset + 1] << 8) | code[offset + 2]));
+      break;
+    case OP_LOOP:
+      emit_jmp(as, next - ((code[offset + 1] << 8) | code[offset + 2]));
+      break;
+    case OP_FOR_PREP:
+    case OP_FOR_LOOP:
+      emit_counted_loop(as, offset, exit);
+      break;
+    case OP_JUMP_IF_FALSE:
+      emit_mov_imm(as, RAX, FALSE_VAL);
+      emit_op_mem(as, true, 0x39, RAX, TOP, -8);
+      emit_jcc(as, CC_E, next + ((code[offset + 1] << 8) | code[offset + 2]));
+      break;
+    case OP_NOT:
+      emit_mov_imm(as, RCX, FALSE_VAL);
+      emit_op_mem(as, true, 0x39, RCX, TOP, -8);
+      emit_bool_from_flags(as, CC_E);
+      emit_store(as, TOP, -8, RAX);
+      break;
+    case OP_NEGATE: {
+      int doubles = new_label(as);
+      int done = new_label(as);
+      emit_check_int(as, TOP, -8, doubles);
+      emit_load32(as, RAX, TOP, -8);
+      emit_op_reg(as, false, 0xf7, 3, RAX);
+      emit_box_int(as);
+      emit_store(as, TOP, -8, RAX);
+      emit_jmp(as, done);
+      place_label(as, doubles);
+      emit_check_double(as, TOP, -8, exit);
+      emit_load(as, RAX, TOP, -8);
+      emit_mov_imm(as, RCX, SIGN_BIT);
+      emit_op_reg(as, true, 0x31, RCX, RAX);
+      emit_store(as, TOP, -8, RAX);
+      place_label(as, done);
+      break;
+    }
+    case OP_ADD:
+      emit_int_binary(as, 0x03, exit);
+      break;
+    case OP_MINUS:
+    case OP_MINUS_INT:
+      emit_int_binary(as, 0x2b, exit);
+      break;
+    case OP_MULTI:
+    case OP_MULTI_INT:
+      emit_int_binary(as, 0x0faf, exit);
+      break;
+    case OP_POWER:
+      emit_int_binary(as, 0x33, exit);
+      break;
+    case OP_DIVIDE:
+    case OP_DIVIDE_INT:
+      emit_int_divide(as, false, exit);
+      break;
+    case OP_MODULE:
+      emit_int_divide(as, true, exit);
+      break;
+    case OP_ADD_D:
+      emit_double_binary(as, 0x58, exit);
+      break;
+    case OP_MINUS_D:
+    case OP_MINUS_DOUBLE:
+      emit_double_binary(as, 0x5c, exit);
+      break;
+    case OP_MULTI_D:
+    case OP_MULTI_DOUBLE:
+      emit_double_binary(as, 0x59, exit);
+      break;
+    case OP_DIVIDE_D:
+    case OP_DIVIDE_DOUBLE:
+      emit_double_binary(as, 0x5e, exit);
+      break;
+    case OP_LESS:
+    case OP_LESS_INT:
+    case OP_LESS_DOUBLE:
+      emit_compare(as, true, exit);
+      break;
+    case OP_GREATER:
+    case OP_GREATER_INT:
+    case OP_GREATER_DOUBLE:
+      emit_compare(as, false, exit);
+      break;
+    case OP_EQUAL:
+      emit_load(as, RDI, TOP, -16);
+      emit_load(as, RSI, TOP, -8);
+      emit_call(as, (void*)are_equal);
+      // A bool return only defines al.
+      emit_op_reg(as, false, 0x84, RAX, RAX);
+      emit_bool_from_flags(as, CC_NE);
+      emit_store(as, TOP, -16, RAX);
+      emit_drop(as, 1);
+      break;
+    // GET_LOCAL a, CONSTANT k, ADD, SET_LOCAL a, POP
+    case OP_INC_LOCAL:
+    // GET_LOCAL a, CONSTANT k, ADD
+    case OP_ADD_LOCAL_CONST: {
+      int32_t disp = code[offset + 1] * sizeof(Value);
+      int32_t step = AS_INT(chunk->constants.values[code[offset + 3]]);
+      int slow = new_label(as);
+      emit_check_int(as, SLOTS, disp, slow);
+      emit_load32(as, RAX, SLOTS, disp);
+      emit_alu_imm(as, false, EXT_ADD, RAX, step);
+      emit_box_int(as);
+      if (code[offset] == OP_INC_LOCAL) {
+        emit_store(as, SLOTS, disp, RAX);
+        emit_jmp(as, offset + 8);
+      } else {
+        emit_push_value(as, RAX);
+        emit_jmp(as, offset + 5);
+      }
+      place_label(as, slow);
+      emit_load(as, RAX, SLOTS, disp);
+      emit_push_value(as, RAX);
+      break;
+    }
+    case OP_LESS_JUMP_IF_FALSE:
+      emit_compare_jump(as, offset, true);
+      break;
+    case OP_GREATER_JUMP_IF_FALSE:
+      emit_compare_jump(as, offset, false);
+      break;
+    case OP_CALL:
+    case OP_CALL_NATIVE:
+      emit_mov_imm32(as, RDI, code[offset + 1]);
+      emit_runtime_call(as, (void*)jit_call_value, next);
+      break;
+    case OP_TAIL_CALL:
+      emit_mov_imm32(as, RDI, code[offset + 1]);
+      emit_runtime_call(as, (void*)jit_tail_call, next);
+      break;
+    case OP_INVOKE:
+      emit_mov_imm(as, RDI, (uint64_t)(uintptr_t)AS_OBJ(chunk->constants.values[code[offset + 1]]));
+      emit_mov_imm32(as, RSI, code[offset + 2]);
+      emit_mov_imm(as, RDX, (uint64_t)(uintptr_t)
+          &chunk->caches[(code[offset + 3] << 8) | code[offset + 4]]);
+      emit_runtime_call(as, (void*)jit_invoke, next);
+      break;
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+      emit_mov_imm(as, RDI, (uint64_t)(uintptr_t)AS_OBJ(chunk->constants.values[code[offset + 1]]));
+      emit_mov_imm(as, RSI, (uint64_t)(uintptr_t)
+          &chunk->caches[(code[offset + 2] << 8) | code[offset + 3]]);
+      emit_runtime_call(as, code[offset] == OP_GET_PROPERTY
+          ? (void*)jit_get_property : (void*)jit_set_property, next);
+      break;
+    case OP_INDEX_SUBSCR:
+      emit_runtime_call(as, (void*)jit_index_subscr, next);
+      break;
+    case OP_STORE_SUBSCR:
+      emit_runtime_call(as, (void*)jit_store_subscr, next);
+      break;
+    case OP_BUILD_LIST:
+      emit_mov_imm32(as, RDI, code[offset + 1]);
+      emit_runtime_call(as, (void*)jit_build_list, next);
+      break;
+    case OP_BUILD_MAP:
+      emit_mov_imm32(as, RDI, code[offset + 1]);
+      emit_runtime_call(as, (void*)jit_build_map, next);
+      break;
+    case OP_ADD_S:
+      emit_runtime_call(as, (void*)jit_concatenate, next);
+      break;
+    case OP_PRINT:
+    case OP_PRINT_TOLINE:
+      emit_mov_imm32(as, RDI, code[offset] == OP_PRINT);
+      emit_runtime_call(as, (void*)jit_print, next);
+      break;
+    case OP_CLOSE_UPVALUE:
+      emit_runtime_call(as, (void*)jit_close_upvalue, next);
+      break;
+    case OP_RETURN:
+      emit_runtime_call(as, (void*)jit_return, next);
+      break;
+    default:
+      // Closures, classes, methods and imports run rarely enough to leave
+      // to the interpreter.
+      emit_jmp(as, exit);
+      break;
+  }
+}
+
+// Entered as JitStatus (*)(CallFrame* frame, void* target): saves the
+// registers it uses, loads the VM state into them and jumps to target.
+// Four pushes and the sub keep rsp 16-byte aligned for runtime calls.
+static void emit_prologue(Assembler* as) {
+  emit_push_reg(as, RBX);
+  emit_push_reg(as, R12);
+  emit_push_reg(as, R13);
+  emit_push_reg(as, R14);
+  emit_alu_imm(as, true, EXT_SUB, RSP, 8);
+  emit_op_reg(as, true, 0x89, RDI, FRAME);
+  emit_mov_imm(as, VM, (uint64_t)(uintptr_t)&hvm);
+  emit_load(as, SLOTS, FRAME, offsetof(CallFrame, slots));
+  emit_load(as, TOP, VM, offsetof(HVM, top));
+  emit_op_reg(as, false, 0xff, 4, RSI);
+}
+
+static void emit_epilogue(Assembler* as) {
+  place_label(as, leave_label(as));
+  emit_alu_imm(as, true, EXT_ADD, RSP, 8);
+  emit_pop_reg(as, R14);
+  emit_pop_reg(as, R13);
+  emit_pop_reg(as, R12);
+  emit_pop_reg(as, RBX);
+  emit_byte(as, 0xc3);
+}
+
+static void free_assembler(Assembler* as) {
+  free(as->code);
+  free(as->labels);
+  free(as->fixups);
+}
+
+bool jit_compile(ObjFunction* function) {
+  if (!hvm.jit_enabled) return false;
+  if (function->jit != NULL) return true;
+
+  Chunk* chunk = &function->chunk;
+  Assembler as;
+  memset(&as, 0, sizeof(Assembler));
+  as.chunk = chunk;
+  as.label_count = 2 * chunk->size + 1;
+  as.label_capacity = as.label_count + 64;
+  as.labels = (int*)malloc(sizeof(int) * as.label_capacity);
+  for (int i = 0; i < as.label_count; i++) as.labels[i] = -1;
+
+  emit_prologue(&as);
+  for (int offset = 0; offset < chunk->size;
+       offset += instruction_size(chunk, offset)) {
+    place_label(&as, offset);
+    emit_instruction(&as, offset);
+  }
+
+  // Exit stubs, only for the instructions that asked for one.
+  for (int i = 0; i < as.fixup_count; i++) {
+    int label = as.fixups[i].label;
+    if (label >= chunk->size && label < 2 * chunk->size && as.labels[label] < 0) {
+      place_label(&as, label);
+      emit_exit_stub(&as, label - chunk->size);
+    }
+  }
+  emit_epilogue(&as);
+
+  for (int i = 0; i < as.fixup_count; i++) {
+    int at = as.fixups[i].at;
+    int32_t rel = as.labels[as.fixups[i].label] - (at + 4);
+    memcpy(&as.code[at], &rel, sizeof(int32_t));
+  }
+
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t mapped_size = (as.size + page - 1) / page * page;
+  void* memory = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    free_assembler(&as);
+    return false;
+  }
+  memcpy(memory, as.code, as.size);
+  if (mprotect(memory, mapped_size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, mapped_size);
+    free_assembler(&as);
+    return false;
+  }
+
+  JitCode* jit = (JitCode*)malloc(sizeof(JitCode));
+  jit->code = (uint8_t*)memory;
+  jit->mapped_size = mapped_size;
+  jit->entry_count = chunk->size;
+  jit->entries = (void**)malloc(sizeof(void*) * chunk->size);
+  for (int offset = 0; offset < chunk->size; offset++) {
+    jit->entries[offset] = as.labels[offset] < 0 ? NULL : jit->code + as.labels[offset];
+  }
+  free_assembler(&as);
+
+  function->jit = jit;
+  return true;
+}
+
+typedef JitStatus (*JitEntry)(CallFrame* frame, void* target);
+
+JitStatus jit_run(CallFrame* frame) {
+  ObjFunction* function = frame->closure->function;
+  void* target = function->jit->entries[frame->ip - function->chunk.code];
+  if (target == NULL) return JIT_EXITED;
+  return ((JitEntry)(void*)function->jit->code)(frame, target);
+}
+
+void free_jit_code(JitCode* jit) {
+  munmap(jit->code, jit->mapped_size);
+  free(jit->entries);
+  free(jit);
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef jit_h
+#define jit_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "object.h"
+#include "chunk.h"
+
+// The baseline JIT turns a hot function's chunk into x86-64 code, one
+// template per opcode. It needs NaN-boxed values and mmap, and is left out
+// of builds that count instructions, since compiled code runs uncounted.
+// Build with -DHVM_NO_JIT to leave it out everywhere.
+#if defined(__x86_64__) && defined(__GNUC__) && defined(NAN_BOXING) && \
+    (defined(__linux__) || defined(__APPLE__)) && \
+    !defined(HVM_NO_JIT) && !defined(HVM_COUNT_INSTRUCTIONS)
+#define HVM_JIT
+#endif
+
+// Calls plus loop back-edges a function runs interpreted before it is
+// compiled. Building with -DJIT_HOT_THRESHOLD=1 compiles everything on its
+// first call.
+#ifndef JIT_HOT_THRESHOLD
+#define JIT_HOT_THRESHOLD 1000
+#endif
+
+// What compiled code reports when it hands control back to execute(). The
+// runtime entry points below return JIT_CONTINUE to let the generated code
+// carry on, or one of the others to make it stop and pass that along.
+typedef enum {
+  JIT_CONTINUE,
+  // The frame returned and has been popped.
+  JIT_RETURNED,
+  // A call pushed a new frame, or a tail call restarted this one.
+  JIT_CALLED,
+  // Stopped before an instruction the interpreter has to run. frame->ip
+  // points at it.
+  JIT_EXITED,
+  // A runtime error has been reported.
+  JIT_ERROR,
+  // An import handed the rest of the run to a nested interpret(), which
+  // has finished it. See jit_import_module().
+  JIT_FINISHED
+} JitStatus;
+
+// Machine code for one function. entries maps each bytecode offset that
+// starts an instruction to its template, so the code can be entered at a
+// call, after a return, or by on-stack replacement at a loop header.
+typedef struct JitCode {
+  uint8_t* code;
+  size_t mapped_size;
+  void** entries;
+  int entry_count;
+} JitCode;
+
+struct CallFrame;
+
+bool jit_compile(ObjFunction* function);
+JitStatus jit_run(struct CallFrame* frame);
+void free_jit_code(JitCode* jit);
+
+// Runtime entry points called from generated code, the JIT's templates
+// and the C that --emit-c writes, for the instructions whose work is too big
+// to inline. They are defined in HVM.c next to the interpreter internals
+// they share, and exist whether or not the JIT is built. The generated code
+// stores the stack top and the frame's ip before calling any of them.
+JitStatus jit_call_value(int cnt);
+JitStatus jit_tail_call(int cnt);
+JitStatus jit_invoke(ObjString* name, int cnt, InlineCache* cache);
+JitStatus jit_get_property(ObjString* name, InlineCache* cache);
+JitStatus jit_set_property(ObjString* name, InlineCache* cache);
+JitStatus jit_index_subscr();
+JitStatus jit_store_subscr();
+JitStatus jit_build_list(int count);
+JitStatus jit_build_map(int count);
+JitStatus jit_concatenate();
+JitStatus jit_print(bool newline);
+JitStatus jit_close_upvalue();
+JitStatus jit_return();
+JitStatus jit_closure(ObjFunction* function, const uint8_t* upvalues);
+JitStatus jit_class(ObjString* name);
+JitStatus jit_method(ObjString* name);
+JitStatus jit_import_std(ObjString* name);
+JitStatus jit_import_module(ObjString* name);
+JitStatus jit_error(const char* message);
+JitStatus jit_undefined_global(int slot);
+// The slow path of OP_FOR_PREP and OP_FOR_LOOP at instruction, leaving
+// whether the loop goes on in holds.
+JitStatus jit_for_loop(const uint8_t* instruction, bool* holds);
+
+#endif
@@ -6,12 +6,6 @@
 
 #include "lexer.h"
 
-typedef struct {
-  const char *start;
-  const char *current;
-  int line;
-} Lexer;
-
 Lexer lexer;
 
 void init_lexer(const char *source) {
@@ -20,6 +14,14 @@ void init_lexer(const char *source) {
   lexer.line = 1;
 }
 
+Lexer save_lexer() {
+  return lexer;
+}
+
+void restore_lexer(Lexer state) {
+  lexer = state;
+}
+
 static bool isAlpha(char c) {
   return (c >= 'a' && c <= 'z') ||
          (c >= 'A' && c <= 'Z') ||
@@ -182,8 +184,15 @@ static TokenType identifierType() {
   return TOKEN_IDENTIFIER;
 }
 
+// A colon inside a name joins a module to one of its members, as in
+// gc:collect. Members never start with a digit, so a colon not followed by
+// a letter ends the name instead, and a map literal can use a variable as
+// a key: {key: value} or {key:1}.
 static Token identifier() {
-  while (isAlpha(peek()) || isDigit(peek())) read_char();
+  while (isAlpha(peek()) || isDigit(peek())) {
+    if (peek() == ':' && !isAlpha(next_peek())) break;
+    read_char();
+  }
   return create_token(identifierType());
 }
 
@@ -215,6 +224,7 @@ Token lex_token() {
   char c = read_char();
 
   if (isDigit(c)) return number();
+  if (c == ':') return create_token(TOKEN_COLON);
   if (isAlpha(c)) return identifier();
 
   switch (c) {
@@ -20,7 +20,7 @@ typedef enum {
   TOKEN_MINUS, TOKEN_PLUS, TOKEN_SLASH, TOKEN_STAR,
   TOKEN_MINUSD, TOKEN_PLUSD, TOKEN_SLASHD, TOKEN_STARD,
   TOKEN_PLUS_COMMA,
-  TOKEN_SEMICOLON, TOKEN_PERCENT,
+  TOKEN_SEMICOLON, TOKEN_COLON, TOKEN_PERCENT,
   TOKEN_POWER,
 
   // One or two character tokens.
@@ -52,7 +52,17 @@ typedef struct {
   int line;
 } Token;
 
+typedef struct {
+  const char *start;
+  const char *current;
+  int line;
+} Lexer;
+
 void init_lexer(const char *source);
 Token lex_token();
 
+// For looking ahead: lex on from a saved state, then put it back.
+Lexer save_lexer();
+void restore_lexer(Lexer state);
+
 #endif
@@ -1,12 +1,19 @@
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "HVM.h"
 #include "compiler.h"
 #include "memory.h"
+#include "jit.h"
 
 #ifdef DEBUG_LOG_GC
 
-#include <stdio.h>
 #include "debug.h"
 
 #endif
@@ -15,19 +22,163 @@ int GROW_CAPACITY(int capacity) {
   return (capacity < 8) ? 8 : capacity * 2;
 }
 
-#define GC_HEAP_GROW_FACTOR 2
+// Bytes allocated between minor collections.
+#define GC_NURSERY_SIZE (256 * 1024)
+
+// With hvm.gc_threads above one, each thread of a major collection marks
+// from its own gray stack, stealing from the others when it runs out, and
+// then takes the arena's pages a few at a time to sweep. A thread only
+// touches the pages it took, and what it frees that the allocator and the
+// statistics keep count of goes into its GcWorker. Both are settled once
+// every thread is done.
+typedef struct {
+  // Gray objects only this thread sees, so no locking.
+  Obj** local;
+  int local_count;
+  int local_capacity;
+
+  // Gray objects it has put up for others to steal from the bottom. shared
+  // is top - bottom, for looking without the lock.
+  pthread_mutex_t lock;
+  Obj** stack;
+  int bottom;
+  int top;
+  int capacity;
+  int shared;
+
+  // Bytes objects owned, and the objects' cells by bytes and by type.
+  size_t freed;
+  size_t freed_cells;
+  size_t freed_objects[OBJ_TYPE_COUNT];
+} GcWorker;
+
+// Most objects moved in one steal.
+#define GC_STEAL_MAX 256
+
+// A thread with more gray objects than this puts half of them up for
+// stealing once its last lot has been taken.
+#define GC_SHARE_MIN 32
+
+// Intern table entries a thread clears at a time.
+#define GC_TABLE_CHUNK 4096
+
+// Pages a thread sweeps at a time.
+#define GC_SWEEP_PAGES 16
+
+static GcWorker gc_workers[GC_MAX_THREADS];
+static int idle_workers;
+static int next_table_chunk;
+static int next_sweep_page;
+static pthread_barrier_t sweep_barrier;
+
+// The worker a thread is while a parallel collection runs.
+static __thread GcWorker* gc_worker = NULL;
+
+// Bytes allocated between two slices of a major collection.
+#define GC_STEP_SIZE (64 * 1024)
+
+// Objects marked or swept between two looks at the clock.
+#define GC_STEP_CHECK 64
+
+// Lists longer than this are marked this many items at a time, each slice
+// counting as GC_STEP_CHECK objects.
+#define GC_LIST_SLICE 1024
+
+static void start_major();
+static bool major_step(double deadline);
+static void finish_major();
+static void collect_in_parallel();
+
+static double gc_clock() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
 
-void* reallocate(void* pointer, size_t old_size, size_t new_size) {
-  hvm.bytes_alloc += new_size - old_size;
+static void record_pause(double seconds) {
+  int bucket = 0;
+  for (uint64_t us = (uint64_t)(seconds * 1e6); us > 0 && bucket < GC_PAUSE_BUCKETS - 1; us >>= 1) {
+    bucket++;
+  }
+  hvm.gc_pauses[bucket]++;
+  hvm.gc_pause_count++;
+  hvm.gc_pause_total += seconds;
+  if (seconds > hvm.gc_pause_max) hvm.gc_pause_max = seconds;
+}
+
+// Called before every allocation of size bytes. Each call that does any
+// work is one pause: a minor collection, a slice of the major collection,
+// or both.
+static void collect_if_needed(size_t size) {
+  hvm.young_bytes += size;
+  hvm.step_bytes += size;
 
-  if (new_size > old_size) {
 #ifdef DEBUG_STRESS_GC
-    take_out_garbage();
+  if (hvm.gc_threads > 1) {
+    collect_in_parallel();
+    return;
+  }
+  collect_young();
+  if (hvm.gc_phase == GC_IDLE) start_major();
+  major_step(0);
+  return;
 #endif
+
+  bool minor = hvm.young_bytes > GC_NURSERY_SIZE;
+  if (hvm.gc_threads > 1) {
+    bool major = hvm.bytes_alloc > hvm.next_gc_limit;
+    if (!minor && !major) return;
+
+    double start = gc_clock();
+    if (major) {
+      collect_in_parallel();
+    } else {
+      collect_young();
+    }
+    record_pause(gc_clock() - start);
+    return;
   }
 
-  if (hvm.bytes_alloc > hvm.next_gc_limit) {
-    take_out_garbage();
+  bool step = hvm.step_bytes > GC_STEP_SIZE &&
+              (hvm.gc_phase != GC_IDLE || hvm.bytes_alloc > hvm.next_gc_limit);
+  if (!minor && !step) return;
+
+  double start = gc_clock();
+  if (step) {
+    hvm.step_bytes = 0;
+    if (hvm.gc_phase == GC_IDLE) {
+      start_major();
+    } else {
+      if (minor) collect_young();
+      // Allocation is outrunning the collector.
+      if (hvm.bytes_alloc > hvm.next_gc_limit * hvm.gc_grow_factor) {
+        finish_major();
+      } else {
+        major_step(start + hvm.gc_max_pause);
+      }
+    }
+  } else {
+    collect_young();
+  }
+  record_pause(gc_clock() - start);
+}
+
+void* reallocate(void* pointer, size_t old_size, size_t new_size) {
+  // A parallel sweep only ever frees.
+  if (gc_worker != NULL) {
+    gc_worker->freed += old_size;
+    free(pointer);
+    return NULL;
+  }
+
+  hvm.bytes_alloc += new_size - old_size;
+
+  if (new_size > old_size) {
+    hvm.bytes_allocated += new_size - old_size;
+    if (hvm.bytes_alloc > hvm.peak_heap) hvm.peak_heap = hvm.bytes_alloc;
+    collect_if_needed(new_size - old_size);
+  } else {
+    hvm.bytes_freed += old_size - new_size;
   }
 
   if (new_size == 0) {
@@ -40,18 +191,30 @@ void* reallocate(void* pointer, size_t old_size, size_t new_size) {
   return result;
 }
 
-void mark_object_memory(Obj *object) {
-  if (object == NULL) return;
-  if (object->is_marked) return;
-
-#ifdef DEBUG_LOG_GC
-  printf("%p mark ", (void*)object);
-  print_value(OBJ_VAL(object));
-  printf("\n");
-#endif
+void* allocate_young(size_t size) {
+  collect_if_needed(size);
+  void* result = arena_allocate(&hvm.arena, size);
+  hvm.bytes_allocated += ARENA_PAGE_OF(result)->cell_size;
+  if (hvm.bytes_alloc > hvm.peak_heap) hvm.peak_heap = hvm.bytes_alloc;
+  return result;
+}
 
-  object->is_marked = true;
+// Gives an object's cell back to its page. A sweeping thread leaves the
+// page to be settled once every thread is done.
+static void release_object(Obj* object) {
+  size_t size = ARENA_PAGE_OF(object)->cell_size;
+  if (gc_worker != NULL) {
+    gc_worker->freed_cells += size;
+    gc_worker->freed_objects[object->type]++;
+    arena_release_cell(object);
+  } else {
+    hvm.bytes_freed += size;
+    hvm.object_counts[object->type]--;
+    arena_free(&hvm.arena, object);
+  }
+}
 
+static void push_gray(Obj* object) {
   if (hvm.gray_capacity < hvm.gray_cnt + 1) {
     hvm.gray_capacity = GROW_CAPACITY(hvm.gray_capacity);
     hvm.gray_stack = (Obj**)realloc(hvm.gray_stack, sizeof(Obj*) * hvm.gray_capacity);
@@ -63,10 +226,127 @@ void mark_object_memory(Obj *object) {
   }
 }
 
+static void push_local_gray(GcWorker* worker, Obj* object) {
+  if (worker->local_capacity < worker->local_count + 1) {
+    worker->local_capacity = GROW_CAPACITY(worker->local_capacity);
+    worker->local = (Obj**)realloc(worker->local, sizeof(Obj*) * worker->local_capacity);
+    if (worker->local == NULL) exit(1);
+  }
+  worker->local[worker->local_count++] = object;
+}
+
+static void push_shared_grays(GcWorker* worker, Obj** objects, int count) {
+  pthread_mutex_lock(&worker->lock);
+  if (worker->top + count > worker->capacity) {
+    if (worker->bottom > 0) {
+      memmove(worker->stack, worker->stack + worker->bottom,
+              sizeof(Obj*) * (worker->top - worker->bottom));
+      worker->top -= worker->bottom;
+      worker->bottom = 0;
+    }
+    while (worker->top + count > worker->capacity) {
+      worker->capacity = GROW_CAPACITY(worker->capacity);
+    }
+    worker->stack = (Obj**)realloc(worker->stack, sizeof(Obj*) * worker->capacity);
+    if (worker->stack == NULL) exit(1);
+  }
+  memcpy(worker->stack + worker->top, objects, sizeof(Obj*) * count);
+  worker->top += count;
+  __atomic_store_n(&worker->shared, worker->top - worker->bottom, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&worker->lock);
+}
+
+// Moves up to GC_STEAL_MAX of worker's shared gray objects to thief's local
+// stack, from the top when the thief is the owner and the bottom otherwise.
+static int take_shared_grays(GcWorker* worker, GcWorker* thief) {
+  if (__atomic_load_n(&worker->shared, __ATOMIC_RELAXED) == 0) return 0;
+
+  pthread_mutex_lock(&worker->lock);
+  int count = worker->top - worker->bottom;
+  if (worker != thief) count = (count + 1) / 2;
+  if (count > GC_STEAL_MAX) count = GC_STEAL_MAX;
+  for (int i = 0; i < count; i++) {
+    push_local_gray(thief, worker == thief ? worker->stack[--worker->top]
+                                           : worker->stack[worker->bottom++]);
+  }
+  if (worker->top == worker->bottom) worker->top = worker->bottom = 0;
+  __atomic_store_n(&worker->shared, worker->top - worker->bottom, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&worker->lock);
+  return count;
+}
+
+static void share_grays(GcWorker* worker) {
+  if (worker->local_count <= GC_SHARE_MIN) return;
+  if (__atomic_load_n(&worker->shared, __ATOMIC_RELAXED) > 0) return;
+  int half = worker->local_count / 2;
+  worker->local_count -= half;
+  push_shared_grays(worker, worker->local + worker->local_count, half);
+}
+
+void mark_object_memory(Obj *object) {
+  if (object == NULL) return;
+  // A minor collection takes every old object to be alive, and a major one
+  // leaves the young objects to the minor collections.
+  if (object->is_young != hvm.collecting_young) return;
+  if (gc_worker != NULL) {
+    if (!arena_set_mark_atomic(object)) {
+      push_local_gray(gc_worker, object);
+    }
+    return;
+  }
+  if (arena_is_marked(object)) return;
+
+#ifdef DEBUG_LOG_GC
+  printf("%p mark ", (void*)object);
+  print_value(OBJ_VAL(object));
+  printf("\n");
+#endif
+
+  arena_set_mark(object);
+  push_gray(object);
+}
+
 void mark_memory_slot(Value value) {
   if (IS_OBJ(value)) mark_object_memory(AS_OBJ(value));
 }
 
+void remember_object(Obj* object) {
+  if (object->is_young || object->is_remembered) return;
+  object->is_remembered = true;
+
+  if (hvm.remembered_capacity < hvm.remembered_cnt + 1) {
+    hvm.remembered_capacity = GROW_CAPACITY(hvm.remembered_capacity);
+    hvm.remembered = (Obj**)realloc(hvm.remembered, sizeof(Obj*) * hvm.remembered_capacity);
+    if (hvm.remembered == NULL) exit(1);
+  }
+  hvm.remembered[hvm.remembered_cnt++] = object;
+}
+
+// For objects written to without the write barrier: the next minor
+// collection scans the object, and if the major collection has already
+// visited it, it gets visited again.
+void rescan_object(Obj* object) {
+  remember_object(object);
+  if (hvm.gc_phase == GC_MARK && !hvm.collecting_young && arena_is_marked(object)) {
+    push_gray(object);
+  }
+}
+
+// The sweep under way has yet to reach the object's page, so marking it
+// keeps it alive through the sweep. Once swept, a page's marks are clear.
+void keep_if_unswept(Obj* object) {
+  if (hvm.gc_phase == GC_SWEEP && ARENA_PAGE_OF(object)->index >= hvm.sweep_page) {
+    arena_set_mark(object);
+  }
+}
+
+static void forget_remembered() {
+  for (int i = 0; i < hvm.remembered_cnt; i++) {
+    hvm.remembered[i]->is_remembered = false;
+  }
+  hvm.remembered_cnt = 0;
+}
+
 static void mark_array_memory(ValueArray* array) {
   for (int i = 0; i < array->size; i++) {
     mark_memory_slot(array->values[i]);
@@ -83,11 +363,23 @@ static void visit_object(Obj* object) {
   switch (object->type) {
     case OBJ_LIST: {
       ObjList* list = (ObjList*)object;
-      for (int i = 0; i < list->count; i++) {
+      if (hvm.gc_phase == GC_MARK && !hvm.collecting_young && list->count > GC_LIST_SLICE) {
+        hvm.scanning = list;
+        hvm.scanning_index = 0;
+        break;
+      }
+      int start = hvm.collecting_young && object->is_remembered ? list->young_from : 0;
+      for (int i = start; i < list->count; i++) {
         mark_memory_slot(list->items[i]);
       }
       break;
     }
+    case OBJ_MAP:
+      mark_value_table(&((ObjMap*)object)->table);
+      break;
+    case OBJ_SET:
+      mark_value_table(&((ObjSet*)object)->table);
+      break;
     case OBJ_BOUND_METHOD: {
       ObjBoundMethod* bound = (ObjBoundMethod*)object;
       mark_memory_slot(bound->receiver);
@@ -97,7 +389,9 @@ static void visit_object(Obj* object) {
     case OBJ_INSTANCE: {
       ObjInstance* instance = (ObjInstance*)object;
       mark_object_memory((Obj*)instance->_class);
-      mark_table(&instance->fields);
+      for (int i = 0; i < instance->shape->slot_count; i++) {
+        mark_memory_slot(instance->fields[i]);
+      }
       break;
     }
     case OBJ_CLASS: {
@@ -118,6 +412,15 @@ static void visit_object(Obj* object) {
       ObjFunction* function = (ObjFunction*)object;
       mark_object_memory((Obj*)function->name);
       mark_array_memory(&function->chunk.constants);
+      // Cached classes and methods are kept alive so a freed class can never
+      // be mistaken for a new one allocated at the same address.
+      for (int i = 0; i < function->chunk.cache_count; i++) {
+        InlineCache* cache = &function->chunk.caches[i];
+        for (int j = 0; j < cache->count; j++) {
+          mark_object_memory((Obj*)cache->entries[j]._class);
+          mark_object_memory((Obj*)cache->entries[j].method);
+        }
+      }
       break;
     }
     case OBJ_UPVALUE:
@@ -137,73 +440,88 @@ static void free_object(Obj* object) {
   switch (object->type) {
     case OBJ_LIST: {
       ObjList* list = (ObjList*)object;
-      FREE_ARRAY(Value*, list->items, list->count);
-      FREE(ObjList, object);
+      FREE_ARRAY(Value, list->items, list->capacity);
       break;
     }
-    case OBJ_BOUND_METHOD:
-      FREE(ObjBoundMethod, object);
+    case OBJ_MAP:
+      free_value_table(&((ObjMap*)object)->table);
+      break;
+    case OBJ_SET:
+      free_value_table(&((ObjSet*)object)->table);
       break;
     case OBJ_INSTANCE: {
       ObjInstance* instance = (ObjInstance*)object;
-      free_table(&instance->fields);
-      FREE(ObjInstance, object);
+      if (instance->fields != instance->inline_fields) {
+        FREE_ARRAY(Value, instance->fields, instance->field_capacity);
+      }
       break;
     }
     case OBJ_CLASS: {
       ObjClass* _class = (ObjClass*)object;
       free_table(&_class->methods);
-      FREE(ObjClass, object);
       break;
     }
     case OBJ_CLOSURE: {
       ObjClosure* closure = (ObjClosure*)object;
       FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-      FREE(ObjClosure, object);
       break;
     }
     case OBJ_STRING: {
       ObjString* string = (ObjString*)object;
       FREE_ARRAY(char, string->chars, string->size + 1);
-      FREE(ObjString, object);
       break;
     }
     case OBJ_FUNCTION: {
       ObjFunction *function = (ObjFunction*)object;
       free_chunk(&function->chunk);
-      FREE(ObjFunction, object);
+#ifdef HVM_JIT
+      if (function->jit != NULL) free_jit_code(function->jit);
+#endif
       break;
     }
+    case OBJ_BOUND_METHOD:
     case OBJ_NATIVE:
-      FREE(ObjNative, object);
-      break;
     case OBJ_UPVALUE:
-      FREE(ObjUpvalue, object);
       break;
   }
+  release_object(object);
 }
 
+// Frees an object a collection did not reach, dropping strings from the
+// intern table on the way.
+static void free_unreached(Obj* object) {
+  if (object->type == OBJ_STRING) {
+    table_delete(&hvm.strings, (ObjString*)object);
+  }
+  free_object(object);
+}
 
-static void goodbye_old_friends() {
-  Obj* previous = NULL;
-  Obj* object = hvm.objects;
+// Moves the young objects that were reached to the old generation, where
+// they stay, and frees the rest. Once a minor collection is done there are
+// no young objects, so nothing needs remembering any more. While a major
+// collection is marking, the promoted objects stay marked and gray so it
+// visits them too, and while it sweeps they must survive the sweep.
+static void goodbye_young_friends() {
+  bool marking = hvm.gc_phase == GC_MARK;
+  Obj* object = hvm.young_objects;
   while (object != NULL) {
-    if (object->is_marked) {
-      previous = object;
-      object = object->next;
-    } else {
-      Obj* unreached = object;
-      object = object->next;
-      if (previous != NULL) {
-        object->is_marked = false;
-        previous->next = object;
+    Obj* next = object->next;
+    if (arena_is_marked(object)) {
+      object->is_young = false;
+      if (marking) {
+        push_gray(object);
       } else {
-        hvm.objects = object;
+        arena_clear_mark(object);
+        keep_if_unswept(object);
       }
-
-      free_object(unreached);
+    } else {
+      free_unreached(object);
     }
+    object = next;
   }
+  hvm.young_objects = NULL;
+  hvm.young_bytes = 0;
+  table_clear_deleted(&hvm.strings);
 }
 
 static void mark_roots() {
@@ -220,49 +538,408 @@ static void mark_roots() {
   }
 
   mark_table(&hvm.globals);
+  mark_array_memory(&hvm.global_values);
+  mark_array_memory(&hvm.global_names);
 
   mark_compiler_roots();
 
+  if (hvm.root_shape != NULL) mark_shape_tree(hvm.root_shape);
+
   mark_object_memory((Obj*)hvm.initString);
 }
 
-static void visit_nodes() {
-  while (hvm.gray_cnt > 0) {
+// Visits one gray object, or the next slice of a long list, and returns
+// how much work that was. The list is finished before anything else is
+// visited, so there is only ever one.
+static int visit_next() {
+  if (hvm.scanning == NULL) {
+    visit_object(hvm.gray_stack[--hvm.gray_cnt]);
+    return 1;
+  }
+
+  ObjList* list = hvm.scanning;
+  int end = hvm.scanning_index + GC_LIST_SLICE;
+  if (end >= list->count) {
+    end = list->count;
+    hvm.scanning = NULL;
+  }
+  for (int i = hvm.scanning_index; i < end; i++) {
+    mark_memory_slot(list->items[i]);
+  }
+  hvm.scanning_index = end;
+  return GC_STEP_CHECK;
+}
+
+// Visits gray objects down to base. Below base are the ones a major
+// collection has left for later.
+static void visit_nodes(int base) {
+  while (hvm.gray_cnt > base) {
     Obj* object = hvm.gray_stack[--hvm.gray_cnt];
     visit_object(object);
   }
 }
 
-void take_out_garbage() {
+// A minor collection: marks the young objects reachable from the roots and
+// from remembered old objects, then promotes them.
+void collect_young() {
 #ifdef DEBUG_LOG_GC
-  printf("-- gc begin\n");
+  printf("-- minor gc begin\n");
   size_t before = hvm.bytes_alloc;
 #endif
 
+  hvm.gc_minor_count++;
+  int base = hvm.gray_cnt;
+  hvm.collecting_young = true;
   mark_roots();
-  visit_nodes();
-  goodbye_white_table_friends(&hvm.strings);
-  goodbye_old_friends();
+  for (int i = 0; i < hvm.remembered_cnt; i++) {
+    visit_object(hvm.remembered[i]);
+  }
+  visit_nodes(base);
+  forget_remembered();
+  goodbye_young_friends();
+  hvm.collecting_young = false;
 
-  hvm.next_gc_limit = hvm.bytes_alloc * GC_HEAP_GROW_FACTOR;
+#ifdef DEBUG_LOG_GC
+  printf("-- minor gc end\n");
+  printf("   collected %zu bytes (from %zu to %zu)\n",
+         before - hvm.bytes_alloc, before, hvm.bytes_alloc);
+#endif
+}
+
+// The major collection is incremental: it marks the old generation and
+// then sweeps it in slices between which the program runs. Only old
+// objects are marked; the young ones are left to the minor collections,
+// which keep running and hand their survivors over already gray. The write
+// barrier keeps whatever the program stores in between from being missed.
+static void start_major() {
+#ifdef DEBUG_LOG_GC
+  printf("-- gc begin\n");
+#endif
+
+  collect_young();
+  hvm.gc_phase = GC_MARK;
+  hvm.step_bytes = 0;
+  mark_roots();
+}
+
+// Marking is done once the roots have been scanned again with nothing left
+// gray.
+static void finish_marking() {
+  collect_young();
+  mark_roots();
+  while (hvm.scanning != NULL || hvm.gray_cnt > 0) {
+    visit_next();
+  }
+
+  hvm.gc_phase = GC_SWEEP;
+  hvm.sweep_page = 0;
+}
+
+// Frees the old objects in a page that were allocated and not marked, and
+// clears its marks. Young objects are the minor collections' business.
+// Returns how many it freed.
+static int sweep_arena_page(ArenaPage* page) {
+  int freed = 0;
+  for (int i = 0; i < ARENA_BITMAP_WORDS; i++) {
+    uint64_t dead = page->allocated[i] & ~page->marks[i];
+    page->marks[i] = 0;
+    while (dead != 0) {
+      int granule = i * 64 + __builtin_ctzll(dead);
+      dead &= dead - 1;
+      Obj* object = (Obj*)((uint8_t*)page + (size_t)granule * ARENA_GRANULE);
+      if (object->is_young) continue;
+      // A parallel sweep has taken unreached strings out of the intern
+      // table already.
+      if (gc_worker != NULL) {
+        free_object(object);
+      } else {
+        free_unreached(object);
+      }
+      freed++;
+    }
+  }
+  return freed;
+}
+
+// Sets where the next major collection starts, from what is in use now.
+static void update_gc_limit() {
+  // A limit past what size_t holds means no major collection at all.
+  double grown = hvm.bytes_alloc * hvm.gc_grow_factor;
+  size_t limit = grown >= (double)SIZE_MAX ? SIZE_MAX : (size_t)grown;
+  hvm.next_gc_limit = limit > hvm.gc_heap_limit ? limit : hvm.gc_heap_limit;
+}
+
+void set_gc_heap_limit(size_t bytes) {
+  hvm.gc_heap_limit = bytes;
+  update_gc_limit();
+}
+
+// A factor below one would start collections before the heap has grown.
+// One that is not a finite number is ignored.
+void set_gc_grow_factor(double factor) {
+  if (!isfinite(factor)) return;
+  hvm.gc_grow_factor = factor < 1 ? 1 : factor;
+  update_gc_limit();
+}
+
+static void finish_sweeping() {
+  hvm.gc_phase = GC_IDLE;
+  table_clear_deleted(&hvm.strings);
+  hvm.gc_major_count++;
+  update_gc_limit();
 
 #ifdef DEBUG_LOG_GC
   printf("-- gc end\n");
-  printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
-         before - hvm.bytes_alloc, before, hvm.bytes_alloc,
-         hvm.next_gc_limit);
+  printf("   %zu bytes in use, next at %zu\n", hvm.bytes_alloc, hvm.next_gc_limit);
 #endif
 }
 
+// Marks or sweeps until the deadline, returning whether the major
+// collection has finished. A deadline of 0 does the least work possible.
+static bool major_step(double deadline) {
+  int work = 0;
+  while (hvm.gc_phase == GC_MARK) {
+    if (hvm.scanning == NULL && hvm.gray_cnt == 0) {
+      finish_marking();
+      break;
+    }
+    work += visit_next();
+    if (work >= GC_STEP_CHECK) {
+      if (gc_clock() >= deadline) return false;
+      work = 0;
+    }
+  }
+
+  // A page is swept in one go. Each counts as one object besides the ones
+  // it frees.
+  while (hvm.sweep_page < hvm.arena.page_count) {
+    ArenaPage* page = hvm.arena.pages[hvm.sweep_page];
+    if (page->in_use) work += sweep_arena_page(page);
+    hvm.sweep_page++;
+    if (++work >= GC_STEP_CHECK) {
+      if (gc_clock() >= deadline) return false;
+      work = 0;
+    }
+  }
+
+  finish_sweeping();
+  return true;
+}
+
+static void finish_major() {
+  if (hvm.gc_phase == GC_IDLE) start_major();
+  if (hvm.gc_phase == GC_MARK) finish_marking();
+  while (!major_step(INFINITY)) {}
+}
+
+// Takes back this thread's own shared objects, or else steals some.
+static bool find_grays(GcWorker* self) {
+  if (take_shared_grays(self, self) > 0) return true;
+
+  int threads = hvm.gc_threads;
+  int first = (int)(self - gc_workers);
+  for (int i = 1; i < threads; i++) {
+    if (take_shared_grays(&gc_workers[(first + i) % threads], self) > 0) return true;
+  }
+  return false;
+}
+
+static bool any_grays() {
+  for (int i = 0; i < hvm.gc_threads; i++) {
+    if (__atomic_load_n(&gc_workers[i].shared, __ATOMIC_RELAXED) > 0) return true;
+  }
+  return false;
+}
+
+// Marking is over once every thread has run out of gray objects at the same
+// time: an idle thread has none, and only a busy one can make more.
+static void mark_in_parallel(GcWorker* self) {
+  while (true) {
+    while (self->local_count > 0) {
+      visit_object(self->local[--self->local_count]);
+      share_grays(self);
+    }
+    if (find_grays(self)) continue;
+
+    __atomic_add_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+    while (!any_grays()) {
+      if (__atomic_load_n(&idle_workers, __ATOMIC_SEQ_CST) == hvm.gc_threads) return;
+      sched_yield();
+    }
+    __atomic_sub_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+  }
+}
+
+// Unreached strings have to leave the intern table before any thread frees
+// one, so every thread clears its share of the table first.
+static void sweep_in_parallel() {
+  Table* strings = &hvm.strings;
+  int chunk;
+  while ((chunk = __atomic_fetch_add(&next_table_chunk, 1, __ATOMIC_RELAXED)) * GC_TABLE_CHUNK <
+         strings->capacity) {
+    goodbye_white_table_friends(strings, chunk * GC_TABLE_CHUNK, (chunk + 1) * GC_TABLE_CHUNK);
+  }
+  pthread_barrier_wait(&sweep_barrier);
+
+  int page_count = hvm.arena.page_count;
+  int first;
+  while ((first = __atomic_fetch_add(&next_sweep_page, GC_SWEEP_PAGES, __ATOMIC_RELAXED)) <
+         page_count) {
+    int end = first + GC_SWEEP_PAGES < page_count ? first + GC_SWEEP_PAGES : page_count;
+    for (int i = first; i < end; i++) {
+      ArenaPage* page = hvm.arena.pages[i];
+      if (page->in_use) sweep_arena_page(page);
+    }
+  }
+}
+
+static void* gc_thread(void* argument) {
+  GcWorker* self = (GcWorker*)argument;
+  gc_worker = self;
+  mark_in_parallel(self);
+  sweep_in_parallel();
+  gc_worker = NULL;
+  return NULL;
+}
+
+// A major collection that stops the program and uses hvm.gc_threads
+// threads, the calling one included.
+static void collect_in_parallel() {
+#ifdef DEBUG_LOG_GC
+  printf("-- parallel gc begin\n");
+#endif
+
+  collect_young();
+
+  int threads = hvm.gc_threads;
+  for (int i = 0; i < threads; i++) {
+    GcWorker* worker = &gc_workers[i];
+    pthread_mutex_init(&worker->lock, NULL);
+    worker->local_count = 0;
+    worker->bottom = 0;
+    worker->top = 0;
+    worker->shared = 0;
+    worker->freed = 0;
+    worker->freed_cells = 0;
+    for (int j = 0; j < OBJ_TYPE_COUNT; j++) worker->freed_objects[j] = 0;
+  }
+  idle_workers = 0;
+  next_table_chunk = 0;
+  next_sweep_page = 0;
+  pthread_barrier_init(&sweep_barrier, NULL, threads);
+
+  // The roots all start out on this thread's stack for the others to steal.
+  gc_worker = &gc_workers[0];
+  mark_roots();
+
+  pthread_t ids[GC_MAX_THREADS];
+  for (int i = 1; i < threads; i++) {
+    if (pthread_create(&ids[i], NULL, gc_thread, &gc_workers[i]) != 0) exit(1);
+  }
+  gc_thread(&gc_workers[0]);
+  for (int i = 1; i < threads; i++) {
+    pthread_join(ids[i], NULL);
+  }
+
+  pthread_barrier_destroy(&sweep_barrier);
+  table_clear_deleted(&hvm.strings);
+  for (int i = 0; i < threads; i++) {
+    GcWorker* worker = &gc_workers[i];
+    pthread_mutex_destroy(&worker->lock);
+    hvm.bytes_alloc -= worker->freed;
+    hvm.bytes_freed += worker->freed + worker->freed_cells;
+    for (int j = 0; j < OBJ_TYPE_COUNT; j++) {
+      hvm.object_counts[j] -= worker->freed_objects[j];
+    }
+  }
+  for (int i = 0; i < hvm.arena.page_count; i++) {
+    arena_settle_page(&hvm.arena, hvm.arena.pages[i]);
+  }
+
+  hvm.gc_major_count++;
+  update_gc_limit();
+
+#ifdef DEBUG_LOG_GC
+  printf("-- parallel gc end\n");
+  printf("   %zu bytes in use, next at %zu\n", hvm.bytes_alloc, hvm.next_gc_limit);
+#endif
+}
+
+// A full collection of both generations. One already under way may have
+// marked objects that have died since, so it is finished first and then
+// followed by a whole one.
+void take_out_garbage() {
+  double start = gc_clock();
+  if (hvm.gc_threads > 1) {
+    collect_in_parallel();
+  } else {
+    if (hvm.gc_phase != GC_IDLE) finish_major();
+    finish_major();
+  }
+  record_pause(gc_clock() - start);
+}
+
+void print_gc_stats(FILE* out) {
+  fprintf(out, "== gc: %zu pauses, %.2f ms in total, longest %.3f ms ==\n",
+          hvm.gc_pause_count, hvm.gc_pause_total * 1e3, hvm.gc_pause_max * 1e3);
+  fprintf(out, "== gc: %zu minor and %zu major collections, %zu KB allocated, "
+          "%zu KB freed, peak heap %zu KB ==\n",
+          hvm.gc_minor_count, hvm.gc_major_count, hvm.bytes_allocated / 1024,
+          hvm.bytes_freed / 1024, hvm.peak_heap / 1024);
+  TableStats strings;
+  table_stats(&hvm.strings, &strings);
+  fprintf(out, "== strings: %d interned in %d slots, %d deleted, %.2f groups per probe, "
+          "longest %d ==\n",
+          strings.size, strings.capacity, strings.tombstones, strings.average_probe,
+          strings.longest_probe);
+  if (hvm.gc_pause_count == 0) return;
+
+  size_t seen = 0;
+  bool p50 = false, p99 = false;
+  for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+    size_t count = hvm.gc_pauses[i];
+    if (count == 0) continue;
+    seen += count;
+    long low = i == 0 ? 0 : 1L << (i - 1);
+    fprintf(out, "%8ld us - %-8ld %8zu", low, 1L << i, count);
+    if (!p50 && seen * 2 >= hvm.gc_pause_count) {
+      fprintf(out, "  p50");
+      p50 = true;
+    }
+    if (!p99 && seen * 100 >= hvm.gc_pause_count * 99) {
+      fprintf(out, "  p99");
+      p99 = true;
+    }
+    fprintf(out, "\n");
+  }
+}
+
 void free_objects() {
-  Obj* object = hvm.objects;
-  while (object != NULL) {
-    Obj* next = object->next;
-    free_object(object);
-    object = next;
+  for (int i = 0; i < hvm.arena.page_count; i++) {
+    ArenaPage* page = hvm.arena.pages[i];
+    if (!page->in_use) continue;
+    for (int j = 0; j < ARENA_BITMAP_WORDS; j++) {
+      uint64_t cells = page->allocated[j];
+      while (cells != 0) {
+        int granule = j * 64 + __builtin_ctzll(cells);
+        cells &= cells - 1;
+        free_object((Obj*)((uint8_t*)page + (size_t)granule * ARENA_GRANULE));
+      }
+    }
   }
+  hvm.young_objects = NULL;
+  free_arena(&hvm.arena);
 
   free(hvm.gray_stack);
+  free(hvm.remembered);
+  for (int i = 0; i < GC_MAX_THREADS; i++) {
+    free(gc_workers[i].local);
+    free(gc_workers[i].stack);
+    gc_workers[i].local = NULL;
+    gc_workers[i].stack = NULL;
+    gc_workers[i].local_capacity = 0;
+    gc_workers[i].capacity = 0;
+  }
 }
 
 
@@ -1,10 +1,22 @@
 #ifndef memory_h
 #define memory_h
 
+#include <stdio.h>
 #include <stdlib.h>
 
+#include "HVM.h"
 #include "object.h"
 
+// The default for hvm.gc_max_pause, in seconds.
+#define GC_MAX_PAUSE 0.001
+
+// The defaults for hvm.gc_heap_limit and hvm.gc_grow_factor.
+#define GC_HEAP_LIMIT (1024 * 1024)
+#define GC_GROW_FACTOR 2.0
+
+// The most threads hvm.gc_threads can ask for.
+#define GC_MAX_THREADS 64
+
 #define ALLOCATE(type, count) \
     (type*)reallocate(NULL, 0, sizeof(type) * (count))
 
@@ -20,9 +32,36 @@ int GROW_CAPACITY(int capacity);
 
 void* reallocate(void* pointer, size_t old_size, size_t new_size);
 
+void* allocate_young(size_t size);
+
 void mark_object_memory(Obj *object);
 void mark_memory_slot(Value value);
+void remember_object(Obj* object);
+void rescan_object(Obj* object);
+void keep_if_unswept(Obj* object);
+void collect_young();
 void take_out_garbage();
+void set_gc_heap_limit(size_t bytes);
+void set_gc_grow_factor(double factor);
+void print_gc_stats(FILE* out);
+
+// Every store of a value into an object goes through the write barrier.
+// Minor collections only trace young objects, so old objects that get a
+// young value are remembered and scanned by the next minor collection.
+// While a major collection is marking, an old value that has not been
+// marked yet is marked now, so no object it has already visited can end up
+// holding the only reference to one it has not. Globals, the stack and the
+// other roots need no barrier: both collections rescan them before they
+// finish.
+static inline void write_barrier(Obj* owner, Value value) {
+  if (!IS_OBJ(value)) return;
+  Obj* object = AS_OBJ(value);
+  if (object->is_young) {
+    if (!owner->is_young) remember_object(owner);
+  } else if (hvm.gc_phase == GC_MARK && !arena_is_marked(object)) {
+    mark_object_memory(object);
+  }
+}
 
 void free_objects();
 
@@ -10,12 +10,14 @@
 #define ALLOCATE_OBJ(type, objectType) (type*)allocate_object(sizeof(type), objectType)
 
 static Obj* allocate_object(size_t size, ObjType type) {
-  Obj* object = (Obj*)reallocate(NULL, 0, size);
+  Obj* object = (Obj*)allocate_young(size);
   object->type = type;
-  object->is_marked = false;
+  object->is_young = true;
+  object->is_remembered = false;
+  hvm.object_counts[type]++;
 
-  object->next = hvm.objects;
-  hvm.objects = object;
+  object->next = hvm.young_objects;
+  hvm.young_objects = object;
 
 #ifdef DEBUG_LOG_GC
   printf("%p allocate %zu for %d\n", (void*)object, size, type);
@@ -34,10 +36,46 @@ ObjBoundMethod* create_bound_method(Value receiver, ObjClosure* method) {
 ObjInstance* create_instance(ObjClass *_class) {
   ObjInstance *instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
   instance->_class = _class;
-  init_table(&instance->fields);
+  instance->shape = hvm.root_shape;
+  instance->field_capacity = INSTANCE_INLINE_FIELDS;
+  instance->fields = instance->inline_fields;
   return instance;
 }
 
+bool get_instance_field(ObjInstance* instance, ObjString* name, Value* value) {
+  int slot = shape_lookup(instance->shape, name);
+  if (slot < 0) return false;
+  *value = instance->fields[slot];
+  return true;
+}
+
+void set_instance_field(ObjInstance* instance, ObjString* name, Value value) {
+  int slot = shape_lookup(instance->shape, name);
+  if (slot >= 0) {
+    instance->fields[slot] = value;
+    write_barrier((Obj*)instance, value);
+    return;
+  }
+
+  // The caller keeps the instance and value reachable, the transition
+  // keeps the name alive.
+  Shape* shape = shape_transition(instance->shape, name);
+  if (shape->slot_count > instance->field_capacity) {
+    int capacity = GROW_CAPACITY(instance->field_capacity);
+    Value* fields = ALLOCATE(Value, capacity);
+    memcpy(fields, instance->fields, sizeof(Value) * instance->shape->slot_count);
+    if (instance->fields != instance->inline_fields) {
+      FREE_ARRAY(Value, instance->fields, instance->field_capacity);
+    }
+    instance->fields = fields;
+    instance->field_capacity = capacity;
+  }
+
+  instance->shape = shape;
+  instance->fields[shape->slot_count - 1] = value;
+  write_barrier((Obj*)instance, value);
+}
+
 ObjClass* create_class(ObjString *name) {
   ObjClass *_class = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
   _class->name = name;
@@ -62,7 +100,11 @@ ObjFunction* create_function() {
   ObjFunction *obj_func = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
   obj_func->arity = 0;
   obj_func->upvalueCount = 0;
+  obj_func->max_stack = 0;
   obj_func->name = NULL;
+  obj_func->hotness = 0;
+  obj_func->jit = NULL;
+  obj_func->compiled = NULL;
   create_chunk(&obj_func->chunk);
   return obj_func;
 }
@@ -75,9 +117,32 @@ ObjUpvalue* create_upvalue(Value* slot) {
   return upvalue;
 }
 
-ObjNative* create_native(NativeFn function) {
+ObjNative* create_native(NativeFn function, const char* name, const char* signature) {
   ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
   native->function = function;
+  native->name = name;
+  native->signature = signature;
+  native->arity = (int)strlen(signature);
+  if (native->arity > NATIVE_MAX_ARITY) {
+    fprintf(stderr, "Native %s takes more than %d arguments.\n", name, NATIVE_MAX_ARITY);
+    exit(EXIT_FAILURE);
+  }
+  native->widen = 0;
+  for (int i = 0; i < native->arity; i++) {
+    switch (signature[i]) {
+      case 'i': native->accepts[i] = NATIVE_ARG_INT; break;
+      case 'd':
+        native->accepts[i] = NATIVE_ARG_DOUBLE | NATIVE_ARG_INT;
+        native->widen |= 1 << i;
+        break;
+      case 'n': native->accepts[i] = NATIVE_ARG_DOUBLE | NATIVE_ARG_INT; break;
+      case 's': native->accepts[i] = NATIVE_ARG_STRING; break;
+      case 'l': native->accepts[i] = NATIVE_ARG_LIST; break;
+      case 'm': native->accepts[i] = NATIVE_ARG_MAP; break;
+      case 'e': native->accepts[i] = NATIVE_ARG_SET; break;
+      default: native->accepts[i] = NATIVE_ARG_ANY; break;
+    }
+  }
   return native;
 }
 
@@ -103,9 +168,18 @@ static uint32_t hash_string(const char *key, int size) {
   return hash;
 }
 
+// The intern table does not keep strings alive, and a string the collector
+// did not reach stays in it until it is swept. One found in the meantime is
+// marked so the sweep keeps it.
+static ObjString* find_interned(const char* chars, int size, uint32_t hash) {
+  ObjString* interned = table_find_string(&hvm.strings, chars, size, hash);
+  if (interned != NULL && !interned->obj.is_young) keep_if_unswept((Obj*)interned);
+  return interned;
+}
+
 ObjString* take_string(char *chars, int size) {
   uint32_t hash = hash_string(chars, size);
-  ObjString* interned = table_find_string(&hvm.strings, chars, size, hash);
+  ObjString* interned = find_interned(chars, size, hash);
   if (interned != NULL) {
     FREE_ARRAY(char, chars, size + 1);
     return interned;
@@ -116,7 +190,7 @@ ObjString* take_string(char *chars, int size) {
 ObjString* copy_string(const char* chars, int size) {
   uint32_t hash = hash_string(chars, size);
 
-  ObjString* interned = table_find_string(&hvm.strings, chars, size, hash);
+  ObjString* interned = find_interned(chars, size, hash);
   if (interned != NULL) return interned;
 
   char* heap_chars = ALLOCATE(char, size + 1);
@@ -145,6 +219,32 @@ static void print_list(ObjList* list) {
   printf("]");
 }
 
+static void print_map(ObjMap* map) {
+  printf("{");
+  bool first = true;
+  for (int i = 0; i < map->table.capacity; i++) {
+    if (!IS_FULL(map->table.control[i])) continue;
+    if (!first) printf(", ");
+    first = false;
+    print_value(map->table.keys[i]);
+    printf(": ");
+    print_value(map->table.values[i]);
+  }
+  printf("}");
+}
+
+static void print_set(ObjSet* set) {
+  printf("{");
+  bool first = true;
+  for (int i = 0; i < set->table.capacity; i++) {
+    if (!IS_FULL(set->table.control[i])) continue;
+    if (!first) printf(", ");
+    first = false;
+    print_value(set->table.keys[i]);
+  }
+  printf("}");
+}
+
 void print_object(Value value) {
   switch (OBJ_TYPE(value)) {
     case OBJ_BOUND_METHOD:
@@ -174,6 +274,12 @@ void print_object(Value value) {
     case OBJ_LIST:
       print_list(AS_LIST(value));
       break;
+    case OBJ_MAP:
+      print_map(AS_MAP(value));
+      break;
+    case OBJ_SET:
+      print_set(AS_SET(value));
+      break;
   }
 }
 
@@ -182,9 +288,19 @@ ObjList* create_list() {
     list->items = NULL;
     list->count = 0;
     list->capacity = 0;
+    list->young_from = 0;
     return list;
 }
 
+// write_barrier() for a store at index, keeping young_from.
+static void list_write_barrier(ObjList* list, int index, Value value) {
+  if (IS_OBJ(value) && !list->obj.is_young && AS_OBJ(value)->is_young &&
+      (!list->obj.is_remembered || index < list->young_from)) {
+    list->young_from = index;
+  }
+  write_barrier((Obj*)list, value);
+}
+
 void push_back_to_list(ObjList* list, Value value) {
   if (list->capacity < list->count + 1) {
     int oldCapacity = list->capacity;
@@ -193,11 +309,13 @@ void push_back_to_list(ObjList* list, Value value) {
   }
   list->items[list->count] = value;
   list->count++;
+  list_write_barrier(list, list->count - 1, value);
   return;
 }
 
 void store_to_list(ObjList* list, int index, Value value) {
     list->items[index] = value;
+    list_write_barrier(list, index, value);
 }
 
 Value index_from_list(ObjList* list, int index) {
@@ -210,6 +328,10 @@ void delete_from_list(ObjList* list, int index) {
   }
   list->items[list->count - 1] = NIL_VAL;
   list->count--;
+  // Young items may have moved down, and so may items a major collection
+  // has not marked yet.
+  if (index < list->young_from) list->young_from = index;
+  if (list == hvm.scanning && index < hvm.scanning_index) hvm.scanning_index--;
 }
 
 bool is_valid_list_index(ObjList* list, int index) {
@@ -219,3 +341,45 @@ bool is_valid_list_index(ObjList* list, int index) {
   return true;
 }
 
+ObjMap* create_map() {
+  ObjMap* map = ALLOCATE_OBJ(ObjMap, OBJ_MAP);
+  init_value_table(&map->table, true);
+  return map;
+}
+
+bool get_from_map(ObjMap* map, Value key, Value* value) {
+  return value_table_get(&map->table, key, value);
+}
+
+// The map, key and value have to be reachable from the stack: storing a new
+// key can grow the table, which can collect.
+void store_to_map(ObjMap* map, Value key, Value value) {
+  value_table_set(&map->table, key, value);
+  write_barrier((Obj*)map, key);
+  write_barrier((Obj*)map, value);
+}
+
+bool delete_from_map(ObjMap* map, Value key) {
+  return value_table_delete(&map->table, key);
+}
+
+ObjSet* create_set() {
+  ObjSet* set = ALLOCATE_OBJ(ObjSet, OBJ_SET);
+  init_value_table(&set->table, false);
+  return set;
+}
+
+bool is_in_set(ObjSet* set, Value item) {
+  return value_table_get(&set->table, item, NULL);
+}
+
+// Like store_to_map(), the set and item have to be reachable from the stack.
+bool add_to_set(ObjSet* set, Value item) {
+  if (!value_table_set(&set->table, item, NIL_VAL)) return false;
+  write_barrier((Obj*)set, item);
+  return true;
+}
+
+bool delete_from_set(ObjSet* set, Value item) {
+  return value_table_delete(&set->table, item);
+}
@@ -10,6 +10,8 @@
 #include "value.h"
 #include "chunk.h"
 #include "table.h"
+#include "value_table.h"
+#include "shape.h"
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
@@ -21,16 +23,21 @@
 #define IS_INSTANCE(value) is_obj_type(value, OBJ_INSTANCE)
 #define IS_BOUND_METHOD(value) is_obj_type(value, OBJ_BOUND_METHOD)
 #define IS_LIST(value) is_obj_type(value, OBJ_LIST)
+#define IS_MAP(value) is_obj_type(value, OBJ_MAP)
+#define IS_SET(value) is_obj_type(value, OBJ_SET)
 
 #define AS_CLOSURE(value) ((ObjClosure*)AS_OBJ(value))
 #define AS_FUNCTION(value) ((ObjFunction*)AS_OBJ(value))
 #define AS_NATIVE(value) (((ObjNative*)AS_OBJ(value))->function)
+#define AS_NATIVE_OBJ(value) ((ObjNative*)AS_OBJ(value))
 #define AS_STRING(value) ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->chars)
 #define AS_CLASS(value) ((ObjClass*)AS_OBJ(value))
 #define AS_INSTANCE(value) ((ObjInstance*)AS_OBJ(value))
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
 #define AS_LIST(value) ((ObjList*)AS_OBJ(value))
+#define AS_MAP(value) ((ObjMap*)AS_OBJ(value))
+#define AS_SET(value) ((ObjSet*)AS_OBJ(value))
 
 typedef enum {
   OBJ_CLASS,
@@ -41,28 +48,72 @@ typedef enum {
   OBJ_FUNCTION,
   OBJ_NATIVE,
   OBJ_BOUND_METHOD,
-  OBJ_LIST
+  OBJ_LIST,
+  OBJ_MAP,
+  OBJ_SET
 } ObjType;
 
+#define OBJ_TYPE_COUNT (OBJ_SET + 1)
+
 struct Obj {
   ObjType type;
-  bool is_marked;
+  // Set until the object survives its first collection.
+  bool is_young;
+  // Set while the object is in hvm.remembered.
+  bool is_remembered;
+  // Links hvm.young_objects while the object is young.
   struct Obj* next;
 };
 
+struct JitCode;
+struct CallFrame;
+
+// A function's C translation from --emit-c, returning a JitStatus. See
+// run_compiled().
+typedef int (*CompiledFn)(struct CallFrame* frame);
+
 typedef struct {
   Obj obj;
   int arity;
   int upvalueCount;
+  // Deepest the stack gets in one call, counting the callee and arguments.
+  int max_stack;
   Chunk chunk;
   ObjString *name;
+  // Calls and loop back-edges so far, and the compiled code once hotness
+  // reaches JIT_HOT_THRESHOLD. See jit.h.
+  uint32_t hotness;
+  struct JitCode* jit;
+  CompiledFn compiled;
 } ObjFunction;
 
 typedef Value (*NativeFn)(int argCount, Value* args);
 
+// A native carries its argument signature, one character per parameter:
+// 'i' int, 'd' double (ints are widened), 'n' int or double, 's' string,
+// 'l' list, 'm' map, 'e' set and 'a' anything. create_native() decodes it into a set of
+// accepted NATIVE_ARG_ kinds per argument, which the call path checks
+// before the function runs, so natives may use the AS_ macros directly.
+#define NATIVE_MAX_ARITY 8
+
+#define NATIVE_ARG_DOUBLE 0x01
+#define NATIVE_ARG_INT 0x02
+#define NATIVE_ARG_STRING 0x04
+#define NATIVE_ARG_LIST 0x08
+#define NATIVE_ARG_MAP 0x10
+#define NATIVE_ARG_SET 0x20
+#define NATIVE_ARG_OTHER 0x40
+#define NATIVE_ARG_ANY 0x7f
+
 typedef struct {
   Obj obj;
   NativeFn function;
+  const char* name;
+  const char* signature;
+  int arity;
+  uint8_t accepts[NATIVE_MAX_ARITY];
+  // Bit i is set when argument i is a double that may be passed as an int.
+  uint8_t widen;
 } ObjNative;
 
 struct ObjString {
@@ -79,23 +130,30 @@ typedef struct ObjUpvalue {
   struct ObjUpvalue* next;
 } ObjUpvalue;
 
-typedef struct {
+typedef struct ObjClosure {
   Obj obj;
   ObjFunction* function;
   ObjUpvalue** upvalues;
   int upvalueCount;
 } ObjClosure;
 
-typedef struct {
+typedef struct ObjClass {
   Obj obj;
   ObjString *name;
   Table methods;
 } ObjClass;
 
+// Small instances keep their fields inline. fields points at inline_fields
+// until a field beyond INSTANCE_INLINE_FIELDS is added, then at a heap array.
+#define INSTANCE_INLINE_FIELDS 4
+
 typedef struct {
   Obj obj;
   ObjClass* _class;
-  Table fields; 
+  Shape* shape;
+  int field_capacity;
+  Value* fields;
+  Value inline_fields[INSTANCE_INLINE_FIELDS];
 } ObjInstance;
 
 typedef struct {
@@ -109,13 +167,31 @@ typedef struct {
   int count;
   int capacity;
   Value* items;
+  // While the list is remembered, the lowest index written since the last
+  // collection. Items below it are old, so a minor collection skips them.
+  int young_from;
 } ObjList;
 
+// A hash map from {k: v} literals. Keys are the values is_hashable()
+// accepts.
+typedef struct {
+  Obj obj;
+  ValueTable table;
+} ObjMap;
+
+// A hash set, made by the set library. Its table has no values.
+typedef struct {
+  Obj obj;
+  ValueTable table;
+} ObjSet;
+
 ObjInstance* create_instance(ObjClass* _class);
+bool get_instance_field(ObjInstance* instance, ObjString* name, Value* value);
+void set_instance_field(ObjInstance* instance, ObjString* name, Value value);
 ObjClass* create_class(ObjString *name);
 ObjClosure* create_closure(ObjFunction *function);
 ObjFunction* create_function();
-ObjNative* create_native(NativeFn function);
+ObjNative* create_native(NativeFn function, const char* name, const char* signature);
 ObjUpvalue* create_upvalue(Value *slot);
 ObjBoundMethod* create_bound_method(Value receiver, ObjClosure* method);
 
@@ -130,6 +206,16 @@ Value index_from_list(ObjList* list, int index);
 void delete_from_list(ObjList* list, int index);
 bool is_valid_list_index(ObjList* list, int index);
 
+ObjMap* create_map();
+bool get_from_map(ObjMap* map, Value key, Value* value);
+void store_to_map(ObjMap* map, Value key, Value value);
+bool delete_from_map(ObjMap* map, Value key);
+
+ObjSet* create_set();
+bool is_in_set(ObjSet* set, Value item);
+bool add_to_set(ObjSet* set, Value item);
+bool delete_from_set(ObjSet* set, Value item);
+
 static inline bool is_obj_type(Value v, ObjType type) {
   return IS_OBJ(v) && AS_OBJ(v)->type == type;
 }
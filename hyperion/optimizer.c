@@ -0,0 +1,640 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include "optimizer.h"
+#include "value.h"
+
+// One instruction of the chunk while optimize_chunk() rewrites it. Nothing
+// moves until the end: an instruction that goes away is only marked dead,
+// and jumps name the instruction they land on rather than an offset.
+typedef struct {
+  int offset;
+  int size;
+  uint8_t op;
+  int constant;
+  int target;
+  bool live;
+} Instruction;
+
+typedef struct {
+  Chunk* chunk;
+  Instruction* code;
+  int count;
+  bool* targets;
+} Program;
+
+// FOR_PREP and FOR_LOOP branch too, but they also move the counter, so
+// they are only ever relocated, never threaded or removed.
+static bool is_counted_loop(uint8_t op) {
+  return op == OP_FOR_PREP || op == OP_FOR_LOOP;
+}
+
+static bool is_jump(uint8_t op) {
+  return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_LOOP ||
+      is_counted_loop(op);
+}
+
+static bool is_constant(Instruction* instruction) {
+  return instruction->op == OP_CONSTANT || instruction->op == OP_TRUE ||
+      instruction->op == OP_FALSE || instruction->op == OP_NIL;
+}
+
+static Value constant_value(Program* program, Instruction* instruction) {
+  switch (instruction->op) {
+    case OP_TRUE: return BOOL_VAL(true);
+    case OP_FALSE: return BOOL_VAL(false);
+    case OP_NIL: return NIL_VAL;
+    default: return program->chunk->constants.values[instruction->constant];
+  }
+}
+
+// Index of the first live instruction at or after index, or count for the
+// end of the chunk. A jump to a dead instruction lands there instead.
+static int live_from(Program* program, int index) {
+  while (index < program->count && !program->code[index].live) index++;
+  return index;
+}
+
+static int live_before(Program* program, int index) {
+  do {
+    index--;
+  } while (index >= 0 && !program->code[index].live);
+  return index;
+}
+
+// A jump to an instruction that goes lands on the next live one instead,
+// so that one is a target from now on.
+static void kill(Program* program, int index) {
+  program->code[index].live = false;
+  if (program->targets[index]) {
+    program->targets[index] = false;
+    program->targets[live_from(program, index)] = true;
+  }
+}
+
+static void find_live_targets(Program* program) {
+  memset(program->targets, 0, sizeof(bool) * (program->count + 1));
+  for (int i = 0; i < program->count; i++) {
+    Instruction* instruction = &program->code[i];
+    if (!instruction->live || !is_jump(instruction->op)) continue;
+    instruction->target = live_from(program, instruction->target);
+    program->targets[instruction->target] = true;
+  }
+}
+
+// Replaces the instruction with one that pushes value, or leaves it alone
+// when the chunk has no room for another constant.
+static bool make_constant(Program* program, Instruction* instruction, Value value) {
+  if (IS_BOOL(value)) {
+    instruction->op = AS_BOOL(value) ? OP_TRUE : OP_FALSE;
+    instruction->size = 1;
+    return true;
+  }
+  if (program->chunk->constants.size > UINT8_MAX) return false;
+
+  instruction->op = OP_CONSTANT;
+  instruction->size = 2;
+  instruction->constant = add_constant(program->chunk, value);
+  return true;
+}
+
+// BINARY_OP in HVM_loop.h, for two ints or two doubles.
+#define FOLD_BINARY(valueType, op) \
+    do { \
+      if (IS_INT(a) && IS_INT(b)) { \
+        *result = valueType(AS_INT(a) op AS_INT(b)); \
+        return true; \
+      } \
+      if (IS_DOUBLE(a) && IS_DOUBLE(b)) { \
+        *result = valueType(AS_DOUBLE(a) op AS_DOUBLE(b)); \
+        return true; \
+      } \
+      return false; \
+    } while (false)
+
+// Int arithmetic wraps here as it does at run time on this target.
+static int wrap(int64_t value) {
+  return (int)(uint32_t)(uint64_t)value;
+}
+
+// Works out what the interpreter would push for a op b. Anything it would
+// report as an error, and the int results the generic opcodes give for
+// doubles, are left for run time.
+static bool fold_binary(uint8_t op, Value a, Value b, Value* result) {
+  bool ints = IS_INT(a) && IS_INT(b);
+  bool doubles = IS_DOUBLE(a) && IS_DOUBLE(b);
+
+  switch (op) {
+    case OP_EQUAL:
+      *result = BOOL_VAL(are_equal(a, b));
+      return true;
+    case OP_LESS: FOLD_BINARY(BOOL_VAL, <);
+    case OP_GREATER: FOLD_BINARY(BOOL_VAL, >);
+    case OP_ADD_S: {
+      if (!IS_STRING(a) || !IS_STRING(b)) return false;
+      ObjString* left = AS_STRING(a);
+      ObjString* right = AS_STRING(b);
+      int size = left->size + right->size;
+      char* chars = ALLOCATE(char, size + 1);
+      memcpy(chars, left->chars, left->size);
+      memcpy(chars + left->size, right->chars, right->size);
+      chars[size] = '\0';
+      *result = OBJ_VAL(take_string(chars, size));
+      return true;
+    }
+    default:
+      break;
+  }
+
+  if (ints) {
+    int x = AS_INT(a);
+    int y = AS_INT(b);
+    bool divides = y != 0 && !(x == INT32_MIN && y == -1);
+    switch (op) {
+      case OP_ADD: *result = INT_VAL(wrap((int64_t)x + y)); return true;
+      case OP_MINUS: *result = INT_VAL(wrap((int64_t)x - y)); return true;
+      case OP_MULTI: *result = INT_VAL(wrap((int64_t)x * y)); return true;
+      case OP_POWER: *result = INT_VAL(x ^ y); return true;
+      case OP_DIVIDE:
+        if (!divides) return false;
+        *result = INT_VAL(x / y);
+        return true;
+      case OP_MODULE:
+        if (!divides) return false;
+        *result = INT_VAL(x % y);
+        return true;
+      case OP_MINUS_D: *result = DOUBLE_VAL(wrap((int64_t)x - y)); return true;
+      case OP_MULTI_D: *result = DOUBLE_VAL(wrap((int64_t)x * y)); return true;
+      case OP_DIVIDE_D:
+        if (!divides) return false;
+        *result = DOUBLE_VAL(x / y);
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  if (doubles) {
+    double x = AS_DOUBLE(a);
+    double y = AS_DOUBLE(b);
+    double value;
+    switch (op) {
+      case OP_ADD_D: value = x + y; break;
+      case OP_MINUS_D: value = x - y; break;
+      case OP_MULTI_D: value = x * y; break;
+      case OP_DIVIDE_D: value = x / y; break;
+      default: return false;
+    }
+    // NaN and infinities stay run-time values, there's no literal for them.
+    if (!isfinite(value)) return false;
+    *result = DOUBLE_VAL(value);
+    return true;
+  }
+  return false;
+}
+
+static bool fold_unary(uint8_t op, Value a, Value* result) {
+  switch (op) {
+    case OP_NOT:
+      *result = BOOL_VAL(IS_BOOL(a) && !AS_BOOL(a));
+      return true;
+    case OP_NEGATE:
+      if (IS_INT(a)) {
+        if (AS_INT(a) == INT32_MIN) return false;
+        *result = INT_VAL(-AS_INT(a));
+        return true;
+      }
+      if (IS_DOUBLE(a)) {
+        *result = DOUBLE_VAL(-AS_DOUBLE(a));
+        return true;
+      }
+      return false;
+    default:
+      return false;
+  }
+}
+
+static bool is_foldable_binary(uint8_t op) {
+  switch (op) {
+    case OP_ADD: case OP_MINUS: case OP_MULTI: case OP_DIVIDE:
+    case OP_MODULE: case OP_POWER:
+    case OP_ADD_D: case OP_MINUS_D: case OP_MULTI_D: case OP_DIVIDE_D:
+    case OP_ADD_S: case OP_EQUAL: case OP_LESS: case OP_GREATER:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Folds an instruction whose operands are all pushed by the constants just
+// before it, nothing jumping in between. The first constant becomes the
+// result and the rest go.
+static bool fold_constants(Program* program, int index) {
+  Instruction* instruction = &program->code[index];
+  int right = live_before(program, index);
+  if (right < 0 || program->targets[index]) return false;
+  if (!is_constant(&program->code[right])) return false;
+
+  Value b = constant_value(program, &program->code[right]);
+  Value result;
+
+  switch (instruction->op) {
+    case OP_POP:
+      // A constant nobody looks at.
+      kill(program, right);
+      kill(program, index);
+      return true;
+    case OP_JUMP_IF_FALSE:
+      // The branch is decided. The condition is still left on the stack for
+      // whatever pops it on either side.
+      if (IS_BOOL(b) && !AS_BOOL(b)) {
+        instruction->op = OP_JUMP;
+      } else {
+        kill(program, index);
+      }
+      return true;
+    case OP_NOT:
+    case OP_NEGATE:
+      if (!fold_unary(instruction->op, b, &result)) return false;
+      if (!make_constant(program, &program->code[right], result)) return false;
+      kill(program, index);
+      return true;
+    default:
+      break;
+  }
+
+  if (!is_foldable_binary(instruction->op)) return false;
+  int left = live_before(program, right);
+  if (left < 0 || program->targets[right]) return false;
+  if (!is_constant(&program->code[left])) return false;
+
+  Value a = constant_value(program, &program->code[left]);
+  if (!fold_binary(instruction->op, a, b, &result)) return false;
+  if (!make_constant(program, &program->code[left], result)) return false;
+  kill(program, right);
+  kill(program, index);
+  return true;
+}
+
+// Points a jump that lands on an unconditional jump at where that one goes.
+// A JUMP_IF_FALSE taken onto another one can follow it too, the falsey
+// condition is still on top. JUMP_IF_FALSE only goes forward, and no jump
+// may end up farther than a 16-bit operand reaches.
+static bool thread_jump(Program* program, int index) {
+  Instruction* instruction = &program->code[index];
+  instruction->target = live_from(program, instruction->target);
+  int target = instruction->target;
+
+  for (int steps = 0; steps < program->count; steps++) {
+    if (target >= program->count) break;
+    Instruction* next = &program->code[target];
+    bool follows = next->op == OP_JUMP || next->op == OP_LOOP ||
+        (instruction->op == OP_JUMP_IF_FALSE && next->op == OP_JUMP_IF_FALSE);
+    if (!follows) break;
+
+    int further = live_from(program, next->target);
+    if (further == target) break;
+    if (instruction->op == OP_JUMP_IF_FALSE && further <= index) break;
+    int end = instruction->offset + instruction->size;
+    int distance = abs(program->code[further].offset - end);
+    if (further >= program->count) distance = abs(program->chunk->size - end);
+    if (distance > UINT16_MAX) break;
+    target = further;
+  }
+
+  if (target == instruction->target) return false;
+  instruction->target = target;
+  return true;
+}
+
+static bool falls_through(uint8_t op) {
+  return op != OP_JUMP && op != OP_LOOP && op != OP_RETURN;
+}
+
+// Kills everything no path from the entry reaches, such as the code after a
+// return or the side of a branch that folded away.
+static bool remove_unreachable(Program* program) {
+  bool* reached = calloc(program->count + 1, sizeof(bool));
+  int* worklist = malloc(sizeof(int) * (program->count + 1));
+  if (reached == NULL || worklist == NULL) exit(1);
+
+  int pending = 0;
+  int entry = live_from(program, 0);
+  reached[entry] = true;
+  worklist[pending++] = entry;
+
+  while (pending > 0) {
+    int index = worklist[--pending];
+    if (index >= program->count) continue;
+    Instruction* instruction = &program->code[index];
+
+    int successors[2];
+    int count = 0;
+    if (falls_through(instruction->op)) {
+      successors[count++] = live_from(program, index + 1);
+    }
+    if (is_jump(instruction->op)) {
+      successors[count++] = live_from(program, instruction->target);
+    }
+
+    for (int i = 0; i < count; i++) {
+      if (reached[successors[i]]) continue;
+      reached[successors[i]] = true;
+      worklist[pending++] = successors[i];
+    }
+  }
+
+  bool changed = false;
+  for (int i = 0; i < program->count; i++) {
+    if (program->code[i].live && !reached[i]) {
+      program->code[i].live = false;
+      changed = true;
+    }
+  }
+
+  free(reached);
+  free(worklist);
+  return changed;
+}
+
+static bool optimize_pass(Program* program) {
+  bool changed = false;
+
+  find_live_targets(program);
+  for (int i = 0; i < program->count; i++) {
+    if (program->code[i].live && fold_constants(program, i)) changed = true;
+  }
+
+  find_live_targets(program);
+  for (int i = 0; i < program->count; i++) {
+    Instruction* instruction = &program->code[i];
+    if (!instruction->live || !is_jump(instruction->op)) continue;
+    if (is_counted_loop(instruction->op)) continue;
+    if (thread_jump(program, i)) changed = true;
+
+    // A jump to the next instruction does nothing, taken or not.
+    if (instruction->target == live_from(program, i + 1)) {
+      kill(program, i);
+      changed = true;
+    }
+  }
+
+  if (remove_unreachable(program)) changed = true;
+  return changed;
+}
+
+// Writes the live instructions back over the chunk, re-encoding each jump
+// for where its target ended up. A forward unconditional jump is an
+// OP_JUMP and a backward one an OP_LOOP, whichever it started as. The
+// jump of a counted loop is its last two bytes.
+static void rewrite_chunk(Program* program) {
+  Chunk* chunk = program->chunk;
+  int* offsets = malloc(sizeof(int) * (program->count + 1));
+  uint8_t* code = malloc(chunk->size);
+  int* lines = malloc(sizeof(int) * chunk->size);
+  if (offsets == NULL || code == NULL || lines == NULL) exit(1);
+
+  int size = 0;
+  for (int i = 0; i < program->count; i++) {
+    offsets[i] = size;
+    if (program->code[i].live) size += program->code[i].size;
+  }
+  offsets[program->count] = size;
+
+  for (int i = 0; i < program->count; i++) {
+    Instruction* instruction = &program->code[i];
+    if (!instruction->live) continue;
+
+    int at = offsets[i];
+    for (int j = 0; j < instruction->size; j++) {
+      lines[at + j] = chunk->lines[instruction->offset];
+    }
+
+    if (is_counted_loop(instruction->op)) {
+      int end = at + instruction->size;
+      int target = offsets[instruction->target];
+      int jump = instruction->op == OP_FOR_LOOP ? end - target : target - end;
+      memcpy(&code[at], &chunk->code[instruction->offset], instruction->size);
+      code[end - 2] = (jump >> 8) & 0xff;
+      code[end - 1] = jump & 0xff;
+    } else if (is_jump(instruction->op)) {
+      int end = at + 3;
+      int target = offsets[instruction->target];
+      uint8_t op = instruction->op;
+      if (op != OP_JUMP_IF_FALSE) op = target >= end ? OP_JUMP : OP_LOOP;
+      int jump = op == OP_LOOP ? end - target : target - end;
+      code[at] = op;
+      code[at + 1] = (jump >> 8) & 0xff;
+      code[at + 2] = jump & 0xff;
+    } else if (instruction->op == OP_CONSTANT) {
+      code[at] = OP_CONSTANT;
+      code[at + 1] = (uint8_t)instruction->constant;
+    } else if (is_constant(instruction)) {
+      code[at] = instruction->op;
+    } else {
+      memcpy(&code[at], &chunk->code[instruction->offset], instruction->size);
+      memcpy(&lines[at], &chunk->lines[instruction->offset],
+          sizeof(int) * instruction->size);
+    }
+  }
+
+  memcpy(chunk->code, code, size);
+  memcpy(chunk->lines, lines, sizeof(int) * size);
+  chunk->size = size;
+
+  free(offsets);
+  free(code);
+  free(lines);
+}
+
+// Folds constant expressions, decides branches on constant conditions,
+// threads jumps through jumps and drops whatever can no longer run. Each
+// step can open up another, so they repeat until nothing changes. Runs on
+// the plain instruction stream before compute_max_stack() and fusion, and
+// returns how many bytes of code it removed.
+int optimize_chunk(Chunk* chunk) {
+  int* indices = malloc(sizeof(int) * (chunk->size + 1));
+  Instruction* code = malloc(sizeof(Instruction) * (chunk->size + 1));
+  bool* targets = malloc(sizeof(bool) * (chunk->size + 1));
+  if (indices == NULL || code == NULL || targets == NULL) exit(1);
+
+  int count = 0;
+  for (int offset = 0; offset < chunk->size; offset += instruction_size(chunk, offset)) {
+    indices[offset] = count;
+    Instruction* instruction = &code[count++];
+    instruction->offset = offset;
+    instruction->size = instruction_size(chunk, offset);
+    instruction->op = chunk->code[offset];
+    instruction->constant = instruction->op == OP_CONSTANT ? chunk->code[offset + 1] : -1;
+    instruction->target = -1;
+    instruction->live = true;
+  }
+  indices[chunk->size] = count;
+
+  for (int i = 0; i < count; i++) {
+    Instruction* instruction = &code[i];
+    if (!is_jump(instruction->op)) continue;
+    instruction->target = indices[jump_target(chunk, instruction->offset)];
+  }
+
+  Program program = {chunk, code, count, targets};
+  while (optimize_pass(&program)) {}
+
+  int before = chunk->size;
+  rewrite_chunk(&program);
+
+  free(indices);
+  free(code);
+  free(targets);
+  return before - chunk->size;
+}
+
+#define MAX_FUSION_PATTERN 5
+
+typedef bool (*FusionGuard)(Chunk* chunk, int* offsets);
+
+// A run of instructions that execute() can do in one dispatch. Only the
+// first opcode of a match is overwritten, so jump offsets and line info
+// stay valid and a handler can fall back to the instruction it replaced.
+typedef struct {
+  uint8_t pattern[MAX_FUSION_PATTERN];
+  int length;
+  uint8_t fused;
+  FusionGuard guard;
+} FusionRule;
+
+static bool is_int_constant(Chunk* chunk, int offset) {
+  return IS_INT(chunk->constants.values[chunk->code[offset + 1]]);
+}
+
+static bool add_int_constant(Chunk* chunk, int* offsets) {
+  return is_int_constant(chunk, offsets[1]);
+}
+
+static bool store_same_local(Chunk* chunk, int* offsets) {
+  return is_int_constant(chunk, offsets[1]) &&
+      chunk->code[offsets[0] + 1] == chunk->code[offsets[3] + 1];
+}
+
+// Longer patterns come first so they win over their own prefixes.
+static FusionRule rules[] = {
+  {{OP_GET_LOCAL, OP_CONSTANT, OP_ADD, OP_SET_LOCAL, OP_POP}, 5,
+      OP_INC_LOCAL, store_same_local},
+  {{OP_GET_LOCAL, OP_CONSTANT, OP_ADD}, 3,
+      OP_ADD_LOCAL_CONST, add_int_constant},
+  {{OP_LESS, OP_JUMP_IF_FALSE, OP_POP}, 3, OP_LESS_JUMP_IF_FALSE, NULL},
+  {{OP_GREATER, OP_JUMP_IF_FALSE, OP_POP}, 3, OP_GREATER_JUMP_IF_FALSE, NULL},
+  {{OP_GET_LOCAL, OP_GET_LOCAL}, 2, OP_GET_LOCAL_GET_LOCAL, NULL},
+};
+
+static bool* find_jump_targets(Chunk* chunk) {
+  bool* targets = calloc(chunk->size + 1, sizeof(bool));
+  if (targets == NULL) exit(1);
+
+  for (int offset = 0; offset < chunk->size; offset += instruction_size(chunk, offset)) {
+    int target = jump_target(chunk, offset);
+    if (target >= 0 && target <= chunk->size) targets[target] = true;
+  }
+  return targets;
+}
+
+static bool match_rule(Chunk* chunk, bool* targets, FusionRule* rule, int offset) {
+  int offsets[MAX_FUSION_PATTERN];
+  for (int i = 0; i < rule->length; i++) {
+    if (offset >= chunk->size || chunk->code[offset] != rule->pattern[i]) {
+      return false;
+    }
+    // Nothing may jump into the middle of a fused sequence.
+    if (i > 0 && targets[offset]) return false;
+
+    offsets[i] = offset;
+    offset += instruction_size(chunk, offset);
+  }
+  return rule->guard == NULL || rule->guard(chunk, offsets);
+}
+
+// Rewrites every match of the rules above into its superinstruction and
+// returns how many dispatches that saves per pass over the chunk.
+int fuse_superinstructions(Chunk* chunk) {
+  bool* targets = find_jump_targets(chunk);
+  int removed = 0;
+
+  int offset = 0;
+  while (offset < chunk->size) {
+    FusionRule* matched = NULL;
+    for (size_t i = 0; i < sizeof(rules) / sizeof(rules[0]); i++) {
+      if (match_rule(chunk, targets, &rules[i], offset)) {
+        matched = &rules[i];
+        break;
+      }
+    }
+
+    if (matched == NULL) {
+      offset += instruction_size(chunk, offset);
+      continue;
+    }
+
+    chunk->code[offset] = matched->fused;
+    removed += matched->length - 1;
+    for (int i = 0; i < matched->length; i++) {
+      offset += instruction_size(chunk, offset);
+    }
+  }
+
+  free(targets);
+  return removed;
+}
+
+// Follows every path through the chunk and returns the deepest the stack
+// gets, counted from the frame's slot zero. The compiler leaves the same
+// height at a jump target along every edge into it, so each instruction only
+// needs visiting once. Run before fusion, on the plain instruction stream.
+int compute_max_stack(Chunk* chunk, int entry_height) {
+  int* heights = malloc(sizeof(int) * (chunk->size + 1));
+  int* worklist = malloc(sizeof(int) * (chunk->size + 1));
+  if (heights == NULL || worklist == NULL) exit(1);
+  for (int i = 0; i <= chunk->size; i++) heights[i] = -1;
+
+  int max_height = entry_height;
+  int pending = 0;
+  heights[0] = entry_height;
+  worklist[pending++] = 0;
+
+  while (pending > 0) {
+    int offset = worklist[--pending];
+    int height = heights[offset];
+
+    while (offset < chunk->size) {
+      uint8_t instruction = chunk->code[offset];
+      height += stack_effect(chunk, offset);
+      if (height > max_height) max_height = height;
+      if (instruction == OP_RETURN) break;
+
+      int next = offset + instruction_size(chunk, offset);
+      int target = jump_target(chunk, offset);
+      if (target >= 0) {
+        if (target <= chunk->size && heights[target] < 0) {
+          heights[target] = height;
+          worklist[pending++] = target;
+        }
+        if (instruction == OP_JUMP || instruction == OP_LOOP) break;
+      }
+
+      if (heights[next] >= 0) break;
+      heights[next] = height;
+      offset = next;
+    }
+  }
+
+  free(heights);
+  free(worklist);
+  return max_height;
+}
@@ -0,0 +1,17 @@
+#ifndef optimizer_h
+#define optimizer_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chunk.h"
+
+int optimize_chunk(Chunk* chunk);
+
+int fuse_superinstructions(Chunk* chunk);
+
+int compute_max_stack(Chunk* chunk, int entry_height);
+
+#endif
@@ -0,0 +1,67 @@
+#include <stdlib.h>
+
+#include "HVM.h"
+#include "memory.h"
+#include "object.h"
+#include "shape.h"
+
+static Shape* allocate_shape(Shape* parent, ObjString* name) {
+  Shape* shape = ALLOCATE(Shape, 1);
+  shape->parent = parent;
+  shape->name = name;
+  shape->slot_count = parent == NULL ? 0 : parent->slot_count + 1;
+  shape->transition_count = 0;
+  shape->transition_capacity = 0;
+  shape->transitions = NULL;
+  return shape;
+}
+
+Shape* create_root_shape() {
+  return allocate_shape(NULL, NULL);
+}
+
+void free_shape_tree(Shape* shape) {
+  for (int i = 0; i < shape->transition_count; i++) {
+    free_shape_tree(shape->transitions[i]);
+  }
+  FREE_ARRAY(Shape*, shape->transitions, shape->transition_capacity);
+  FREE(Shape, shape);
+}
+
+void mark_shape_tree(Shape* shape) {
+  mark_object_memory((Obj*)shape->name);
+  for (int i = 0; i < shape->transition_count; i++) {
+    mark_shape_tree(shape->transitions[i]);
+  }
+}
+
+// Field names are interned, so walking towards the root comparing pointers
+// finds the slot. Instances rarely have more than a handful of fields.
+int shape_lookup(Shape* shape, ObjString* name) {
+  for (; shape->name != NULL; shape = shape->parent) {
+    if (shape->name == name) return shape->slot_count - 1;
+  }
+  return -1;
+}
+
+Shape* shape_transition(Shape* shape, ObjString* name) {
+  for (int i = 0; i < shape->transition_count; i++) {
+    if (shape->transitions[i]->name == name) return shape->transitions[i];
+  }
+
+  // The name is not reachable from the tree until the child is linked in,
+  // so keep it on the stack across the allocations.
+  push(OBJ_VAL(name));
+  Shape* child = allocate_shape(shape, name);
+
+  if (shape->transition_capacity < shape->transition_count + 1) {
+    int old_capacity = shape->transition_capacity;
+    shape->transition_capacity = GROW_CAPACITY(old_capacity);
+    shape->transitions = GROW_ARRAY(Shape*, shape->transitions,
+        old_capacity, shape->transition_capacity);
+  }
+  shape->transitions[shape->transition_count++] = child;
+  pop();
+
+  return child;
+}
@@ -0,0 +1,36 @@
+#ifndef shape_h
+#define shape_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "value.h"
+
+// A shape is the field layout shared by every instance that was given the
+// same fields in the same order. Shapes form a tree rooted at
+// hvm.root_shape: adding a field follows the transition for that name to a
+// child shape, creating it the first time. The new field's slot is
+// slot_count - 1 of the child.
+//
+// Shapes are not collected. They live until free_hvm, and the field names
+// they hold are marked as roots.
+typedef struct Shape {
+  struct Shape* parent;
+  ObjString* name;
+  int slot_count;
+
+  int transition_count;
+  int transition_capacity;
+  struct Shape** transitions;
+} Shape;
+
+Shape* create_root_shape();
+void free_shape_tree(Shape* shape);
+void mark_shape_tree(Shape* shape);
+
+int shape_lookup(Shape* shape, ObjString* name);
+Shape* shape_transition(Shape* shape, ObjString* name);
+
+#endif
@@ -37,21 +37,11 @@ static Value floor_native_function(int argCount, Value* args) {
   return INT_VAL(r);
 }
 
-void add_module_console(const char* name, Value (*f)(int, Value*)) {
-  set_table(
-      &hvm.globals,
-      AS_STRING(
-        OBJ_VAL(
-          copy_string(name, (int)strlen(name))
-        )
-      ),
-      OBJ_VAL(
-        create_native(f)
-      )
-  );
+void add_module_console(const char* name, Value (*f)(int, Value*), const char* signature) {
+  define_native(name, f, signature);
 }
 
 void console_module_init() {
-  add_module_console("console:get_line", get_line_native_function);
+  add_module_console("console:get_line", get_line_native_function, "");
 }
 
@@ -67,22 +67,12 @@ static Value file_io_output_native_function(int argCount, Value *args) {
   return NIL_VAL;
 }
 
-void add_module_file_io(const char* name, Value (*f)(int, Value*)) {
-  set_table(
-      &hvm.globals,
-      AS_STRING(
-        OBJ_VAL(
-          copy_string(name, (int)strlen(name))
-        )
-      ),
-      OBJ_VAL(
-        create_native(f)
-      )
-  );
+void add_module_file_io(const char* name, Value (*f)(int, Value*), const char* signature) {
+  define_native(name, f, signature);
 }
 
 void file_io_module_init() {
-  add_module_file_io("file_io:read", file_io_read_native_function);
-  add_module_file_io("file_io:write", file_io_output_native_function);
+  add_module_file_io("file_io:read", file_io_read_native_function, "s");
+  add_module_file_io("file_io:write", file_io_output_native_function, "ss");
 }
 
@@ -0,0 +1,148 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+
+#include "gc.h"
+#include "../../HVM.h"
+#include "../../value.h"
+#include "../../object.h"
+#include "../../memory.h"
+
+// Sizes go to scripts in kilobytes, so they fit an int.
+static Value kilobytes(size_t bytes) {
+  size_t kb = bytes / 1024;
+  return INT_VAL(kb > INT_MAX ? INT_MAX : (int)kb);
+}
+
+static Value count(size_t value) {
+  return INT_VAL(value > INT_MAX ? INT_MAX : (int)value);
+}
+
+static Value collect_native_function(int argCount, Value* args) {
+  take_out_garbage();
+  return NIL_VAL;
+}
+
+static Value collections_native_function(int argCount, Value* args) {
+  return count(hvm.gc_major_count);
+}
+
+static Value minor_collections_native_function(int argCount, Value* args) {
+  return count(hvm.gc_minor_count);
+}
+
+static Value pause_total_native_function(int argCount, Value* args) {
+  return DOUBLE_VAL(hvm.gc_pause_total * 1e3);
+}
+
+static Value pause_max_native_function(int argCount, Value* args) {
+  return DOUBLE_VAL(hvm.gc_pause_max * 1e3);
+}
+
+static Value allocated_native_function(int argCount, Value* args) {
+  return kilobytes(hvm.bytes_allocated);
+}
+
+static Value freed_native_function(int argCount, Value* args) {
+  return kilobytes(hvm.bytes_freed);
+}
+
+static Value live_native_function(int argCount, Value* args) {
+  return kilobytes(hvm.bytes_alloc);
+}
+
+static Value peak_native_function(int argCount, Value* args) {
+  return kilobytes(hvm.peak_heap);
+}
+
+// The names gc:objects() knows each type by.
+static const char* type_names[OBJ_TYPE_COUNT] = {
+  [OBJ_CLASS] = "class",
+  [OBJ_INSTANCE] = "instance",
+  [OBJ_STRING] = "string",
+  [OBJ_UPVALUE] = "upvalue",
+  [OBJ_CLOSURE] = "closure",
+  [OBJ_FUNCTION] = "function",
+  [OBJ_NATIVE] = "native",
+  [OBJ_BOUND_METHOD] = "bound_method",
+  [OBJ_LIST] = "list",
+  [OBJ_MAP] = "map",
+  [OBJ_SET] = "set",
+};
+
+static Value objects_native_function(int argCount, Value* args) {
+  const char* name = AS_CSTRING(args[0]);
+  for (int i = 0; i < OBJ_TYPE_COUNT; i++) {
+    if (strcmp(type_names[i], name) == 0) return count(hvm.object_counts[i]);
+  }
+  return NIL_VAL;
+}
+
+// The intern table, to see how long its probes get as strings come and go.
+static Value strings_native_function(int argCount, Value* args) {
+  return count((size_t)hvm.strings.size);
+}
+
+static Value string_slots_native_function(int argCount, Value* args) {
+  return count((size_t)hvm.strings.capacity);
+}
+
+static Value string_probe_native_function(int argCount, Value* args) {
+  TableStats stats;
+  table_stats(&hvm.strings, &stats);
+  return DOUBLE_VAL(stats.average_probe);
+}
+
+static Value string_probe_max_native_function(int argCount, Value* args) {
+  TableStats stats;
+  table_stats(&hvm.strings, &stats);
+  return INT_VAL(stats.longest_probe);
+}
+
+static Value heap_limit_native_function(int argCount, Value* args) {
+  return kilobytes(hvm.gc_heap_limit);
+}
+
+static Value set_heap_limit_native_function(int argCount, Value* args) {
+  int kb = AS_INT(args[0]);
+  if (kb < 0) return NIL_VAL;
+  set_gc_heap_limit((size_t)kb * 1024);
+  return NIL_VAL;
+}
+
+static Value growth_native_function(int argCount, Value* args) {
+  return DOUBLE_VAL(hvm.gc_grow_factor);
+}
+
+static Value set_growth_native_function(int argCount, Value* args) {
+  set_gc_grow_factor(AS_DOUBLE(args[0]));
+  return NIL_VAL;
+}
+
+void add_module_gc(const char* name, Value (*f)(int, Value*), const char* signature) {
+  define_native(name, f, signature);
+}
+
+void gc_module_init() {
+  add_module_gc("gc:collect", collect_native_function, "");
+  add_module_gc("gc:collections", collections_native_function, "");
+  add_module_gc("gc:minor_collections", minor_collections_native_function, "");
+  add_module_gc("gc:pause_total", pause_total_native_function, "");
+  add_module_gc("gc:pause_max", pause_max_native_function, "");
+  add_module_gc("gc:allocated", allocated_native_function, "");
+  add_module_gc("gc:freed", freed_native_function, "");
+  add_module_gc("gc:live", live_native_function, "");
+  add_module_gc("gc:peak", peak_native_function, "");
+  add_module_gc("gc:objects", objects_native_function, "s");
+  add_module_gc("gc:strings", strings_native_function, "");
+  add_module_gc("gc:string_slots", string_slots_native_function, "");
+  add_module_gc("gc:string_probe", string_probe_native_function, "");
+  add_module_gc("gc:string_probe_max", string_probe_max_native_function, "");
+  add_module_gc("gc:heap_limit", heap_limit_native_function, "");
+  add_module_gc("gc:set_heap_limit", set_heap_limit_native_function, "i");
+  add_module_gc("gc:growth", growth_native_function, "");
+  add_module_gc("gc:set_growth", set_growth_native_function, "d");
+}
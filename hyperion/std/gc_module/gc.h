@@ -0,0 +1,11 @@
+#ifndef gc_module_h
+#define gc_module_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+void gc_module_init();
+
+#endif
@@ -40,9 +40,11 @@ static Value erase_native_function(int argCount, Value *args) {
 
 static Value init_native_function(int argCount, Value *args) {
   ObjList *list = create_list();
+  push(OBJ_VAL(list));
   for (int i = 0; i < AS_INT(args[0]); i++) {
     push_back_to_list(list, args[1]);
   }
+  pop();
   return OBJ_VAL(list);
 }
 
@@ -52,24 +54,14 @@ static Value len_native_function(int argCount, Value *args) {
   );
 }
 
-void add_module_list(const char* name, Value (*f)(int, Value*)) {
-  set_table(
-      &hvm.globals,
-      AS_STRING(
-        OBJ_VAL(
-          copy_string(name, (int)strlen(name))
-        )
-      ),
-      OBJ_VAL(
-        create_native(f)
-      )
-  );
+void add_module_list(const char* name, Value (*f)(int, Value*), const char* signature) {
+  define_native(name, f, signature);
 }
 
 void list_module_init() {
-  add_module_list("list:push_back", push_back_native_function);
-  add_module_list("list:erase", erase_native_function);
-  add_module_list("list:init", init_native_function);
-  add_module_list("list:len", len_native_function);
+  add_module_list("list:push_back", push_back_native_function, "la");
+  add_module_list("list:erase", erase_native_function, "li");
+  add_module_list("list:init", init_native_function, "ia");
+  add_module_list("list:len", len_native_function, "l");
 }
 
@@ -0,0 +1,58 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "map.h"
+#include "../../HVM.h"
+#include "../../value.h"
+#include "../../object.h"
+
+static Value has_native_function(int argCount, Value* args) {
+  Value value;
+  if (!is_hashable(args[1])) return BOOL_VAL(false);
+  return BOOL_VAL(get_from_map(AS_MAP(args[0]), args[1], &value));
+}
+
+static Value delete_native_function(int argCount, Value* args) {
+  if (!is_hashable(args[1])) return BOOL_VAL(false);
+  return BOOL_VAL(delete_from_map(AS_MAP(args[0]), args[1]));
+}
+
+// The keys or the values as a list, both in the same order.
+static Value to_list(ObjMap* map, bool keys) {
+  ObjList* list = create_list();
+  push(OBJ_VAL(list));
+  ValueTable* table = &map->table;
+  for (int i = 0; i < table->capacity; i++) {
+    if (!IS_FULL(table->control[i])) continue;
+    push_back_to_list(list, keys ? table->keys[i] : table->values[i]);
+  }
+  pop();
+  return OBJ_VAL(list);
+}
+
+static Value keys_native_function(int argCount, Value* args) {
+  return to_list(AS_MAP(args[0]), true);
+}
+
+static Value values_native_function(int argCount, Value* args) {
+  return to_list(AS_MAP(args[0]), false);
+}
+
+static Value len_native_function(int argCount, Value* args) {
+  return INT_VAL(AS_MAP(args[0])->table.size);
+}
+
+void add_module_map(const char* name, Value (*f)(int, Value*), const char* signature) {
+  define_native(name, f, signature);
+}
+
+void map_module_init() {
+  add_module_map("map:has", has_native_function, "ma");
+  add_module_map("map:delete", delete_native_function, "ma");
+  add_module_map("map:keys", keys_native_function, "m");
+  add_module_map("map:values", values_native_function, "m");
+  add_module_map("map:len", len_native_function, "m");
+}
@@ -0,0 +1,11 @@
+#ifndef map_module_h
+#define map_module_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+void map_module_init();
+
+#endif
@@ -138,37 +138,27 @@ static Value ln_native_function(int argCount, Value *args) {
   );
 }
 
-void add_module_math(const char* name, Value (*f)(int, Value*)) {
-  set_table(
-      &hvm.globals,
-      AS_STRING(
-        OBJ_VAL(
-          copy_string(name, (int)strlen(name))
-        )
-      ),
-      OBJ_VAL(
-        create_native(f)
-      )
-  );
+void add_module_math(const char* name, Value (*f)(int, Value*), const char* signature) {
+  define_native(name, f, signature);
 }
 
 void math_module_init() {
-  add_module_math("math:gcd", gcd_native_function);
-  add_module_math("math:lcm", lcm_native_function);
-  add_module_math("math:fac", fac_native_function);
-  add_module_math("math:ceil", ceil_native_function);
-  add_module_math("math:floor", floor_native_function);
-  add_module_math("math:abs", abs_native_function);
-  add_module_math("math:sin", sin_native_function);
-  add_module_math("math:cos", cos_native_function);
-  add_module_math("math:tan", tan_native_function);
-  add_module_math("math:atan2", atan2_native_function);
-  add_module_math("math:pi", pi_native_function);
-  add_module_math("math:to_radians", to_radians_native_function);
-  add_module_math("math:e", e_native_function);
-  add_module_math("math:golden_ratio", golden_ratio_native_function);
-  add_module_math("math:pow", power_native_function);
-  add_module_math("math:ln", ln_native_function);
-  add_module_math("math:log", log_native_function);
+  add_module_math("math:gcd", gcd_native_function, "ii");
+  add_module_math("math:lcm", lcm_native_function, "ii");
+  add_module_math("math:fac", fac_native_function, "i");
+  add_module_math("math:ceil", ceil_native_function, "d");
+  add_module_math("math:floor", floor_native_function, "d");
+  add_module_math("math:abs", abs_native_function, "n");
+  add_module_math("math:sin", sin_native_function, "d");
+  add_module_math("math:cos", cos_native_function, "d");
+  add_module_math("math:tan", tan_native_function, "d");
+  add_module_math("math:atan2", atan2_native_function, "dd");
+  add_module_math("math:pi", pi_native_function, "");
+  add_module_math("math:to_radians", to_radians_native_function, "d");
+  add_module_math("math:e", e_native_function, "");
+  add_module_math("math:golden_ratio", golden_ratio_native_function, "");
+  add_module_math("math:pow", power_native_function, "dd");
+  add_module_math("math:ln", ln_native_function, "d");
+  add_module_math("math:log", log_native_function, "dd");
 }
 
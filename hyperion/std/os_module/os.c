@@ -29,21 +29,11 @@ static Value getcwd_native_function(int argCount, Value *args) {
   }
 }
 
-void add_module_os(const char* name, Value (*f)(int, Value*)) {
-  set_table(
-      &hvm.globals,
-      AS_STRING(
-        OBJ_VAL(
-          copy_string(name, (int)strlen(name))
-        )
-      ),
-      OBJ_VAL(
-        create_native(f)
-      )
-  );
+void add_module_os(const char* name, Value (*f)(int, Value*), const char* signature) {
+  define_native(name, f, signature);
 }
 
 void os_module_init() {
-  add_module_os("os:getcwd", getcwd_native_function);
+  add_module_os("os:getcwd", getcwd_native_function, "");
 }
 
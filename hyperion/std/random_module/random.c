@@ -29,22 +29,12 @@ static Value srand_native_function(int argCount, Value *args) {
   return NIL_VAL;
 }
 
-void add_module_random(const char* name, Value (*f)(int, Value*)) {
-  set_table(
-      &hvm.globals,
-      AS_STRING(
-        OBJ_VAL(
-          copy_string(name, (int)strlen(name))
-        )
-      ),
-      OBJ_VAL(
-        create_native(f)
-      )
-  );
+void add_module_random(const char* name, Value (*f)(int, Value*), const char* signature) {
+  define_native(name, f, signature);
 }
 
 void random_module_init() {
-  add_module_random("random:rand", rand_native_function);
-  add_module_random("random:srand", srand_native_function);
+  add_module_random("random:rand", rand_native_function, "");
+  add_module_random("random:srand", srand_native_function, "i");
 }
 
@@ -0,0 +1,131 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "set.h"
+#include "../../HVM.h"
+#include "../../value.h"
+#include "../../object.h"
+
+static Value new_native_function(int argCount, Value* args) {
+  return OBJ_VAL(create_set());
+}
+
+// The set is made at the list's size, so filling it never grows it. A
+// list holding anything unhashable gives nil.
+static Value from_list_native_function(int argCount, Value* args) {
+  ObjList* list = AS_LIST(args[0]);
+  ObjSet* set = create_set();
+  push(OBJ_VAL(set));
+  value_table_reserve(&set->table, list->count);
+  for (int i = 0; i < list->count; i++) {
+    if (!is_hashable(list->items[i])) {
+      pop();
+      return NIL_VAL;
+    }
+    add_to_set(set, list->items[i]);
+  }
+  pop();
+  return OBJ_VAL(set);
+}
+
+static Value to_list_native_function(int argCount, Value* args) {
+  ValueTable* table = &AS_SET(args[0])->table;
+  ObjList* list = create_list();
+  push(OBJ_VAL(list));
+  for (int i = 0; i < table->capacity; i++) {
+    if (IS_FULL(table->control[i])) push_back_to_list(list, table->keys[i]);
+  }
+  pop();
+  return OBJ_VAL(list);
+}
+
+static Value add_native_function(int argCount, Value* args) {
+  if (!is_hashable(args[1])) return NIL_VAL;
+  return BOOL_VAL(add_to_set(AS_SET(args[0]), args[1]));
+}
+
+static Value has_native_function(int argCount, Value* args) {
+  if (!is_hashable(args[1])) return BOOL_VAL(false);
+  return BOOL_VAL(is_in_set(AS_SET(args[0]), args[1]));
+}
+
+static Value remove_native_function(int argCount, Value* args) {
+  if (!is_hashable(args[1])) return BOOL_VAL(false);
+  return BOOL_VAL(delete_from_set(AS_SET(args[0]), args[1]));
+}
+
+static Value len_native_function(int argCount, Value* args) {
+  return INT_VAL(AS_SET(args[0])->table.size);
+}
+
+// The bulk operations walk one table's slots and probe the other, without
+// going back to the interpreter per item. The new set stays on the stack
+// while it fills, and the items come from sets that are arguments.
+static Value union_native_function(int argCount, Value* args) {
+  ValueTable* a = &AS_SET(args[0])->table;
+  ValueTable* b = &AS_SET(args[1])->table;
+  ObjSet* set = create_set();
+  push(OBJ_VAL(set));
+  // Room for both, so even disjoint sets fill it without growing it.
+  value_table_reserve(&set->table, a->size + b->size);
+  for (int i = 0; i < a->capacity; i++) {
+    if (IS_FULL(a->control[i])) add_to_set(set, a->keys[i]);
+  }
+  for (int i = 0; i < b->capacity; i++) {
+    if (IS_FULL(b->control[i])) add_to_set(set, b->keys[i]);
+  }
+  pop();
+  return OBJ_VAL(set);
+}
+
+static Value intersection_native_function(int argCount, Value* args) {
+  ValueTable* a = &AS_SET(args[0])->table;
+  ValueTable* b = &AS_SET(args[1])->table;
+  // Walking the smaller set probes the larger one fewer times.
+  if (a->size > b->size) {
+    ValueTable* swap = a;
+    a = b;
+    b = swap;
+  }
+  ObjSet* set = create_set();
+  push(OBJ_VAL(set));
+  for (int i = 0; i < a->capacity; i++) {
+    if (!IS_FULL(a->control[i])) continue;
+    if (value_table_get(b, a->keys[i], NULL)) add_to_set(set, a->keys[i]);
+  }
+  pop();
+  return OBJ_VAL(set);
+}
+
+static Value difference_native_function(int argCount, Value* args) {
+  ValueTable* a = &AS_SET(args[0])->table;
+  ValueTable* b = &AS_SET(args[1])->table;
+  ObjSet* set = create_set();
+  push(OBJ_VAL(set));
+  for (int i = 0; i < a->capacity; i++) {
+    if (!IS_FULL(a->control[i])) continue;
+    if (!value_table_get(b, a->keys[i], NULL)) add_to_set(set, a->keys[i]);
+  }
+  pop();
+  return OBJ_VAL(set);
+}
+
+void add_module_set(const char* name, Value (*f)(int, Value*), const char* signature) {
+  define_native(name, f, signature);
+}
+
+void set_module_init() {
+  add_module_set("set:new", new_native_function, "");
+  add_module_set("set:from_list", from_list_native_function, "l");
+  add_module_set("set:to_list", to_list_native_function, "e");
+  add_module_set("set:add", add_native_function, "ea");
+  add_module_set("set:has", has_native_function, "ea");
+  add_module_set("set:remove", remove_native_function, "ea");
+  add_module_set("set:len", len_native_function, "e");
+  add_module_set("set:union", union_native_function, "ee");
+  add_module_set("set:intersection", intersection_native_function, "ee");
+  add_module_set("set:difference", difference_native_function, "ee");
+}
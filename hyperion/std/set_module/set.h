@@ -0,0 +1,11 @@
+#ifndef set_module_h
+#define set_module_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+void set_module_init();
+
+#endif
@@ -21,19 +21,25 @@ static Value make_string_string(char* str) {
 }
 
 char* char_to_string(char c) {
-    char* str = (char*)malloc(1);
+    char* str = (char*)malloc(2);
     if (str == NULL) {
       perror("Memory allocation error");
       exit(EXIT_FAILURE);
     }
     str[0] = c;
+    str[1] = '\0';
     return str;
 }
 
+static Value make_char_string(char c) {
+  char* str = char_to_string(c);
+  Value value = make_string_string(str);
+  free(str);
+  return value;
+}
+
 static Value chr_native_function(int argCount, Value *args) {
-  return make_string_string(
-      char_to_string((char)AS_INT(args[0]))
-  );
+  return make_char_string((char)AS_INT(args[0]));
 }
 
 static Value ord_native_function(int argCount, Value *args) {
@@ -43,16 +49,12 @@ static Value ord_native_function(int argCount, Value *args) {
 }
 
 static Value get_native_function(int argCount, Value *args) {
-  int index = ceil(
-    AS_INT(
-      args[1]
-    )
-  );
-  return make_string_string(
-    char_to_string(
-      AS_STRING(args[0])->chars[index]
-    )
-  );
+  ObjString* string = AS_STRING(args[0]);
+  int index = AS_INT(args[1]);
+  if (index < 0 || index >= string->size) {
+    return NIL_VAL;
+  }
+  return make_char_string(string->chars[index]);
 }
 
 static Value string_len_native_function(int argCount, Value *args) {
@@ -61,24 +63,14 @@ static Value string_len_native_function(int argCount, Value *args) {
   );
 }
 
-void add_module_string(const char* name, Value (*f)(int, Value*)) {
-  set_table(
-      &hvm.globals,
-      AS_STRING(
-        OBJ_VAL(
-          copy_string(name, (int)strlen(name))
-        )
-      ),
-      OBJ_VAL(
-        create_native(f)
-      )
-  );
+void add_module_string(const char* name, Value (*f)(int, Value*), const char* signature) {
+  define_native(name, f, signature);
 }
 
 void string_module_init() {
-  add_module_string("string:len", string_len_native_function);
-  add_module_string("string:ord", ord_native_function);
-  add_module_string("string:chr", chr_native_function);
-  add_module_string("string:get", get_native_function);
+  add_module_string("string:len", string_len_native_function, "s");
+  add_module_string("string:ord", ord_native_function, "s");
+  add_module_string("string:chr", chr_native_function, "i");
+  add_module_string("string:get", get_native_function, "si");
 }
 
@@ -22,9 +22,14 @@ static Value make_string_sys(char* str) {
 
 static Value get_argv_native_function(int argCount, Value *args) {
   ObjList* list = create_list();
+  push(OBJ_VAL(list));
   for (int i = 0; i < CLA.argc; i++) {
-    push_back_to_list(list, make_string_sys(CLA.argv[i]));
+    Value arg = make_string_sys(CLA.argv[i]);
+    push(arg);
+    push_back_to_list(list, arg);
+    pop();
   }
+  pop();
   return OBJ_VAL(list);
 }
 
@@ -32,22 +37,12 @@ static Value get_argc_native_function(int argCount, Value *args) {
   return INT_VAL(CLA.argc);
 }
 
-void add_module_sys(const char* name, Value (*f)(int, Value*)) {
-  set_table(
-      &hvm.globals,
-      AS_STRING(
-        OBJ_VAL(
-          copy_string(name, (int)strlen(name))
-        )
-      ),
-      OBJ_VAL(
-        create_native(f)
-      )
-  );
+void add_module_sys(const char* name, Value (*f)(int, Value*), const char* signature) {
+  define_native(name, f, signature);
 }
 
 void sys_module_init() {
-  add_module_sys("sys:get_argv", get_argv_native_function);
-  add_module_sys("sys:get_argc", get_argc_native_function);
+  add_module_sys("sys:get_argv", get_argv_native_function, "");
+  add_module_sys("sys:get_argc", get_argc_native_function, "");
 }
 
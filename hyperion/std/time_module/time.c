@@ -14,16 +14,6 @@ static Value clock_native_function(int argCount, Value* args) {
 }
 
 void time_module_init() {
-  set_table(
-      &hvm.globals,
-      AS_STRING(
-        OBJ_VAL(
-          copy_string("time:clock", (int)strlen("time:clock"))
-        )
-      ),
-      OBJ_VAL(
-        create_native(clock_native_function)
-      )
-  );
+  define_native("time:clock", clock_native_function, "");
 }
 
@@ -65,22 +65,12 @@ static Value to_string_native_function(int argCount, Value* args) {
   }
 }
 
-void add_module_type_conv(const char* name, Value (*f)(int, Value*)) {
-  set_table(
-      &hvm.globals,
-      AS_STRING(
-        OBJ_VAL(
-          copy_string(name, (int)strlen(name))
-        )
-      ),
-      OBJ_VAL(
-        create_native(f)
-      )
-  );
+void add_module_type_conv(const char* name, Value (*f)(int, Value*), const char* signature) {
+  define_native(name, f, signature);
 }
 
 void type_conversion_module_init() {
-  add_module_type_conv("type_conv:to_string", to_string_native_function);
-  add_module_type_conv("type_conv:to_double", to_double_native_function);
+  add_module_type_conv("type_conv:to_string", to_string_native_function, "a");
+  add_module_type_conv("type_conv:to_double", to_double_native_function, "n");
 }
 
@@ -1,139 +1,267 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "group.h"
 #include "memory.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
 
-#define TABLE_MAX_LOAD 0.75
-
 void init_table(Table *table) {
   table->size = 0;
+  table->tombstones = 0;
+  table->sparse_inserts = 0;
   table->capacity = 0;
-  table->entries = NULL;
+  table->control = NULL;
+  table->keys = NULL;
+  table->values = NULL;
 }
 
 void free_table(Table *table) {
-  FREE_ARRAY(Entry, table->entries, table->capacity);
+  if (table->capacity > 0) {
+    FREE_ARRAY(uint8_t, table->control, CONTROL_SIZE(table->capacity));
+    FREE_ARRAY(ObjString*, table->keys, table->capacity);
+    FREE_ARRAY(Value, table->values, table->capacity);
+  }
   init_table(table);
 }
 
-static Entry* find_entry(Entry *entries, int capacity, ObjString *key) {
-  // the core for the hash table
-  // for now using linear search
-  uint32_t index = key->hash & (capacity - 1);
-  Entry *tombstone = NULL;
+// The slot holding key, or -1. A group with an empty slot ends the probe,
+// since an insert would have stopped there.
+static int find_entry(Table* table, ObjString* key) {
+  uint32_t mask = (uint32_t)table->capacity - 1;
+  uint32_t position = HASH_START(key->hash) & mask;
+  uint32_t stride = 0;
+  uint8_t tag = HASH_TAG(key->hash);
   while (true) {
-    Entry* entry = &entries[index];
-    if (entry->key == NULL) {
-      if (IS_NIL(entry->value)) {
-        return tombstone != NULL ? tombstone : entry;
-      } else {
-        if (tombstone == NULL) tombstone = entry;
-      }
-    } else if (entry->key == key) {
-      return entry;
+    const uint8_t* group = table->control + position;
+    for (uint32_t match = match_tag(group, tag); match != 0; match &= match - 1) {
+      uint32_t index = (position + __builtin_ctz(match)) & mask;
+      if (table->keys[index] == key) return (int)index;
     }
-    index = (index + 1) & (capacity - 1);
+    if (match_empty(group) != 0) return -1;
+    PROBE_NEXT(position, stride, mask);
   }
 }
 
 bool table_get(Table* table, ObjString* key, Value* value) {
   if (table->size == 0) return false;
-  Entry* entry = find_entry(table->entries, table->capacity, key);
-  if (entry->key == NULL) return false;
-  *value = entry->value;
+  int index = find_entry(table, key);
+  if (index < 0) return false;
+  *value = table->values[index];
   return true;
 }
 
+// Rebuilds the table with capacity slots, which also clears the deleted
+// ones. Allocating can run a collection that deletes from the table, so the
+// table stays as it was until everything has been allocated.
 static void adjust_capacity(Table *table, int capacity) {
-  Entry *entries = ALLOCATE(Entry, capacity);
-  for (int i = 0; i < capacity; i++) {
-    entries[i].key = NULL;
-    entries[i].value = NIL_VAL;
-  }
+  uint8_t* control = ALLOCATE(uint8_t, CONTROL_SIZE(capacity));
+  ObjString** keys = ALLOCATE(ObjString*, capacity);
+  Value* values = ALLOCATE(Value, capacity);
+  memset(control, CONTROL_EMPTY, CONTROL_SIZE(capacity));
+
+  Table old = *table;
+  table->capacity = capacity;
   table->size = 0;
-  for (int i = 0; i < table->capacity; i++) {
-    Entry* entry = &table->entries[i];
-    if (entry->key == NULL) continue;
-
-    // this is why the hash table speed isn't always growing
-    // when the capacity is in need of growth we have to reinstall all the entries
-    Entry* dest = find_entry(entries, capacity, entry->key);
-    dest->key = entry->key;
-    dest->value = entry->value;
+  table->tombstones = 0;
+  table->sparse_inserts = 0;
+  table->control = control;
+  table->keys = keys;
+  table->values = values;
+
+  for (int i = 0; i < old.capacity; i++) {
+    if (!IS_FULL(old.control[i])) continue;
+    ObjString* key = old.keys[i];
+    int index = find_free_slot(table->control, table->capacity, key->hash);
+    set_control(table->control, table->capacity, index, HASH_TAG(key->hash));
+    table->keys[index] = key;
+    table->values[index] = old.values[i];
     table->size++;
   }
-  FREE_ARRAY(Entry, table->entries, table->capacity);
-  table->entries = entries;
-  table->capacity = capacity;
+
+  free_table(&old);
+}
+
+// Puts every key back where a probe for it goes first, which empties the
+// deleted slots without allocating. Keys not placed yet are marked deleted
+// while this runs, and a key whose new slot holds one swaps with it.
+static void rehash_in_place(Table* table) {
+  uint32_t mask = (uint32_t)table->capacity - 1;
+  uint8_t* control = table->control;
+  for (int i = 0; i < table->capacity; i++) {
+    if (control[i] == CONTROL_DELETED) {
+      control[i] = CONTROL_EMPTY;
+    } else if (IS_FULL(control[i])) {
+      control[i] = CONTROL_DELETED;
+    }
+  }
+  memcpy(control + table->capacity, control, GROUP_SIZE - 1);
+
+  for (int i = 0; i < table->capacity; i++) {
+    if (control[i] != CONTROL_DELETED) continue;
+    ObjString* key = table->keys[i];
+    uint32_t start = HASH_START(key->hash) & mask;
+    int index = find_free_slot(table->control, table->capacity, key->hash);
+
+    // Every group a probe reads before the free slot is full, so a key in
+    // the same group as it is found there already.
+    if (((i - start) & mask) / GROUP_SIZE == ((index - start) & mask) / GROUP_SIZE) {
+      set_control(table->control, table->capacity, i, HASH_TAG(key->hash));
+      continue;
+    }
+
+    Value value = table->values[i];
+    if (control[index] == CONTROL_EMPTY) {
+      set_control(table->control, table->capacity, i, CONTROL_EMPTY);
+      table->keys[i] = NULL;
+      table->values[i] = NIL_VAL;
+    } else {
+      table->keys[i] = table->keys[index];
+      table->values[i] = table->values[index];
+      i--;
+    }
+    set_control(table->control, table->capacity, index, HASH_TAG(key->hash));
+    table->keys[index] = key;
+    table->values[index] = value;
+  }
+  table->tombstones = 0;
 }
 
 bool set_table(Table *table, ObjString *key, Value value) {
-  if (table->size + 1 > table->capacity * TABLE_MAX_LOAD) {
-    int capacity = GROW_CAPACITY(table->capacity);
-    adjust_capacity(table, capacity);
+  if (table->size > 0) {
+    int index = find_entry(table, key);
+    if (index >= 0) {
+      table->values[index] = value;
+      return false;
+    }
+  }
+
+  if (table->size + table->tombstones + 1 > table->capacity * GROUP_MAX_LOAD) {
+    // Mostly deleted slots are cleared out in place rather than grown past.
+    if (table->capacity == 0) {
+      adjust_capacity(table, GROUP_SIZE);
+    } else if (table->size + 1 > table->capacity * GROUP_MAX_LOAD / 2) {
+      adjust_capacity(table, table->capacity * 2);
+    } else {
+      rehash_in_place(table);
+    }
+  } else if (table->capacity > GROUP_SIZE &&
+             table->size + 1 < table->capacity * GROUP_MAX_LOAD / 4) {
+    // A table most keys have left shrinks to half full or less once it has
+    // stayed that sparse for a while. The intern table empties at every
+    // collection and fills up again after it, and should keep its size.
+    if (++table->sparse_inserts > table->capacity / 2) {
+      int capacity = table->capacity;
+      while (capacity > GROUP_SIZE && table->size + 1 <= capacity / 2 * GROUP_MAX_LOAD / 2) {
+        capacity /= 2;
+      }
+      adjust_capacity(table, capacity);
+    }
+  } else {
+    table->sparse_inserts = 0;
   }
-  Entry *entry = find_entry(table->entries, table->capacity, key);
-  bool is_new = (entry->key == NULL);
-  if (is_new && IS_NIL(entry->value)) table->size++;
 
-  entry->key = key;
-  entry->value = value;
+  int index = find_free_slot(table->control, table->capacity, key->hash);
+  if (table->control[index] == CONTROL_DELETED) table->tombstones--;
+  set_control(table->control, table->capacity, index, HASH_TAG(key->hash));
+  table->keys[index] = key;
+  table->values[index] = value;
+  table->size++;
+  return true;
+}
 
-  return is_new;
+// Clears a slot a key has left.
+static void remove_slot(Table* table, int index) {
+  if (can_empty(table->control, table->capacity, index)) {
+    set_control(table->control, table->capacity, index, CONTROL_EMPTY);
+  } else {
+    set_control(table->control, table->capacity, index, CONTROL_DELETED);
+    table->tombstones++;
+  }
+  table->keys[index] = NULL;
+  table->values[index] = NIL_VAL;
+  table->size--;
 }
 
 bool table_delete(Table* table, ObjString* key) {
   if (table->size == 0) return false;
-  Entry* entry = find_entry(table->entries, table->capacity, key);
-  if (entry->key == NULL) return false;
-  entry->key = NULL;
-  entry->value = BOOL_VAL(true);
+  int index = find_entry(table, key);
+  if (index < 0) return false;
+  remove_slot(table, index);
   return true;
 }
 
+void table_clear_deleted(Table* table) {
+  if (table->tombstones > table->capacity / 8) rehash_in_place(table);
+}
+
 void table_add_all(Table *from, Table *to) {
   for (int i = 0; i < from->capacity; i++) {
-    Entry *entry = &from->entries[i];
-    if (entry->key != NULL) {
-      set_table(to, entry->key, entry->value);
+    if (IS_FULL(from->control[i])) {
+      set_table(to, from->keys[i], from->values[i]);
     }
   }
 }
 
 ObjString* table_find_string(Table* table, const char* chars, int size, uint32_t hash) {
   if (table->size == 0) return NULL;
-  uint32_t index = hash & (table->capacity - 1);
+  uint32_t mask = (uint32_t)table->capacity - 1;
+  uint32_t position = HASH_START(hash) & mask;
+  uint32_t stride = 0;
+  uint8_t tag = HASH_TAG(hash);
   while (true) {
-    Entry* entry = &table->entries[index];
-    if (entry->key == NULL) {
-      if (IS_NIL(entry->value)) return NULL;
-    } else if (entry->key->size == size &&
-               entry->key->hash == hash &&
-               memcmp(entry->key->chars, chars, size) == 0) {
-      return entry->key;
+    const uint8_t* group = table->control + position;
+    for (uint32_t match = match_tag(group, tag); match != 0; match &= match - 1) {
+      ObjString* key = table->keys[(position + __builtin_ctz(match)) & mask];
+      if (key->size == size && key->hash == hash && memcmp(key->chars, chars, size) == 0) {
+        return key;
+      }
     }
-
-    index = (index + 1) & (table->capacity - 1);
+    if (match_empty(group) != 0) return NULL;
+    PROBE_NEXT(position, stride, mask);
   }
 }
 
-void goodbye_white_table_friends(Table* table) {
-  for (int i = 0; i < table->capacity; i++) {
-    Entry* entry = &table->entries[i];
-    if (entry->key != NULL && !entry->key->obj.is_marked) {
-      table_delete(table, entry->key);
+// Drops the keys in slots start to end that were not marked. Ranges that
+// do not overlap can be cleared at the same time, which is why the slots are
+// left deleted: whether one can be emptied depends on slots in other ranges.
+void goodbye_white_table_friends(Table* table, int start, int end) {
+  int dropped = 0;
+  for (int i = start; i < end && i < table->capacity; i++) {
+    if (!IS_FULL(table->control[i])) continue;
+    if (!arena_is_marked(table->keys[i])) {
+      set_control(table->control, table->capacity, i, CONTROL_DELETED);
+      table->keys[i] = NULL;
+      table->values[i] = NIL_VAL;
+      dropped++;
     }
   }
+  if (dropped > 0) {
+    __atomic_sub_fetch(&table->size, dropped, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&table->tombstones, dropped, __ATOMIC_RELAXED);
+  }
 }
 
 void mark_table(Table* table) {
   for (int i = 0; i < table->capacity; i++) {
-    Entry* entry = &table->entries[i];
-    mark_object_memory((Obj*)entry->key);
-    mark_memory_slot(entry->value);
+    if (!IS_FULL(table->control[i])) continue;
+    mark_object_memory((Obj*)table->keys[i]);
+    mark_memory_slot(table->values[i]);
   }
 }
 
+void table_stats(Table* table, TableStats* stats) {
+  stats->size = table->size;
+  stats->tombstones = table->tombstones;
+  stats->capacity = table->capacity;
+  stats->longest_probe = 0;
+  long groups = 0;
+  for (int i = 0; i < table->capacity; i++) {
+    if (!IS_FULL(table->control[i])) continue;
+    int length = probe_length(table->capacity, table->keys[i]->hash, i);
+    groups += length;
+    if (length > stats->longest_probe) stats->longest_probe = length;
+  }
+  stats->average_probe = table->size > 0 ? (double)groups / table->size : 0;
+}
@@ -7,18 +7,32 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "group.h"
 #include "value.h"
 
+// Interned strings to values, in a Swiss table: see group.h.
 typedef struct {
-  ObjString* key;
-  Value value;
-} Entry;
+  // Keys in the table, and slots left deleted.
+  int size;
+  int tombstones;
+  // Keys added in a row while the table was sparse enough to shrink.
+  int sparse_inserts;
+  // Slots, a power of two and at least GROUP_SIZE, or 0.
+  int capacity;
+  uint8_t* control;
+  ObjString** keys;
+  Value* values;
+} Table;
 
+// What a table looks like inside, for checking how well it is probing. A
+// probe's length is how many groups it reads to find a key.
 typedef struct {
   int size;
+  int tombstones;
   int capacity;
-  Entry *entries;
-} Table;
+  double average_probe;
+  int longest_probe;
+} TableStats;
 
 void init_table(Table *table);
 void free_table(Table *table);
@@ -28,7 +42,11 @@ bool table_get(Table* table, ObjString* key, Value* value);
 void table_add_all(Table* from, Table* to);
 ObjString* table_find_string(Table* table, const char* chars, int size, uint32_t hash);
 
-void goodbye_white_table_friends(Table *table);
+void goodbye_white_table_friends(Table* table, int start, int end);
+// Rebuilds the table where it is once deleted slots take up an eighth of it.
+// This does not allocate, so a collection can call it.
+void table_clear_deleted(Table* table);
+void table_stats(Table* table, TableStats* stats);
 void mark_table(Table *table);
 
 #endif
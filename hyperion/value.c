@@ -31,14 +31,16 @@ void free_value_array(ValueArray *arr) {
 
 void print_value(Value v) {
 #ifdef NAN_BOXING
-  if (IS_BOOL(value)) {
-    printf(AS_BOOL(value) ? "true" : "false");
-  } else if (IS_NIL(value)) {
+  if (IS_BOOL(v)) {
+    printf(AS_BOOL(v) ? "true" : "false");
+  } else if (IS_NIL(v)) {
     printf("nil");
-  } else if (IS_NUMBER(value)) {
-    printf("%f", AS_NUMBER(value));
-  } else if (IS_OBJ(value)) {
-    print_object(value);
+  } else if (IS_INT(v)) {
+    printf("%i", AS_INT(v));
+  } else if (IS_DOUBLE(v)) {
+    printf("%g", AS_DOUBLE(v));
+  } else if (IS_OBJ(v)) {
+    print_object(v);
   }
 #else
   switch (v.type) {
@@ -63,8 +65,9 @@ void print_value(Value v) {
 
 bool are_equal(Value a, Value b) {
 #ifdef NAN_BOXING
-  if (IS_NUMBER(a) && IS_NUMBER(b)) {
-    return AS_NUMBER(a) == AS_NUMBER(b);
+  // Everything but doubles is equal exactly when the bits are.
+  if (IS_DOUBLE(a) && IS_DOUBLE(b)) {
+    return AS_DOUBLE(a) == AS_DOUBLE(b);
   }
   return a == b;
 #else
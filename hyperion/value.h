@@ -10,47 +10,75 @@
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 
+// Values are NaN-boxed into 8 bytes unless built with -DHVM_NO_NAN_BOXING,
+// which brings back the tagged union below.
+#if !defined(NAN_BOXING) && !defined(HVM_NO_NAN_BOXING)
+#define NAN_BOXING
+#endif
+
 #ifdef NAN_BOXING
 
+// A double is stored as itself. Everything else hides in the payload of a
+// quiet NaN that arithmetic never produces:
+//
+//   object  1 11111111111 11 00 <48-bit pointer>
+//   int     0 11111111111 11 01 0000 <32-bit int>
+//   nil     0 11111111111 11 00 ... 01
+//   false   0 11111111111 11 00 ... 10
+//   true    0 11111111111 11 00 ... 11
+//   undef   0 11111111111 11 00 ... 100  (never visible to scripts)
 #define QNAN     ((uint64_t)0x7ffc000000000000)
 #define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define TAG_INT  ((uint64_t)0x0001000000000000)
 #define TAG_NIL   1 // 01.
 #define TAG_FALSE 2 // 10.
 #define TAG_TRUE  3 // 11.
+#define TAG_UNDEFINED 4 // 100.
 
 typedef uint64_t Value;
 
-#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
-#define IS_NIL(value) ((value) == NIL_VAL)
-#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_BOOL(value)    (((value) | 1) == TRUE_VAL)
+#define IS_DOUBLE(value)  (((value) & QNAN) != QNAN)
+#define IS_INT(value)     (((value) & (SIGN_BIT | QNAN | TAG_INT)) == (QNAN | TAG_INT))
+#define IS_NIL(value)     ((value) == NIL_VAL)
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
 #define IS_OBJ(value) \
     (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
 
-#define AS_NUMBER(value) value_to_num(value)
+#define AS_BOOL(value)    ((value) == TRUE_VAL)
+#define AS_DOUBLE(value)  value_to_double(value)
+#define AS_INT(value)     ((int)(int32_t)(uint32_t)(value))
 #define AS_OBJ(value) \
     ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
-#define AS_BOOL(value) ((value) == TRUE_VAL)
 
-#define NUMBER_VAL(num) num_to_value(num)
-#define BOOL_VAL(b) ((b) ? TRUE_VAL : FALSE_VAL)
-#define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
-#define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
-#define NIL_VAL ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define BOOL_VAL(b)       ((b) ? TRUE_VAL : FALSE_VAL)
+#define DOUBLE_VAL(num)   double_to_value(num)
+#define INT_VAL(num)      int_to_value(num)
+#define FALSE_VAL         ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL          ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define NIL_VAL           ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define UNDEFINED_VAL     ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
 #define OBJ_VAL(obj) \
     (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
 
-static inline double value_to_num(Value value) {
+static inline double value_to_double(Value value) {
   double num;
   memcpy(&num, &value, sizeof(Value));
   return num;
 }
 
-static inline Value numToValue(double num) {
+static inline Value double_to_value(double num) {
   Value value;
   memcpy(&value, &num, sizeof(double));
   return value;
 }
 
+// Takes an int so callers passing a double get C's conversion, as they do
+// with the tagged union.
+static inline Value int_to_value(int num) {
+  return QNAN | TAG_INT | (uint64_t)(uint32_t)num;
+}
+
 #else
 
 typedef enum {
@@ -59,6 +87,7 @@ typedef enum {
   VAL_INT,
   VAL_OBJ,
   VAL_NIL,
+  VAL_UNDEFINED,
 } ValueType;
 
 typedef struct {
@@ -76,6 +105,7 @@ typedef struct {
 #define IS_INT(value)     ((value).type == VAL_INT)
 #define IS_NIL(value)     ((value).type == VAL_NIL)
 #define IS_OBJ(value)     ((value).type == VAL_OBJ)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
 
 #define AS_BOOL(value)    ((value).as.Boolean)
 #define AS_DOUBLE(value)  ((value).as.Double)
@@ -87,6 +117,7 @@ typedef struct {
 #define INT_VAL(value)    ((Value){VAL_INT, {.Integer = value}})
 #define OBJ_VAL(object)   ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 #define NIL_VAL           ((Value){VAL_NIL, {.Double = 0}})
+#define UNDEFINED_VAL     ((Value){VAL_UNDEFINED, {.Double = 0}})
 
 #endif
 
@@ -0,0 +1,177 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "group.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "value_table.h"
+
+bool is_hashable(Value value) {
+  return IS_INT(value) || IS_DOUBLE(value) || IS_BOOL(value) || IS_NIL(value) ||
+         IS_STRING(value);
+}
+
+// Spreads the bits of a hash over all 32, since probes take the group from
+// the upper ones and the tag from the lower seven.
+static inline uint32_t mix32(uint32_t hash) {
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6b;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+static inline uint32_t mix64(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return (uint32_t)hash;
+}
+
+uint32_t hash_value(Value value) {
+  if (IS_STRING(value)) return mix32(AS_STRING(value)->hash);
+  if (IS_INT(value)) return mix32((uint32_t)AS_INT(value));
+  if (IS_DOUBLE(value)) {
+    // -0.0 == 0.0, so both hash as 0.0.
+    double number = AS_DOUBLE(value) == 0 ? 0.0 : AS_DOUBLE(value);
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    return mix64(bits);
+  }
+  if (IS_BOOL(value)) return AS_BOOL(value) ? 0x9e3779b9u : 0x7f4a7c15u;
+  return 0x2545f491u;
+}
+
+void init_value_table(ValueTable* table, bool has_values) {
+  table->size = 0;
+  table->tombstones = 0;
+  table->capacity = 0;
+  table->has_values = has_values;
+  table->control = NULL;
+  table->keys = NULL;
+  table->values = NULL;
+}
+
+void free_value_table(ValueTable* table) {
+  if (table->capacity > 0) {
+    FREE_ARRAY(uint8_t, table->control, CONTROL_SIZE(table->capacity));
+    FREE_ARRAY(Value, table->keys, table->capacity);
+    if (table->has_values) FREE_ARRAY(Value, table->values, table->capacity);
+  }
+  init_value_table(table, table->has_values);
+}
+
+// The slot holding key, or -1.
+static int find_entry(ValueTable* table, Value key, uint32_t hash) {
+  uint32_t mask = (uint32_t)table->capacity - 1;
+  uint32_t position = HASH_START(hash) & mask;
+  uint32_t stride = 0;
+  uint8_t tag = HASH_TAG(hash);
+  while (true) {
+    const uint8_t* group = table->control + position;
+    for (uint32_t match = match_tag(group, tag); match != 0; match &= match - 1) {
+      uint32_t index = (position + __builtin_ctz(match)) & mask;
+      if (are_equal(table->keys[index], key)) return (int)index;
+    }
+    if (match_empty(group) != 0) return -1;
+    PROBE_NEXT(position, stride, mask);
+  }
+}
+
+bool value_table_get(ValueTable* table, Value key, Value* value) {
+  if (table->size == 0) return false;
+  int index = find_entry(table, key, hash_value(key));
+  if (index < 0) return false;
+  if (value != NULL) *value = table->values[index];
+  return true;
+}
+
+// Rebuilds the table with capacity slots. Allocating can run a collection
+// that marks the table, so it stays as it was until everything has been
+// allocated.
+static void adjust_capacity(ValueTable* table, int capacity) {
+  uint8_t* control = ALLOCATE(uint8_t, CONTROL_SIZE(capacity));
+  Value* keys = ALLOCATE(Value, capacity);
+  Value* values = table->has_values ? ALLOCATE(Value, capacity) : NULL;
+  memset(control, CONTROL_EMPTY, CONTROL_SIZE(capacity));
+
+  ValueTable old = *table;
+  table->capacity = capacity;
+  table->size = 0;
+  table->tombstones = 0;
+  table->control = control;
+  table->keys = keys;
+  table->values = values;
+
+  for (int i = 0; i < old.capacity; i++) {
+    if (!IS_FULL(old.control[i])) continue;
+    uint32_t hash = hash_value(old.keys[i]);
+    int index = find_free_slot(control, capacity, hash);
+    set_control(control, capacity, index, HASH_TAG(hash));
+    keys[index] = old.keys[i];
+    if (values != NULL) values[index] = old.values[i];
+    table->size++;
+  }
+
+  free_value_table(&old);
+}
+
+void value_table_reserve(ValueTable* table, int count) {
+  int capacity = table->capacity < GROUP_SIZE ? GROUP_SIZE : table->capacity;
+  while (count > capacity * GROUP_MAX_LOAD) capacity *= 2;
+  if (capacity > table->capacity) adjust_capacity(table, capacity);
+}
+
+bool value_table_set(ValueTable* table, Value key, Value value) {
+  uint32_t hash = hash_value(key);
+  if (table->size > 0) {
+    int index = find_entry(table, key, hash);
+    if (index >= 0) {
+      if (table->has_values) table->values[index] = value;
+      return false;
+    }
+  }
+
+  if (table->size + table->tombstones + 1 > table->capacity * GROUP_MAX_LOAD) {
+    // Mostly deleted slots are cleared out rather than grown past.
+    int capacity = table->capacity < GROUP_SIZE ? GROUP_SIZE : table->capacity;
+    if (table->size + 1 > capacity * GROUP_MAX_LOAD / 2) capacity *= 2;
+    adjust_capacity(table, capacity);
+  }
+
+  int index = find_free_slot(table->control, table->capacity, hash);
+  if (table->control[index] == CONTROL_DELETED) table->tombstones--;
+  set_control(table->control, table->capacity, index, HASH_TAG(hash));
+  table->keys[index] = key;
+  if (table->has_values) table->values[index] = value;
+  table->size++;
+  return true;
+}
+
+bool value_table_delete(ValueTable* table, Value key) {
+  if (table->size == 0) return false;
+  int index = find_entry(table, key, hash_value(key));
+  if (index < 0) return false;
+  if (can_empty(table->control, table->capacity, index)) {
+    set_control(table->control, table->capacity, index, CONTROL_EMPTY);
+  } else {
+    set_control(table->control, table->capacity, index, CONTROL_DELETED);
+    table->tombstones++;
+  }
+  table->keys[index] = NIL_VAL;
+  if (table->has_values) table->values[index] = NIL_VAL;
+  table->size--;
+  return true;
+}
+
+void mark_value_table(ValueTable* table) {
+  for (int i = 0; i < table->capacity; i++) {
+    if (!IS_FULL(table->control[i])) continue;
+    mark_memory_slot(table->keys[i]);
+    if (table->has_values) mark_memory_slot(table->values[i]);
+  }
+}
@@ -0,0 +1,45 @@
+#ifndef value_table_h
+#define value_table_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "group.h"
+#include "value.h"
+
+// Values to values, in a Swiss table like Table's: see group.h. Keys are
+// ints, doubles, bools, nil or strings, compared as == compares them.
+// Strings are interned, so they are compared by identity but hashed by
+// their contents, which keeps the layout the same from run to run. A table
+// made without values is a set of keys, and has no values array.
+typedef struct {
+  // Keys in the table, and slots left deleted.
+  int size;
+  int tombstones;
+  // Slots, a power of two and at least GROUP_SIZE, or 0.
+  int capacity;
+  bool has_values;
+  uint8_t* control;
+  Value* keys;
+  Value* values;
+} ValueTable;
+
+bool is_hashable(Value value);
+uint32_t hash_value(Value value);
+
+void init_value_table(ValueTable* table, bool has_values);
+void free_value_table(ValueTable* table);
+// Makes room for count keys in all, so adding up to that many more does not
+// grow the table again. Allocates, like value_table_set().
+void value_table_reserve(ValueTable* table, int count);
+// Whether key is in the table. value may be NULL, and is for sets.
+bool value_table_get(ValueTable* table, Value key, Value* value);
+// Returns whether the key is new. Growing the table allocates, so the
+// caller keeps key and value where the collector can see them.
+bool value_table_set(ValueTable* table, Value key, Value value);
+bool value_table_delete(ValueTable* table, Value key);
+void mark_value_table(ValueTable* table);
+
+#endif
@@ -1,12 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "hyperion/chunk.h"
 #include "hyperion/debug.h"
 #include "hyperion/HVM.h"
+#include "hyperion/memory.h"
 #include "hyperion/commandline.h"
 #include "hyperion/DMODE.h"
+#include "hyperion/compiler.h"
+#include "hyperion/emit_c.h"
+
+static bool gc_stats = false;
 
 static void repl() {
 	char line[1024];
@@ -56,8 +63,70 @@ static void run_file(const char* path) {
 	InterReport result = interpret(source);
 	free(source);
 
+#ifdef HVM_COUNT_INSTRUCTIONS
+	printf("== %zu instructions executed ==\n", hvm.instruction_count);
+#else
+	if (DMODE.mode) {
+		printf("== %zu instructions executed ==\n", hvm.instruction_count);
+	}
+#endif
+	if (DMODE.mode) {
+		printf("== inline caches: %zu hits, %zu misses ==\n",
+				hvm.cache_hits, hvm.cache_misses);
+	}
+	// On stderr, so it can be asked for without changing what a script prints.
+	if (gc_stats) print_gc_stats(stderr);
+
+	if (result == INTER_COMPILE_ERROR) exit(65);
+	if (result == INTER_RUNTIME_ERROR) exit(70);
+}
+
+// --prefork: the script's top level runs once as the init phase. What it
+// leaves is collected, and then each of the worker processes forked from
+// it calls the script's worker(id), id counting from 0. The workers share
+// the warmed up heap copy-on-write. The exit status is the worst of theirs.
+static void run_preforked(const char* path, int workers) {
+	char* source = get_source_content(path);
+	InterReport result = interpret(source);
+	free(source);
 	if (result == INTER_COMPILE_ERROR) exit(65);
 	if (result == INTER_RUNTIME_ERROR) exit(70);
+
+	take_out_garbage();
+	fflush(stdout);
+	fflush(stderr);
+
+	for (int id = 0; id < workers; id++) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("[ERROR] fork");
+			exit(71);
+		}
+		if (pid == 0) {
+			result = call_global("worker", INT_VAL(id));
+			if (gc_stats) print_gc_stats(stderr);
+			fflush(stdout);
+			_exit(result == INTER_OK ? 0 : 70);
+		}
+	}
+
+	int worst = 0;
+	int status;
+	while (wait(&status) > 0) {
+		int code = WIFEXITED(status) ? WEXITSTATUS(status) : 70;
+		if (code > worst) worst = code;
+	}
+	if (worst != 0) exit(worst);
+}
+
+// Writes the script as C to stdout instead of running it.
+static void emit_file(const char* path) {
+	char* source = get_source_content(path);
+	ObjFunction* function = compile(source);
+	free(source);
+
+	if (function == NULL) exit(65);
+	emit_c(function, stdout);
 }
 
 int main(int argc, char* argv[]) {
@@ -65,18 +134,62 @@ int main(int argc, char* argv[]) {
 	CLA.argv = argv;
 
 	DMODE.mode = false;
+	bool no_jit = false;
+	bool emit = false;
+	double gc_pause = GC_MAX_PAUSE;
+	int gc_threads = 1;
+	bool huge_pages = false;
+	int prefork = 0;
+	// The heap limit, in KB, and the growth factor can come from the
+	// environment too. The flags win.
+	const char* env_heap_limit = getenv("HYPL_GC_HEAP_LIMIT");
+	const char* env_growth = getenv("HYPL_GC_GROWTH");
+	long heap_limit = env_heap_limit != NULL ? atol(env_heap_limit) : -1;
+	double growth = env_growth != NULL ? atof(env_growth) : 0;
 	for (int i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "-d") == 0) {
 			DMODE.mode = true;
+		} else if (strcmp(argv[i], "--no-jit") == 0) {
+			no_jit = true;
+		} else if (strcmp(argv[i], "--emit-c") == 0) {
+			emit = true;
+		} else if (strncmp(argv[i], "-O", 2) == 0) {
+			optimize_level = argv[i][2] == '\0' ? 2 : atoi(argv[i] + 2);
+		} else if (strncmp(argv[i], "--gc-pause=", 11) == 0) {
+			gc_pause = atof(argv[i] + 11) / 1000;
+		} else if (strncmp(argv[i], "--gc-threads=", 13) == 0) {
+			gc_threads = atoi(argv[i] + 13);
+			if (gc_threads < 1) gc_threads = 1;
+			if (gc_threads > GC_MAX_THREADS) gc_threads = GC_MAX_THREADS;
+		} else if (strncmp(argv[i], "--gc-heap-limit=", 16) == 0) {
+			heap_limit = atol(argv[i] + 16);
+		} else if (strncmp(argv[i], "--gc-growth=", 12) == 0) {
+			growth = atof(argv[i] + 12);
+		} else if (strcmp(argv[i], "--gc-huge-pages") == 0) {
+			huge_pages = true;
+		} else if (strcmp(argv[i], "--prefork") == 0 && i + 1 < argc) {
+			prefork = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--gc-stats") == 0) {
+			gc_stats = true;
 		}
 	}
 
 	init_hvm();
+	if (no_jit) hvm.jit_enabled = false;
+	hvm.gc_max_pause = gc_pause;
+	hvm.gc_threads = gc_threads;
+	if (huge_pages) arena_use_huge_pages(&hvm.arena);
+	if (heap_limit >= 0) set_gc_heap_limit((size_t)heap_limit * 1024);
+	if (growth > 0) set_gc_grow_factor(growth);
 
 	if (argc == 1) {
 		repl();
 	} else {
-		if (argv[1][0] != '-') {
+		if (argv[1][0] != '-' && emit) {
+			emit_file(argv[1]);
+		} else if (argv[1][0] != '-' && prefork > 0) {
+			run_preforked(argv[1], prefork);
+		} else if (argv[1][0] != '-') {
 			run_file(argv[1]);
 		} else {
 			repl();